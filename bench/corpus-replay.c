@@ -0,0 +1,574 @@
+// Corpus replay benchmark: renders captured documents (+ their resources) N times per surface type,
+// reports p50/p95/p99 latency, throughput and peak RSS; can compare against a previous run.
+//
+// corpus directory layout:
+//   *.xml          documents, root element <surface width="..." height="...">
+//   resources      (optional) resources for all documents
+//   <name>.res     (optional) additional resources for <name>.xml
+// resource files: one per line, relative to the corpus directory, e.g.
+//   font font0 fonts/MarkOT-Black.otf
+//   image tex0 tex0.png
+#include "../xmlcairo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>  // getopt()
+#include <dirent.h>
+#include <sys/resource.h>  // getrusage()
+#include <cairo.h>
+#include <libxml/tree.h>
+#include <libxml/parser.h>
+#include <libxml/xmlIO.h>
+
+#define MAX_RESULTS 4096
+
+static double now_ms() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+// }}}
+
+static long peak_rss_kb() // {{{
+{
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) {
+    return -1;
+  }
+  return ru.ru_maxrss;  // (linux: kB)
+}
+// }}}
+
+// --- output sink (via xmlio: "replay-mem:" scheme), measures bytes only
+
+static size_t sink_len;
+
+static int sink_match(const char *filename) // {{{
+{
+  return strncmp(filename, "replay-mem:", 11) == 0;
+}
+// }}}
+
+static void *sink_open(const char *filename) // {{{
+{
+  (void)filename;
+  sink_len = 0;
+  return &sink_len;
+}
+// }}}
+
+static int sink_write(void *context, const char *buffer, int len) // {{{
+{
+  (void)context;
+  (void)buffer;
+  sink_len += len;
+  return len;
+}
+// }}}
+
+static int sink_close(void *context) // {{{
+{
+  (void)context;
+  return 0;
+}
+// }}}
+
+// --- corpus
+
+struct resource_s {
+  int is_font;
+  char *key, *filename;
+};
+
+struct document_s {
+  char *name;
+  char *data;
+  size_t len;
+  struct resource_s *res;
+  int num_res;
+};
+
+static char *read_file(const char *filename, size_t *ret_len) // {{{
+{
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    return NULL;
+  }
+  char *ret = NULL;
+  size_t len = 0, size = 0;
+  for (;;) {
+    if (len + 4096 > size) {
+      size = size ? 2 * size : 65536;
+      char *tmp = realloc(ret, size);
+      if (!tmp) {
+        free(ret);
+        fclose(f);
+        return NULL;
+      }
+      ret = tmp;
+    }
+    const size_t res = fread(ret + len, 1, size - len, f);
+    if (res == 0) {
+      break;
+    }
+    len += res;
+  }
+  fclose(f);
+  *ret_len = len;
+  return ret;
+}
+// }}}
+
+// appends to doc->res; missing file is not an error. returns 0 on success
+static int read_resources(struct document_s *doc, const char *dir, const char *filename) // {{{
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, filename);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return 0;
+  }
+
+  char line[4096], type[16], key[256], file[2048];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), f)) {
+    lineno++;
+    if (line[strspn(line, " \t\r\n")] == '#' || !line[strspn(line, " \t\r\n")]) {
+      continue;
+    }
+    if (sscanf(line, "%15s %255s %2047s", type, key, file) != 3 ||
+        (strcmp(type, "font") != 0 && strcmp(type, "image") != 0)) {
+      fprintf(stderr, "%s:%d: expected \"font|image <key> <file>\"\n", path, lineno);
+      fclose(f);
+      return -1;
+    }
+    struct resource_s *tmp = realloc(doc->res, (doc->num_res + 1) * sizeof(*tmp));
+    if (!tmp) {
+      fclose(f);
+      return -1;
+    }
+    doc->res = tmp;
+    struct resource_s *res = &doc->res[doc->num_res++];
+    res->is_font = (type[0] == 'f');
+    res->key = strdup(key);
+    char respath[4096];
+    snprintf(respath, sizeof(respath), "%s/%s", dir, file);
+    res->filename = strdup(respath);
+    if (!res->key || !res->filename) {
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+// }}}
+
+static int cmp_str(const void *a, const void *b) // {{{
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+// }}}
+
+// returns number of documents, or -1
+static int load_corpus(const char *dir, struct document_s **ret_docs) // {{{
+{
+  DIR *d = opendir(dir);
+  if (!d) {
+    fprintf(stderr, "could not open corpus directory %s\n", dir);
+    return -1;
+  }
+
+  char **names = NULL;
+  int num = 0;
+  for (struct dirent *ent; (ent = readdir(d)); ) {
+    const size_t len = strlen(ent->d_name);
+    if (len > 4 && strcmp(ent->d_name + len - 4, ".xml") == 0) {
+      char **tmp = realloc(names, (num + 1) * sizeof(*tmp));
+      if (!tmp) {
+        break;
+      }
+      names = tmp;
+      if (!(names[num] = strdup(ent->d_name))) {
+        break;
+      }
+      num++;
+    }
+  }
+  closedir(d);
+  qsort(names, num, sizeof(*names), cmp_str);  // (stable order for comparisons)
+
+  struct document_s *docs = calloc(num ? num : 1, sizeof(*docs));
+  if (!docs) {
+    return -1;
+  }
+  for (int i = 0; i < num; i++) {
+    char path[4096], resname[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    docs[i].name = names[i];
+    docs[i].data = read_file(path, &docs[i].len);
+    if (!docs[i].data) {
+      fprintf(stderr, "could not read %s\n", path);
+      return -1;
+    }
+    snprintf(resname, sizeof(resname), "%.*s.res", (int)strlen(names[i]) - 4, names[i]);
+    if (read_resources(&docs[i], dir, "resources") != 0 ||
+        read_resources(&docs[i], dir, resname) != 0) {
+      return -1;
+    }
+  }
+  free(names);
+
+  *ret_docs = docs;
+  return num;
+}
+// }}}
+
+static void free_corpus(struct document_s *docs, int num) // {{{
+{
+  for (int i = 0; i < num; i++) {
+    for (int j = 0; j < docs[i].num_res; j++) {
+      free(docs[i].res[j].key);
+      free(docs[i].res[j].filename);
+    }
+    free(docs[i].res);
+    free(docs[i].data);
+    free(docs[i].name);
+  }
+  free(docs);
+}
+// }}}
+
+// --- rendering
+
+static const char *surface_types[] = { "pdf", "png", "ps", "svg", "script" };
+
+static double get_dim(xmlNodePtr root, const char *name, double def) // {{{
+{
+  xmlChar *val = xmlGetNoNsProp(root, (const xmlChar *)name);
+  if (!val) {
+    return def;
+  }
+  const double ret = atof((const char *)val);
+  xmlFree(val);
+  return (ret > 0) ? ret : def;
+}
+// }}}
+
+static xmlcairo_surface_t *create_surface(const char *type, const char *filename, double width, double height) // {{{
+{
+  if (strcmp(type, "pdf") == 0) {
+    return xmlcairo_surface_create_pdf(filename, width, height);
+  } else if (strcmp(type, "png") == 0) {
+    return xmlcairo_surface_create_png(filename, CAIRO_FORMAT_ARGB32, width, height);
+  } else if (strcmp(type, "ps") == 0) {
+    return xmlcairo_surface_create_ps(filename, width, height);
+  } else if (strcmp(type, "svg") == 0) {
+    return xmlcairo_surface_create_svg(filename, width, height);
+  } else if (strcmp(type, "script") == 0) {
+    return xmlcairo_surface_create_script(filename, CAIRO_CONTENT_COLOR_ALPHA, width, height);
+  }
+  return NULL;
+}
+// }}}
+
+// parse + load resources + apply + encode; returns ms, or -1 on error
+static double render_one(const struct document_s *doc, const char *type, int verbose) // {{{
+{
+  const double start = now_ms();
+  xmlDocPtr xdoc = xmlReadMemory(doc->data, doc->len, doc->name, NULL, XML_PARSE_NONET);
+  xmlNodePtr root = xdoc ? xmlDocGetRootElement(xdoc) : NULL;
+  if (!root) {
+    if (verbose) {
+      fprintf(stderr, "%s: parse failed\n", doc->name);
+    }
+    xmlFreeDoc(xdoc);  // (accepts NULL)
+    return -1;
+  }
+
+  xmlcairo_surface_t *sfc = create_surface(type, "replay-mem:out", get_dim(root, "width", 1000), get_dim(root, "height", 1000));
+  if (!sfc) {
+    xmlFreeDoc(xdoc);
+    return -1;
+  }
+  for (int i = 0; i < doc->num_res; i++) {
+    const struct resource_s *res = &doc->res[i];
+    const cairo_status_t st = (res->is_font) ? xmlcairo_load_font(sfc, res->key, res->filename)
+                                             : xmlcairo_load_image(sfc, res->key, res->filename);
+    if (st != CAIRO_STATUS_SUCCESS && verbose) {
+      fprintf(stderr, "%s: failed to load %s\n", doc->name, res->filename);
+    }
+  }
+
+  cairo_status_t st = xmlcairo_apply_list(sfc, root->children);
+  if (st != CAIRO_STATUS_SUCCESS && verbose) {
+    fprintf(stderr, "%s: apply: %s\n", doc->name, cairo_status_to_string(st));
+  }
+  st = xmlcairo_surface_destroy(sfc);
+  xmlFreeDoc(xdoc);
+  if (st != CAIRO_STATUS_SUCCESS) {
+    if (verbose) {
+      fprintf(stderr, "%s: encode: %s\n", doc->name, cairo_status_to_string(st));
+    }
+    return -1;
+  }
+  return now_ms() - start;
+}
+// }}}
+
+// --- results
+
+struct result_s {
+  char type[8];
+  char *doc;  // "*": all documents
+  double p50, p95, p99;
+};
+
+static int cmp_double(const void *a, const void *b) // {{{
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+// }}}
+
+// nearest rank, vals must be sorted
+static double percentile(const double *vals, int n, double q) // {{{
+{
+  int idx = (int)(q * n + 0.999999) - 1;
+  if (idx < 0) {
+    idx = 0;
+  } else if (idx >= n) {
+    idx = n - 1;
+  }
+  return vals[idx];
+}
+// }}}
+
+static int set_result(struct result_s *res, const char *type, const char *doc, double *vals, int n) // {{{ returns 0 on malloc error
+{
+  qsort(vals, n, sizeof(*vals), cmp_double);
+  snprintf(res->type, sizeof(res->type), "%s", type);
+  res->doc = strdup(doc);
+  if (!res->doc) {
+    return 0;
+  }
+  res->p50 = percentile(vals, n, 0.50);
+  res->p95 = percentile(vals, n, 0.95);
+  res->p99 = percentile(vals, n, 0.99);
+  return 1;
+}
+// }}}
+
+static int write_results(const char *filename, const struct result_s *res, int num) // {{{
+{
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    return -1;
+  }
+  fprintf(f, "# type\tdoc\tp50_ms\tp95_ms\tp99_ms\n");
+  for (int i = 0; i < num; i++) {
+    fprintf(f, "%s\t%s\t%.4f\t%.4f\t%.4f\n", res[i].type, res[i].doc, res[i].p50, res[i].p95, res[i].p99);
+  }
+  return (fclose(f) == 0) ? 0 : -1;
+}
+// }}}
+
+// returns number of results, or -1
+static int read_results(const char *filename, struct result_s *res, int max) // {{{
+{
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    return -1;
+  }
+  char line[4096], doc[4096];
+  int num = 0;
+  while (num < max && fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') {
+      continue;
+    }
+    struct result_s *cur = &res[num];
+    if (sscanf(line, "%7s\t%4095[^\t]\t%lf\t%lf\t%lf", cur->type, doc, &cur->p50, &cur->p95, &cur->p99) == 5) {
+      cur->doc = strdup(doc);
+      if (!cur->doc) {
+        while (num > 0) {
+          free(res[--num].doc);
+        }
+        fclose(f);
+        return -1;
+      }
+      num++;
+    }
+  }
+  fclose(f);
+  return num;
+}
+// }}}
+
+// prints changes beyond threshold (relative) and noise floor; returns number of regressions
+static int compare_results(const struct result_s *base, int num_base, const struct result_s *cur, int num_cur, double threshold, double floor_ms) // {{{
+{
+  int regressions = 0;
+  printf("# compare: threshold %+.0f%%, noise floor %.3f ms\n", threshold * 100, floor_ms);
+  for (int i = 0; i < num_cur; i++) {
+    const struct result_s *b = NULL;
+    for (int j = 0; j < num_base; j++) {
+      if (strcmp(base[j].type, cur[i].type) == 0 && strcmp(base[j].doc, cur[i].doc) == 0) {
+        b = &base[j];
+        break;
+      }
+    }
+    if (!b) {
+      continue;
+    }
+
+    static const char *names[] = { "p50", "p99" };
+    const double bv[] = { b->p50, b->p99 }, cv[] = { cur[i].p50, cur[i].p99 };
+    for (int k = 0; k < 2; k++) {
+      if (bv[k] <= 0 || fabs(cv[k] - bv[k]) < floor_ms) {
+        continue;
+      }
+      const double rel = cv[k] / bv[k] - 1.0;
+      if (rel > threshold) {
+        printf("REGRESSION %-6s %-32s %s %9.3f -> %9.3f ms (%+.1f%%)\n", cur[i].type, cur[i].doc, names[k], bv[k], cv[k], rel * 100);
+        regressions++;
+      } else if (rel < -threshold) {
+        printf("improved   %-6s %-32s %s %9.3f -> %9.3f ms (%+.1f%%)\n", cur[i].type, cur[i].doc, names[k], bv[k], cv[k], rel * 100);
+      }
+    }
+  }
+  return regressions;
+}
+// }}}
+
+static void usage(const char *argv0) // {{{
+{
+  fprintf(stderr,
+          "Usage: %s [-r reps] [-t type] [-o results.tsv] [-c baseline.tsv] [-x threshold%%] [-v] corpusdir\n"
+          "  types: pdf png ps svg script (default: all)\n"
+          "  renders every document reps times (parse + resource load + apply + encode),\n"
+          "  reports per type p50/p95/p99 ms, docs/s, output MB/s and peak RSS;\n"
+          "  -o saves per-document percentiles, -c compares against saved ones (exit code 2 on regression)\n", argv0);
+}
+// }}}
+
+int main(int argc, char **argv)
+{
+  int reps = 10, verbose = 0;
+  const char *only_type = NULL, *outfile = NULL, *basefile = NULL;
+  double threshold = 0.10;
+
+  int c;
+  while ((c = getopt(argc, argv, "r:t:o:c:x:vh")) != -1) {
+    switch (c) {
+    case 'r': reps = atoi(optarg); break;
+    case 't': only_type = optarg; break;
+    case 'o': outfile = optarg; break;
+    case 'c': basefile = optarg; break;
+    case 'x': threshold = atof(optarg) / 100.0; break;
+    case 'v': verbose = 1; break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (reps <= 0 || optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct document_s *docs;
+  const int num_docs = load_corpus(argv[optind], &docs);
+  if (num_docs <= 0) {
+    fprintf(stderr, "no documents in %s\n", argv[optind]);
+    return 1;
+  }
+
+  xmlRegisterDefaultOutputCallbacks();
+  xmlRegisterOutputCallbacks(sink_match, sink_open, sink_write, sink_close);
+
+  const int num_types = sizeof(surface_types) / sizeof(*surface_types);
+  struct result_s *results = calloc((num_docs + 1) * num_types, sizeof(*results));  // (per document, and "*" per type)
+  double *all = malloc(num_docs * reps * sizeof(double)), *one = malloc(reps * sizeof(double));
+  if (!results || !all || !one) {
+    return 1;
+  }
+  int num_results = 0;
+
+  printf("# %d documents, %d reps, rss_kb before: %ld\n", num_docs, reps, peak_rss_kb());
+  printf("%-7s %9s %9s %9s %9s %9s %6s\n", "type", "p50", "p95", "p99", "docs/s", "MB/s", "errors");
+
+  for (int t = 0; t < num_types; t++) {
+    const char *type = surface_types[t];
+    if (only_type && strcmp(only_type, type) != 0) {
+      continue;
+    }
+
+    int num_all = 0, errors = 0;
+    double total_ms = 0;
+    size_t total_bytes = 0;
+    for (int d = 0; d < num_docs; d++) {
+      int num_one = 0;
+      for (int r = 0; r < reps; r++) {
+        const double ms = render_one(&docs[d], type, verbose && r == 0);
+        if (ms < 0) {
+          errors++;
+          continue;
+        }
+        one[num_one++] = all[num_all++] = ms;
+        total_ms += ms;
+        total_bytes += sink_len;
+      }
+      if (num_one && !set_result(&results[num_results++], type, docs[d].name, one, num_one)) {
+        return 1;
+      }
+    }
+    if (!num_all) {
+      printf("%-7s (all renders failed)\n", type);
+      continue;
+    }
+
+    struct result_s *agg = &results[num_results++];
+    if (!set_result(agg, type, "*", all, num_all)) {
+      return 1;
+    }
+    printf("%-7s %9.3f %9.3f %9.3f %9.1f %9.2f %6d\n",
+           type, agg->p50, agg->p95, agg->p99, num_all / (total_ms * 1e-3),
+           total_bytes / (total_ms * 1e-3) / 1e6, errors);
+  }
+  // (getrusage: high-water mark of the whole process, i.e. of all types so far, not per type)
+  printf("# process peak rss_kb: %ld\n", peak_rss_kb());
+
+  int ret = 0;
+  if (outfile && write_results(outfile, results, num_results) != 0) {
+    fprintf(stderr, "could not write %s\n", outfile);
+    ret = 1;
+  }
+  if (basefile) {
+    struct result_s *base = calloc(MAX_RESULTS, sizeof(*base));
+    const int num_base = base ? read_results(basefile, base, MAX_RESULTS) : -1;
+    if (num_base < 0) {
+      fprintf(stderr, "could not read %s\n", basefile);
+      ret = 1;
+    } else if (compare_results(base, num_base, results, num_results, threshold, 0.05) > 0) {
+      ret = 2;
+    }
+    for (int i = 0; i < num_base; i++) {
+      free(base[i].doc);
+    }
+    free(base);
+  }
+
+  for (int i = 0; i < num_results; i++) {
+    free(results[i].doc);
+  }
+  free(results);
+  free(all);
+  free(one);
+  free_corpus(docs, num_docs);
+  xmlCleanupParser();
+  return ret;
+}
+
@@ -0,0 +1,430 @@
+// Microbenchmarks for the svg parsers and the GPOS pair lookup, without cairo drawing:
+// parse_svg_path (no-op builder), parse_svg_transform, parse_svg_cairo_dasharray, gpos_pair_lookup_get.
+#include "../parse-svg.h"
+#include "../parse-svg-cairo.h"
+#include "../gposkern.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>  // getopt()
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+
+#define MIN_MS 200.0
+#define RUNS 5
+
+static double now_ms() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+// }}}
+
+static unsigned int rnd_state = 42;
+static double rnd(double lo, double hi) // {{{
+{
+  rnd_state = rnd_state * 1103515245u + 12345u;
+  return lo + (hi - lo) * ((rnd_state >> 8) & 0xffff) / 65535.0;
+}
+// }}}
+
+struct strbuf_s {
+  char *data;
+  size_t len, size;
+  long numbers;  // generated numeric tokens
+};
+
+static void sbprintf(struct strbuf_s *sb, int numbers, const char *fmt, ...) // {{{
+{
+  va_list ap;
+  va_start(ap, fmt);
+  const int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (sb->len + len + 1 > sb->size) {
+    size_t new_size = sb->size ? sb->size : 4096;
+    while (new_size < sb->len + len + 1) {
+      new_size *= 2;
+    }
+    char *tmp = realloc(sb->data, new_size);
+    if (!tmp) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+    sb->data = tmp;
+    sb->size = new_size;
+  }
+  va_start(ap, fmt);
+  vsnprintf(sb->data + sb->len, len + 1, fmt, ap);
+  va_end(ap);
+  sb->len += len;
+  sb->numbers += numbers;
+}
+// }}}
+
+// --- runner
+
+typedef long (*bench_fn_t)(void *user);  // returns work units (for sanity / anti-dce)
+
+// runs fn until MIN_MS has passed, RUNS times; returns median ms per call
+static double run_bench(bench_fn_t fn, void *user) // {{{
+{
+  long iters = 1;
+  volatile long sink = 0;
+  for (;;) { // calibrate
+    const double start = now_ms();
+    for (long i = 0; i < iters; i++) {
+      sink += fn(user);
+    }
+    if (now_ms() - start >= MIN_MS / 4 || iters >= (1L << 30)) {
+      break;
+    }
+    iters *= 2;
+  }
+
+  double t[RUNS];
+  for (int r = 0; r < RUNS; r++) {
+    const double start = now_ms();
+    for (long i = 0; i < iters; i++) {
+      sink += fn(user);
+    }
+    t[r] = (now_ms() - start) / iters;
+  }
+  (void)sink;
+
+  // median (insertion sort)
+  for (int i = 1; i < RUNS; i++) {
+    for (int j = i; j > 0 && t[j - 1] > t[j]; j--) {
+      const double tmp = t[j];
+      t[j] = t[j - 1];
+      t[j - 1] = tmp;
+    }
+  }
+  return t[RUNS / 2];
+}
+// }}}
+
+static void report(const char *name, double ms, size_t bytes, long numbers, const char *unit) // {{{
+{
+  printf("%-28s %10.4f ms  %9.2f MB/s  %12.0f %s/s\n",
+         name, ms, bytes / (ms * 1e-3) / 1e6, numbers / (ms * 1e-3), unit);
+}
+// }}}
+
+// --- svg path
+
+static long pb_calls;
+static void _pbnop_move_to(void *user, float x, float y) { (void)user; (void)x; (void)y; pb_calls++; }
+static void _pbnop_line_to(void *user, float x, float y) { (void)user; (void)x; (void)y; pb_calls++; }
+static void _pbnop_quad_to(void *user, float cx0, float cy0, float x, float y) { (void)user; (void)cx0; (void)cy0; (void)x; (void)y; pb_calls++; }
+static void _pbnop_curve_to(void *user, float cx0, float cy0, float cx1, float cy1, float x, float y) { (void)user; (void)cx0; (void)cy0; (void)cx1; (void)cy1; (void)x; (void)y; pb_calls++; }
+static void _pbnop_arc_to(void *user, float cx, float cy, float rx, float ry, float phi, float start, float delta) { (void)user; (void)cx; (void)cy; (void)rx; (void)ry; (void)phi; (void)start; (void)delta; pb_calls++; }
+static void _pbnop_close(void *user) { (void)user; pb_calls++; }
+
+static const struct _path_builder_t pbnop = {
+  &_pbnop_move_to,
+  &_pbnop_line_to,
+  &_pbnop_quad_to,
+  &_pbnop_curve_to,
+  &_pbnop_arc_to,
+  &_pbnop_close
+};
+
+static long bench_path(void *user) // {{{
+{
+  const struct strbuf_s *sb = user;
+  pb_calls = 0;
+  if (parse_svg_path(sb->data, &pbnop, NULL) >= 0) {
+    fprintf(stderr, "path parse error\n");
+    exit(1);
+  }
+  return pb_calls;
+}
+// }}}
+
+// kind: 0 = lines (absolute), 1 = mixed relative curves, 2 = arcs
+static void gen_path(struct strbuf_s *sb, int kind, int n) // {{{
+{
+  sbprintf(sb, 2, "M %.3f,%.3f", rnd(0, 1000), rnd(0, 1000));
+  for (int i = 0; i < n; i++) {
+    switch (kind) {
+    case 0:
+      sbprintf(sb, 2, " L %.3f,%.3f", rnd(0, 1000), rnd(0, 1000));
+      break;
+    case 1:
+      if (i & 1) {
+        sbprintf(sb, 6, " c %.2f,%.2f %.2f,%.2f %.2f,%.2f", rnd(-50, 50), rnd(-50, 50), rnd(-50, 50), rnd(-50, 50), rnd(-50, 50), rnd(-50, 50));
+      } else {
+        sbprintf(sb, 4, " q%.2f %.2f %.2f %.2f", rnd(-50, 50), rnd(-50, 50), rnd(-50, 50), rnd(-50, 50));
+      }
+      break;
+    case 2:
+      sbprintf(sb, 7, " A %.2f,%.2f %.1f %d,%d %.2f,%.2f", rnd(1, 80), rnd(1, 80), rnd(0, 90), i & 1, (i >> 1) & 1, rnd(0, 1000), rnd(0, 1000));
+      break;
+    }
+  }
+  sbprintf(sb, 0, " z");
+}
+// }}}
+
+// --- svg transform
+
+static long tb_calls;
+static void _tbnop_matrix(void *user, float a, float b, float c, float d, float e, float f) { (void)user; (void)a; (void)b; (void)c; (void)d; (void)e; (void)f; tb_calls++; }
+static void _tbnop_translate(void *user, float x, float y) { (void)user; (void)x; (void)y; tb_calls++; }
+static void _tbnop_scale(void *user, float x, float y) { (void)user; (void)x; (void)y; tb_calls++; }
+static void _tbnop_rotate(void *user, float a, float x, float y) { (void)user; (void)a; (void)x; (void)y; tb_calls++; }
+static void _tbnop_skewX(void *user, float ax) { (void)user; (void)ax; tb_calls++; }
+static void _tbnop_skewY(void *user, float ay) { (void)user; (void)ay; tb_calls++; }
+
+static const struct _transform_builder_t tbnop = {
+  &_tbnop_matrix,
+  &_tbnop_translate,
+  &_tbnop_scale,
+  &_tbnop_rotate,
+  &_tbnop_skewX,
+  &_tbnop_skewY
+};
+
+struct strlist_s {
+  char **strs;
+  int num;
+  size_t bytes;
+  long numbers;
+};
+
+static long bench_transform(void *user) // {{{
+{
+  const struct strlist_s *sl = user;
+  tb_calls = 0;
+  for (int i = 0; i < sl->num; i++) {
+    if (parse_svg_transform(sl->strs[i], &tbnop, NULL) >= 0) {
+      fprintf(stderr, "transform parse error: %s\n", sl->strs[i]);
+      exit(1);
+    }
+  }
+  return tb_calls;
+}
+// }}}
+
+static void gen_transforms(struct strlist_s *sl, int n) // {{{
+{
+  sl->strs = calloc(n, sizeof(char *));
+  if (!sl->strs) {
+    exit(1);
+  }
+  for (int i = 0; i < n; i++) {
+    struct strbuf_s sb = {};
+    switch (i % 4) {
+    case 0:
+      sbprintf(&sb, 2, "translate(%.2f,%.2f)", rnd(-500, 500), rnd(-500, 500));
+      break;
+    case 1:
+      sbprintf(&sb, 5, "translate(%.2f %.2f) rotate(%.1f) scale(%.3f,%.3f)", rnd(-500, 500), rnd(-500, 500), rnd(0, 360), rnd(0.1, 3), rnd(0.1, 3));
+      break;
+    case 2:
+      sbprintf(&sb, 6, "matrix(%.4f,%.4f,%.4f,%.4f,%.2f,%.2f)", rnd(-1, 1), rnd(-1, 1), rnd(-1, 1), rnd(-1, 1), rnd(-500, 500), rnd(-500, 500));
+      break;
+    case 3:
+      sbprintf(&sb, 4, "rotate(%.1f, %.2f, %.2f) skewX(%.1f)", rnd(0, 360), rnd(0, 100), rnd(0, 100), rnd(-30, 30));
+      break;
+    }
+    sl->strs[i] = sb.data;
+    sl->bytes += sb.len;
+    sl->numbers += sb.numbers;
+  }
+  sl->num = n;
+}
+// }}}
+
+// --- dasharray
+
+static long bench_dasharray(void *user) // {{{
+{
+  const struct strlist_s *sl = user;
+  long ret = 0;
+  for (int i = 0; i < sl->num; i++) {
+    struct cairo_svg_dasharray_s da = {};
+    if (parse_svg_cairo_dasharray(&da, sl->strs[i]) >= 0) {
+      fprintf(stderr, "dasharray parse error: %s\n", sl->strs[i]);
+      exit(1);
+    }
+    ret += da.num_dashes;
+    free_dasharray(&da);
+  }
+  return ret;
+}
+// }}}
+
+static void gen_dasharrays(struct strlist_s *sl, int n) // {{{
+{
+  sl->strs = calloc(n, sizeof(char *));
+  if (!sl->strs) {
+    exit(1);
+  }
+  for (int i = 0; i < n; i++) {
+    struct strbuf_s sb = {};
+    const int len = 1 + (i % 8);
+    for (int j = 0; j < len; j++) {
+      sbprintf(&sb, 1, (j == 0) ? "%.2f" : (j & 1) ? ", %.2f" : " %.2f", rnd(0, 20));
+    }
+    sl->strs[i] = sb.data;
+    sl->bytes += sb.len;
+    sl->numbers += sb.numbers;
+  }
+  sl->num = n;
+}
+// }}}
+
+static void free_strlist(struct strlist_s *sl) // {{{
+{
+  for (int i = 0; i < sl->num; i++) {
+    free(sl->strs[i]);
+  }
+  free(sl->strs);
+}
+// }}}
+
+// --- gpos
+
+struct gpos_bench_s {
+  const gpos_pair_lookup_t *gpl;
+  unsigned short *pairs;  // [2 * num]
+  int num;
+};
+
+static long bench_gpos(void *user) // {{{
+{
+  const struct gpos_bench_s *gb = user;
+  long ret = 0;
+  for (int i = 0; i < gb->num; i++) {
+    ret += gpos_pair_lookup_get(gb->gpl, gb->pairs[2 * i], gb->pairs[2 * i + 1]);
+  }
+  return ret;
+}
+// }}}
+
+// returns 0 on success (or when font has no GPOS)
+static int bench_gpos_font(FT_Library library, const char *filename, int n) // {{{
+{
+  FT_Face face;
+  if (FT_New_Face(library, filename, 0, &face) != 0) {
+    fprintf(stderr, "Could not open font %s\n", filename);
+    return -1;
+  }
+
+  FT_ULong length = 0;
+  if (FT_Load_Sfnt_Table(face, TTAG_GPOS, 0, NULL, &length) != 0) {
+    printf("# %s: no GPOS table\n", filename);
+    FT_Done_Face(face);
+    return 0;
+  }
+  unsigned char *gpos = malloc(length);
+  if (!gpos || FT_Load_Sfnt_Table(face, TTAG_GPOS, 0, gpos, &length) != 0) {
+    free(gpos);
+    FT_Done_Face(face);
+    return -1;
+  }
+
+  gpos_pair_lookup_t *gpl = gpos_pair_lookup_create(gpos, length, NULL, NULL);
+  if (!gpl) {
+    printf("# %s: GPOS not supported\n", filename);
+    free(gpos);
+    FT_Done_Face(face);
+    return 0;
+  }
+
+  struct gpos_bench_s gb = { gpl, malloc(2 * n * sizeof(unsigned short)), n };
+  if (!gb.pairs) {
+    exit(1);
+  }
+
+  // realistic: pairs of (ascii) letters
+  static const char text[] = "AVAWAYTeToVaWaYoLTPAFaKerning: The Quick Brown Fox Jumps Over The Lazy Dog.";
+  for (int i = 0; i < n; i++) {
+    gb.pairs[2 * i] = FT_Get_Char_Index(face, text[i % (sizeof(text) - 2)]);
+    gb.pairs[2 * i + 1] = FT_Get_Char_Index(face, text[i % (sizeof(text) - 2) + 1]);
+  }
+  const double ms_text = run_bench(bench_gpos, &gb);
+
+  // uniform random gids
+  for (int i = 0; i < 2 * n; i++) {
+    gb.pairs[i] = (unsigned short)rnd(0, face->num_glyphs - 1);
+  }
+  const double ms_rand = run_bench(bench_gpos, &gb);
+
+  const char *base = strrchr(filename, '/');
+  base = base ? base + 1 : filename;
+  char name[64];
+  snprintf(name, sizeof(name), "gpos text %.18s", base);
+  report(name, ms_text, 0, n, "lookups");
+  snprintf(name, sizeof(name), "gpos random %.16s", base);
+  report(name, ms_rand, 0, n, "lookups");
+
+  free(gb.pairs);
+  gpos_pair_lookup_destroy(gpl);
+  free(gpos);
+  FT_Done_Face(face);
+  return 0;
+}
+// }}}
+
+int main(int argc, char **argv)
+{
+  int n = 10000;
+  int c;
+  while ((c = getopt(argc, argv, "n:h")) != -1) {
+    switch (c) {
+    case 'n': n = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-n count] [fontfile...]\n"
+                      "  fontfiles: used for the gpos_pair_lookup_get benchmark\n", argv[0]);
+      return 1;
+    }
+  }
+  if (n <= 0) {
+    return 1;
+  }
+
+  printf("# n=%d, median of %d runs\n", n, RUNS);
+
+  static const char *path_names[] = { "parse_svg_path lines", "parse_svg_path curves", "parse_svg_path arcs" };
+  for (int kind = 0; kind < 3; kind++) {
+    struct strbuf_s sb = {};
+    gen_path(&sb, kind, n);
+    report(path_names[kind], run_bench(bench_path, &sb), sb.len, sb.numbers, "numbers");
+    free(sb.data);
+  }
+
+  struct strlist_s sl = {};
+  gen_transforms(&sl, n);
+  report("parse_svg_transform", run_bench(bench_transform, &sl), sl.bytes, sl.numbers, "numbers");
+  free_strlist(&sl);
+
+  memset(&sl, 0, sizeof(sl));
+  gen_dasharrays(&sl, n);
+  report("parse_svg_cairo_dasharray", run_bench(bench_dasharray, &sl), sl.bytes, sl.numbers, "numbers");
+  free_strlist(&sl);
+
+  if (optind < argc) {
+    FT_Library library;
+    if (FT_Init_FreeType(&library) != 0) {
+      fprintf(stderr, "Failed to initialize FreeType\n");
+      return 1;
+    }
+    for (int i = optind; i < argc; i++) {
+      bench_gpos_font(library, argv[i], n);
+    }
+    FT_Done_FreeType(library);
+  } else {
+    printf("# gpos_pair_lookup_get: skipped (no fontfile given)\n");
+  }
+
+  return 0;
+}
+
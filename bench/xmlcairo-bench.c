@@ -0,0 +1,432 @@
+// Synthetic workload benchmark: times parse / apply / encode / write separately
+// for generated documents, across all surface types.
+#include "../xmlcairo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>  // getopt()
+#include <cairo.h>
+#include <libxml/tree.h>
+#include <libxml/parser.h>
+#include <libxml/xmlIO.h>
+
+#define WIDTH 1024
+#define HEIGHT 768
+
+static double now_ms() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+// }}}
+
+// deterministic, so runs are comparable
+static unsigned int rnd_state;
+static double rnd(double lo, double hi) // {{{
+{
+  rnd_state = rnd_state * 1103515245u + 12345u;
+  return lo + (hi - lo) * ((rnd_state >> 8) & 0xffff) / 65535.0;
+}
+// }}}
+
+// --- output sink (via xmlio: "bench-mem:" scheme)
+
+static struct {
+  char *data;
+  size_t len, size;
+} sink;
+
+static int sink_match(const char *filename) // {{{
+{
+  return strncmp(filename, "bench-mem:", 10) == 0;
+}
+// }}}
+
+static void *sink_open(const char *filename) // {{{
+{
+  (void)filename;
+  sink.len = 0;
+  return &sink;
+}
+// }}}
+
+static int sink_write(void *context, const char *buffer, int len) // {{{
+{
+  (void)context;
+  if (sink.len + len > sink.size) {
+    size_t new_size = sink.size ? sink.size : 65536;
+    while (new_size < sink.len + len) {
+      new_size *= 2;
+    }
+    char *tmp = realloc(sink.data, new_size);
+    if (!tmp) {
+      return -1;
+    }
+    sink.data = tmp;
+    sink.size = new_size;
+  }
+  memcpy(sink.data + sink.len, buffer, len);
+  sink.len += len;
+  return len;
+}
+// }}}
+
+static int sink_close(void *context) // {{{
+{
+  (void)context;
+  return 0;
+}
+// }}}
+
+// --- document generators
+
+static void bprintf(xmlBufferPtr buf, const char *fmt, ...) // {{{
+{
+  char tmp[512];
+  va_list ap;
+  va_start(ap, fmt);
+  const int len = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  xmlBufferAdd(buf, (const xmlChar *)tmp, (len < (int)sizeof(tmp)) ? len : (int)sizeof(tmp) - 1);
+}
+// }}}
+
+static void gen_paths(xmlBufferPtr buf, int n) // {{{
+{
+  bprintf(buf, "<set line-width=\"1.5\" line-join=\"round\"/>\n");
+  for (int i = 0; i < n; i++) {
+    const double x = rnd(0, WIDTH), y = rnd(0, HEIGHT), r = rnd(2, 40);
+    bprintf(buf, "<set-source r=\"%.3f\" g=\"%.3f\" b=\"%.3f\" a=\"0.6\"/>\n", rnd(0, 1), rnd(0, 1), rnd(0, 1));
+    bprintf(buf, "<path d=\"M %.2f,%.2f A %.2f,%.2f 0 0,1 %.2f,%.2f A %.2f,%.2f 0 1,1 %.2f,%.2f "
+                 "l %.2f,%.2f c %.2f,%.2f %.2f,%.2f %.2f,%.2f z\"/>\n",
+            x, y, r, r, x + 2 * r, y, r, r * 0.5, x, y + r,
+            rnd(-20, 20), rnd(-20, 20), rnd(-20, 20), rnd(-20, 20), rnd(-20, 20), rnd(-20, 20), rnd(-20, 20), rnd(-20, 20));
+    bprintf(buf, (i & 1) ? "<stroke/>\n" : "<fill/>\n");
+  }
+}
+// }}}
+
+static void gen_text(xmlBufferPtr buf, int n) // {{{
+{
+  static const char *labels[] = {
+    "AVAWay To", "Typography", "WAVE LTd.", "Yellow Fox", "Kerning: Te Yo Va", "P.O. Box 42", "Line #"  // (last: followed by the number)
+  };
+  const int num_labels = sizeof(labels) / sizeof(*labels);
+
+  bprintf(buf, "<set-source r=\"0.1\" g=\"0.1\" b=\"0.2\"/>\n");
+  for (int i = 0; i < n; i++) {
+    bprintf(buf, "<text font=\"font0\" size=\"%.1f\" x=\"%.2f\" y=\"%.2f\"%s>",
+            rnd(6, 24), rnd(0, WIDTH - 100), rnd(10, HEIGHT),
+            (i % 7 == 0) ? " max-width=\"80\"" : "");
+    bprintf(buf, "%s", labels[i % num_labels]);
+    if (i % num_labels == num_labels - 1) {
+      bprintf(buf, "%d", i);
+    }
+    bprintf(buf, "</text>\n");
+  }
+}
+// }}}
+
+static void gen_images(xmlBufferPtr buf, int n) // {{{
+{
+  static const char *gravities[] = { "center", "n", "ne", "e", "se", "s", "sw", "w", "nw", "stretch" };
+  for (int i = 0; i < n; i++) {
+    const double x = rnd(0, WIDTH - 64), y = rnd(0, HEIGHT - 64), w = rnd(8, 64), h = rnd(8, 64);
+    bprintf(buf, "<set-source image=\"img0\" x=\"%.2f\" y=\"%.2f\" width=\"%.2f\" height=\"%.2f\" gravity=\"%s\"/>\n",
+            x, y, w, h, gravities[i % 10]);
+    bprintf(buf, "<path d=\"M %.2f,%.2f h %.2f v %.2f h %.2f z\"/>\n<fill/>\n", x, y, w, h, -w);
+    if (i % 16 == 0) {
+      bprintf(buf, "<mask image=\"img0\" x=\"%.2f\" y=\"%.2f\" width=\"%.2f\"/>\n", x, y, w);
+    }
+  }
+}
+// }}}
+
+static void gen_state(xmlBufferPtr buf, int n) // {{{
+{
+  for (int i = 0; i < n; i++) {
+    bprintf(buf, "<sub transform=\"translate(%.2f,%.2f) rotate(%.1f)\">\n", rnd(0, WIDTH), rnd(0, HEIGHT), rnd(0, 360));
+    bprintf(buf, "<set line-width=\"%.2f\" line-cap=\"round\" operator=\"over\"/>\n", rnd(0.5, 4));
+    bprintf(buf, "<set-source r=\"%.3f\" g=\"%.3f\" b=\"%.3f\"/>\n", rnd(0, 1), rnd(0, 1), rnd(0, 1));
+    bprintf(buf, "<sub transform=\"scale(%.2f)\"><set line-join=\"bevel\" miter-limit=\"4\"/><dash offset=\"1\">4 2</dash>", rnd(0.5, 2));
+    bprintf(buf, "<path d=\"M 0,0 l 10,0 l 0,10\"/><stroke/></sub>\n");
+    bprintf(buf, "</sub>\n");
+  }
+}
+// }}}
+
+struct workload_s {
+  const char *name;
+  void (*gen)(xmlBufferPtr buf, int n);
+  int needs_font, needs_image;
+};
+
+static const struct workload_s workloads[] = {
+  { "path", gen_paths, 0, 0 },
+  { "text", gen_text, 1, 0 },
+  { "image", gen_images, 0, 1 },
+  { "state", gen_state, 0, 0 }
+};
+
+// --- surfaces
+
+static const char *surface_types[] = { "pdf", "png", "ps", "svg", "script" };
+
+static xmlcairo_surface_t *create_surface(const char *type, const char *filename) // {{{
+{
+  if (strcmp(type, "pdf") == 0) {
+    return xmlcairo_surface_create_pdf(filename, WIDTH, HEIGHT);
+  } else if (strcmp(type, "png") == 0) {
+    return xmlcairo_surface_create_png(filename, CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+  } else if (strcmp(type, "ps") == 0) {
+    return xmlcairo_surface_create_ps(filename, WIDTH, HEIGHT);
+  } else if (strcmp(type, "svg") == 0) {
+    return xmlcairo_surface_create_svg(filename, WIDTH, HEIGHT);
+  } else if (strcmp(type, "script") == 0) {
+    return xmlcairo_surface_create_script(filename, CAIRO_CONTENT_COLOR_ALPHA, WIDTH, HEIGHT);
+  }
+  return NULL;
+}
+// }}}
+
+// writes a small test image, returns 0 on success
+static int make_image(const char *filename) // {{{
+{
+  cairo_surface_t *img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 128, 96);
+  cairo_t *cr = cairo_create(img);
+  for (int i = 0; i < 16; i++) {
+    cairo_set_source_rgba(cr, i / 16.0, 1.0 - i / 16.0, 0.5, 0.8);
+    cairo_rectangle(cr, i * 8, 0, 8, 96);
+    cairo_fill(cr);
+  }
+  cairo_destroy(cr);
+  const cairo_status_t ret = cairo_surface_write_to_png(img, filename);
+  cairo_surface_destroy(img);
+  return (ret == CAIRO_STATUS_SUCCESS) ? 0 : -1;
+}
+// }}}
+
+// --- timing
+
+enum { PH_PARSE, PH_APPLY, PH_ENCODE, PH_WRITE, NUM_PHASES };
+
+static int cmp_double(const void *a, const void *b) // {{{
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+// }}}
+
+static double median(double *vals, int n) // {{{
+{
+  qsort(vals, n, sizeof(*vals), cmp_double);
+  return (n & 1) ? vals[n / 2] : 0.5 * (vals[n / 2 - 1] + vals[n / 2]);
+}
+// }}}
+
+struct options_s {
+  int count, reps;
+  const char *font, *image, *outdir;
+  const char *only_workload, *only_type;
+  int optimize, simplify, cull;
+  xmlcairo_trace_t *trace;  // or NULL
+};
+
+// returns 0 on success
+static int run_one(const struct options_s *opts, const struct workload_s *wl, const char *type, const xmlBufferPtr doc) // {{{
+{
+  double *times = malloc(NUM_PHASES * opts->reps * sizeof(double));
+  if (!times) {
+    return -1;
+  }
+  size_t outsize = 0;
+
+  for (int r = 0; r < opts->reps; r++) {
+    double *t = times + r * NUM_PHASES;
+
+    xmlcairo_trace_begin(opts->trace, "parse");
+    double start = now_ms();
+    xmlDocPtr xdoc = xmlReadMemory((const char *)xmlBufferContent(doc), xmlBufferLength(doc), "bench.xml", NULL, XML_PARSE_NONET);
+    if (xdoc && opts->optimize) {  // (counts as parse)
+      xmlcairo_optimize_report_t report;
+      xmlcairo_optimize_list(xmlDocGetRootElement(xdoc)->children, &report);
+      if (r == 0) {
+        printf("# %s/%s optimized: -%d set attrs (-%d sets, %d merged), -%d set-source, %d subs flattened, -%d subs\n",
+               wl->name, type, report.removed_set_attrs, report.removed_sets, report.merged_sets,
+               report.removed_sources, report.flattened_subs, report.removed_subs);
+      }
+    }
+    t[PH_PARSE] = now_ms() - start;
+    xmlcairo_trace_end(opts->trace);
+    if (!xdoc) {
+      fprintf(stderr, "parse failed\n");
+      free(times);
+      return -1;
+    }
+
+    xmlcairo_surface_t *sfc = create_surface(type, "bench-mem:out");
+    if (!sfc) {
+      fprintf(stderr, "could not create %s surface\n", type);
+      xmlFreeDoc(xdoc);
+      free(times);
+      return -1;
+    }
+    xmlcairo_surface_set_trace(sfc, opts->trace);
+    xmlcairo_surface_set_simplify(sfc, opts->simplify);
+    xmlcairo_surface_set_cull(sfc, opts->cull);  // (0: malloc error, just not culled)
+    if (wl->needs_font && xmlcairo_load_font(sfc, "font0", opts->font) != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "failed to load font %s\n", opts->font);
+    }
+    if (wl->needs_image && xmlcairo_load_image(sfc, "img0", opts->image) != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "failed to load image %s\n", opts->image);
+    }
+
+    start = now_ms();
+    cairo_status_t st = xmlcairo_apply_list(sfc, xmlDocGetRootElement(xdoc)->children);
+    t[PH_APPLY] = now_ms() - start;
+    if (st != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "apply: %s\n", cairo_status_to_string(st));
+    }
+
+    start = now_ms();
+    st = xmlcairo_surface_destroy(sfc);  // (encodes into sink)
+    t[PH_ENCODE] = now_ms() - start;
+    if (st != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "encode: %s\n", cairo_status_to_string(st));
+    }
+    xmlFreeDoc(xdoc);
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s/bench-%s.%s", opts->outdir, wl->name, type);
+    start = now_ms();
+    FILE *f = fopen(filename, "wb");
+    if (f) {
+      fwrite(sink.data, 1, sink.len, f);
+      fclose(f);
+    }
+    t[PH_WRITE] = now_ms() - start;
+    outsize = sink.len;
+  }
+
+  double med[NUM_PHASES], tmp[opts->reps];
+  for (int p = 0; p < NUM_PHASES; p++) {
+    for (int r = 0; r < opts->reps; r++) {
+      tmp[r] = times[r * NUM_PHASES + p];
+    }
+    med[p] = median(tmp, opts->reps);
+  }
+  printf("%-6s %-7s %9.3f %9.3f %9.3f %9.3f %9.3f %10zu\n",
+         wl->name, type, med[PH_PARSE], med[PH_APPLY], med[PH_ENCODE], med[PH_WRITE],
+         med[PH_PARSE] + med[PH_APPLY] + med[PH_ENCODE] + med[PH_WRITE], outsize);
+
+  free(times);
+  return 0;
+}
+// }}}
+
+static void usage(const char *argv0) // {{{
+{
+  fprintf(stderr,
+          "Usage: %s [-n count] [-r reps] [-f font] [-i image.png] [-o outdir] [-w workload] [-t type] [-T trace.json] [-O] [-S] [-C]\n"
+          "  workloads: path text image state (text needs -f)\n"
+          "  types: pdf png ps svg script\n"
+          "  reports median milliseconds per phase over reps\n"
+          "  -T: write a trace event timeline (chrome://tracing, Perfetto)\n"
+          "  -O: run xmlcairo_optimize_list() after parsing (included in parse time)\n"
+          "  -S: simplify path line runs to the current tolerance (xmlcairo_surface_set_simplify())\n"
+          "  -C: skip elements outside of the clip (xmlcairo_surface_set_cull())\n", argv0);
+}
+// }}}
+
+int main(int argc, char **argv)
+{
+  struct options_s opts = {
+    .count = 1000, .reps = 5,
+    .font = NULL, .image = NULL, .outdir = "/tmp"
+  };
+  const char *tracefile = NULL;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:r:f:i:o:w:t:T:OSCh")) != -1) {
+    switch (c) {
+    case 'n': opts.count = atoi(optarg); break;
+    case 'r': opts.reps = atoi(optarg); break;
+    case 'f': opts.font = optarg; break;
+    case 'i': opts.image = optarg; break;
+    case 'o': opts.outdir = optarg; break;
+    case 'w': opts.only_workload = optarg; break;
+    case 't': opts.only_type = optarg; break;
+    case 'T': tracefile = optarg; break;
+    case 'O': opts.optimize = 1; break;
+    case 'S': opts.simplify = 1; break;
+    case 'C': opts.cull = 1; break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (opts.count <= 0 || opts.reps <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  char imgname[1024];
+  if (!opts.image) {
+    snprintf(imgname, sizeof(imgname), "%s/bench-img0.png", opts.outdir);
+    if (make_image(imgname) != 0) {
+      fprintf(stderr, "could not write %s\n", imgname);
+      return 1;
+    }
+    opts.image = imgname;
+  }
+
+  xmlRegisterDefaultOutputCallbacks();
+  xmlRegisterOutputCallbacks(sink_match, sink_open, sink_write, sink_close);
+
+  if (tracefile) {
+    opts.trace = xmlcairo_trace_create(tracefile);
+    if (!opts.trace) {
+      fprintf(stderr, "could not create %s\n", tracefile);
+      return 1;
+    }
+  }
+
+  printf("# count=%d reps=%d size=%dx%d (median ms)\n", opts.count, opts.reps, WIDTH, HEIGHT);
+  printf("%-6s %-7s %9s %9s %9s %9s %9s %10s\n", "load", "type", "parse", "apply", "encode", "write", "total", "bytes");
+
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(*workloads); i++) {
+    const struct workload_s *wl = &workloads[i];
+    if (opts.only_workload && strcmp(opts.only_workload, wl->name) != 0) {
+      continue;
+    }
+    if (wl->needs_font && !opts.font) {
+      printf("# %s: skipped (no -f font)\n", wl->name);
+      continue;
+    }
+
+    xmlBufferPtr doc = xmlBufferCreate();
+    rnd_state = 42;
+    bprintf(doc, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<surface width=\"%d\" height=\"%d\">\n", WIDTH, HEIGHT);
+    wl->gen(doc, opts.count);
+    bprintf(doc, "</surface>\n");
+
+    for (size_t j = 0; j < sizeof(surface_types) / sizeof(*surface_types); j++) {
+      if (opts.only_type && strcmp(opts.only_type, surface_types[j]) != 0) {
+        continue;
+      }
+      run_one(&opts, wl, surface_types[j], doc);
+    }
+    xmlBufferFree(doc);
+  }
+
+  if (opts.trace && xmlcairo_trace_destroy(opts.trace) != 0) {
+    fprintf(stderr, "could not write %s\n", tracefile);
+  }
+  free(sink.data);
+  xmlCleanupParser();
+  return 0;
+}
+
@@ -1,36 +1,74 @@
 #include "ftfont-cairo.h"
 
 #define WITH_GPOSKERN
+#define WITH_FASTCMAP
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#ifdef WITH_FASTCMAP
+#include FT_ADVANCES_H
+#endif
+
 #ifdef WITH_GPOSKERN
 #include FT_TRUETYPE_TABLES_H
 #include FT_TRUETYPE_TAGS_H
 #endif
 
 #include <assert.h>
+#include <string.h>  // strlen()
 #include <cairo/cairo-ft.h>
+#include "xmlcairo-probes.h"
 
 #ifdef WITH_GPOSKERN
 #include "gposkern.h"
 #endif
 
+#ifdef WITH_HARFBUZZ
+#include "hbshaper.h"
+#include <pthread.h>
+#endif
+
 struct _ftfont_cairo_mgr {
   FT_Library library;
   size_t num_fonts, size_fonts;
   ftfont_cairo_font_t **fonts;
+
+  // scratch for ftfont_cairo_get_glyphs()
+  cairo_glyph_t *glyphs;
+  int size_glyphs;
 };
 
+#ifdef WITH_FASTCMAP
+struct _fastcmap_astral {
+  unsigned int codepoint;
+  unsigned short gid;
+};
+#endif
+
 struct _ftfont_cairo_font {
   ftfont_cairo_mgr_t *mgr;
   cairo_font_face_t *fft;
+  unsigned short units_per_EM;
 
 #ifdef WITH_GPOSKERN
   unsigned char *gpos;
   gpos_pair_lookup_t *gposkern;
 #endif
+
+#ifdef WITH_FASTCMAP
+  // NULL, when face could not be mapped (-> fallback to cairo_scaled_font_text_to_glyphs)
+  unsigned short *bmp;  // [0x10000], codepoint -> gid
+  struct _fastcmap_astral *astral;  // sorted by codepoint
+  size_t num_astral;
+  unsigned short *advances;  // [num_glyphs], in font units
+  int has_kern;  // (legacy 'kern' table)
+#endif
+
+#ifdef WITH_HARFBUZZ
+  hbshaper_t *shaper;  // NULL, when harfbuzz can't use the font file
+  pthread_mutex_t shaper_lock;  // (shaper reuses its buffer; fonts are shared by xmlcairo_apply_list_parallel() workers)
+#endif
 };
 
 ftfont_cairo_mgr_t *ftfont_cairo_mgr_create() // {{{
@@ -62,6 +100,7 @@ void ftfont_cairo_mgr_destroy(ftfont_cairo_mgr_t *fcm) // {{{
     cairo_font_face_destroy(fcm->fonts[i]->fft);
   }
   free(fcm->fonts);
+  cairo_glyph_free(fcm->glyphs);
 
   FT_Done_FreeType(fcm->library);    // FIXME ? - assume cairo keeps own reference ?
   free(fcm);
@@ -76,11 +115,100 @@ static void destroy_ftfont_cairo_font(FT_Face face) // {{{
 #ifdef WITH_GPOSKERN
   gpos_pair_lookup_destroy(font->gposkern);
   free(font->gpos);
+#endif
+#ifdef WITH_FASTCMAP
+  free(font->bmp);
+  free(font->astral);
+  free(font->advances);
+#endif
+#ifdef WITH_HARFBUZZ
+  if (font->shaper) {
+    hbshaper_destroy(font->shaper);
+    pthread_mutex_destroy(&font->shaper_lock);
+  }
 #endif
   free(font);
 }
 // }}}
 
+#ifdef WITH_FASTCMAP
+static void free_fastcmap(ftfont_cairo_font_t *font) // {{{
+{
+  free(font->bmp);
+  free(font->astral);
+  free(font->advances);
+  font->bmp = NULL;
+  font->astral = NULL;
+  font->num_astral = 0;
+  font->advances = NULL;
+}
+// }}}
+
+// fills font->bmp / ->astral / ->advances from the face's (unicode) charmap
+// returns 0 on success (incl. "not mappable": font->bmp stays NULL), -1 on malloc failure
+static int build_fastcmap(ftfont_cairo_font_t *font, FT_Face face) // {{{
+{
+  if (!face->charmap || face->charmap->encoding != FT_ENCODING_UNICODE ||
+      face->num_glyphs <= 0 || face->num_glyphs > 0xffff ||
+      !FT_IS_SCALABLE(face) || !face->units_per_EM) {
+    return 0;  // (use cairo's path)
+  }
+
+  font->bmp = calloc(0x10000, sizeof(*font->bmp));
+  font->advances = malloc(face->num_glyphs * sizeof(*font->advances));
+  if (!font->bmp || !font->advances) {
+    goto err;
+  }
+
+  // (NOTE: FT_Get_Next_Char returns codepoints in ascending order -> astral stays sorted)
+  size_t size_astral = 0;
+  FT_UInt gid;
+  for (FT_ULong cp = FT_Get_First_Char(face, &gid); gid != 0; cp = FT_Get_Next_Char(face, cp, &gid)) {
+    if (cp < 0x10000) {
+      font->bmp[cp] = gid;
+      continue;
+    }
+
+    if (font->num_astral >= size_astral) {
+      const size_t new_size = size_astral + 64;
+      struct _fastcmap_astral *tmp = realloc(font->astral, new_size * sizeof(*font->astral));
+      if (!tmp) {
+        goto err;
+      }
+      size_astral = new_size;
+      font->astral = tmp;
+    }
+    font->astral[font->num_astral].codepoint = cp;
+    font->astral[font->num_astral].gid = gid;
+    font->num_astral++;
+  }
+
+  // unhinted, unscaled -> just the hmtx values
+  FT_Fixed *tmp = malloc(face->num_glyphs * sizeof(FT_Fixed));
+  if (!tmp) {
+    goto err;
+  }
+  if (FT_Get_Advances(face, 0, face->num_glyphs, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING, tmp) != 0) {
+    free(tmp);
+    free_fastcmap(font);  // not mappable
+    return 0;
+  }
+  for (FT_Long i = 0; i < face->num_glyphs; i++) {
+    font->advances[i] = tmp[i];
+  }
+  free(tmp);
+
+  font->has_kern = FT_HAS_KERNING(face);
+
+  return 0;
+
+err:
+  free_fastcmap(font);
+  return -1;
+}
+// }}}
+#endif
+
 static const cairo_user_data_key_t ff_key = {};
 
 static ftfont_cairo_font_t *do_load_font(FT_Library library, const char *filename) // {{{
@@ -100,6 +228,7 @@ static ftfont_cairo_font_t *do_load_font(FT_Library library, const char *filenam
 
   face->generic.data = ret;
   face->generic.finalizer = NULL; // void (*FT_Generic_Finalizer)(void* object);  // not needed by us
+  ret->units_per_EM = face->units_per_EM;
 
 #ifdef WITH_GPOSKERN
   if ((face->face_flags & FT_FACE_FLAG_KERNING) == 0) {
@@ -128,6 +257,23 @@ static ftfont_cairo_font_t *do_load_font(FT_Library library, const char *filenam
   }
 #endif
 
+#ifdef WITH_FASTCMAP
+  if (build_fastcmap(ret, face) != 0) {
+    destroy_ftfont_cairo_font(face);
+    return NULL;
+  }
+#endif
+
+#ifdef WITH_HARFBUZZ
+  if (FT_IS_SFNT(face) && face->units_per_EM) {
+    ret->shaper = hbshaper_create(filename, 0);  // (NULL is ok: no complex shaping)
+    if (ret->shaper && pthread_mutex_init(&ret->shaper_lock, NULL) != 0) {
+      hbshaper_destroy(ret->shaper);
+      ret->shaper = NULL;
+    }
+  }
+#endif
+
   ret->fft = cairo_ft_font_face_create_for_ft_face(face, FT_LOAD_NO_HINTING);
   // cairo_font_face_status() not checked, _set_user_data will. (as per cairo doc example)
   if (cairo_font_face_set_user_data(ret->fft, &ff_key, face, (cairo_destroy_func_t)destroy_ftfont_cairo_font) != CAIRO_STATUS_SUCCESS) {
@@ -187,6 +333,29 @@ void ftfont_cairo_unload(ftfont_cairo_font_t *font) // {{{
 }
 // }}}
 
+// returns NULL on malloc failure
+static cairo_glyph_t *reserve_glyphs(ftfont_cairo_mgr_t *fcm, size_t num) // {{{
+{
+  if (num > (size_t)fcm->size_glyphs) {
+    if (num > 0x7fffffff / 2) {
+      return NULL;
+    }
+    int new_size = fcm->size_glyphs ? fcm->size_glyphs : 64;
+    while ((size_t)new_size < num) {
+      new_size *= 2;
+    }
+    cairo_glyph_t *tmp = cairo_glyph_allocate(new_size);  // (no realloc, contents need not be kept)
+    if (!tmp) {
+      return NULL;
+    }
+    cairo_glyph_free(fcm->glyphs);
+    fcm->glyphs = tmp;
+    fcm->size_glyphs = new_size;
+  }
+  return fcm->glyphs;
+}
+// }}}
+
 // TODO? check cr, font
 void ftfont_cairo_set_font(cairo_t *cr, ftfont_cairo_font_t *font, double size) // {{{
 {
@@ -216,6 +385,7 @@ static double get_kern(FT_Face face, unsigned short firstGID, unsigned short sec
   ftfont_cairo_font_t *font = face->generic.data;
   if (font->gpos) {
     const int val = gpos_pair_lookup_get(font->gposkern, firstGID, secondGID);
+    XMLCAIRO_PROBE3(kern__lookup, firstGID, secondGID, val);
     return FT_MulFix(val, face->size->metrics.x_scale) / 64.0;  // (double)face->units_per_EM;
   }
 #endif
@@ -227,24 +397,276 @@ static double get_kern(FT_Face face, unsigned short firstGID, unsigned short sec
   if (res) {
     return 0.0;
   }
+  XMLCAIRO_PROBE3(kern__lookup, firstGID, secondGID, (int)vec.x);
 
   return vec.x / 64.0;   // DEFAULT/UNFITTED
 //  return FT_MulFix(vec.x, face->size->metrics.x_scale); // * size / (double)face->units_per_EM;  // UNSCALED
 }
 // }}}
 
+#ifdef WITH_FASTCMAP
+static inline unsigned short fastcmap_lookup(const ftfont_cairo_font_t *font, unsigned int codepoint) // {{{
+{
+  if (codepoint < 0x10000) {
+    return font->bmp[codepoint];
+  }
+
+  // bsearch
+  size_t lo = 0, hi = font->num_astral;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (font->astral[mid].codepoint < codepoint) {
+      lo = mid + 1;
+    } else if (font->astral[mid].codepoint > codepoint) {
+      hi = mid;
+    } else {
+      return font->astral[mid].gid;
+    }
+  }
+  return 0;
+}
+// }}}
+
+// expects len > 0, *str >= 0x80
+// returns number of bytes consumed, or 0 on invalid sequence
+static inline int decode_utf8_multi(const unsigned char *str, size_t len, unsigned int *ret_cp) // {{{
+{
+  unsigned int cp;
+  int num;
+  if ((str[0] & 0xe0) == 0xc0) {
+    cp = str[0] & 0x1f;
+    num = 2;
+  } else if ((str[0] & 0xf0) == 0xe0) {
+    cp = str[0] & 0x0f;
+    num = 3;
+  } else if ((str[0] & 0xf8) == 0xf0) {
+    cp = str[0] & 0x07;
+    num = 4;
+  } else {
+    return 0;
+  }
+  if (len < (size_t)num) {
+    return 0;
+  }
+
+  for (int i = 1; i < num; i++) {
+    if ((str[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    cp = (cp << 6) | (str[i] & 0x3f);
+  }
+
+  static const unsigned int min_cp[] = { 0, 0, 0x80, 0x800, 0x10000 };
+  if (cp < min_cp[num] ||  // overlong
+      (cp >= 0xd800 && cp <= 0xdfff) ||
+      cp > 0x10ffff) {
+    return 0;
+  }
+
+  *ret_cp = cp;
+  return num;
+}
+// }}}
+
+// face must be locked, when font->has_kern (otherwise NULL is ok)
+// returns kerning in font units
+static int get_kern_unscaled(const ftfont_cairo_font_t *font, FT_Face face, unsigned short firstGID, unsigned short secondGID) // {{{
+{
+#ifdef WITH_GPOSKERN
+  if (font->gposkern) {
+    const int val = gpos_pair_lookup_get(font->gposkern, firstGID, secondGID);
+    XMLCAIRO_PROBE3(kern__lookup, firstGID, secondGID, val);
+    return val;
+  }
+#endif
+  if (!face) {
+    return 0;
+  }
+
+  FT_Vector vec;
+  if (FT_Get_Kerning(face, firstGID, secondGID, FT_KERNING_UNSCALED, &vec) != 0) {
+    return 0;
+  }
+  XMLCAIRO_PROBE3(kern__lookup, firstGID, secondGID, (int)vec.x);
+  return vec.x;
+}
+// }}}
+
+// does not need cairo's scaled font (nor the face lock, except for legacy 'kern' tables)
+static cairo_glyph_t *fastcmap_get_glyphs(cairo_t *cr, ftfont_cairo_font_t *font, ftfont_cairo_mgr_t *fcm, const char *str, size_t len, double x, double y, int pkern, int gkern, int *ret_num_glyphs) // {{{
+{
+  // (num_glyphs <= len)
+  cairo_glyph_t *glyphs = reserve_glyphs(fcm, (len > 0) ? len : 1);
+  if (!glyphs) {
+    return NULL;
+  }
+
+  cairo_matrix_t fm;
+  cairo_get_font_matrix(cr, &fm);
+  const double sx = fm.xx / font->units_per_EM,
+               sy = fm.yx / font->units_per_EM;
+  const double dgkern = gkern * font->units_per_EM / 1000.0;
+
+  cairo_scaled_font_t *sface = NULL;
+  FT_Face face = NULL;
+  if (pkern && font->has_kern) {
+    sface = cairo_get_scaled_font(cr);
+    face = cairo_ft_scaled_font_lock_face(sface);  // (NULL -> no kerning)
+  }
+
+  const unsigned char *cur = (const unsigned char *)str, *end = cur + len;
+  unsigned short prev = 0;
+  double pos = 0.0;  // in font units
+  int num_glyphs = 0;
+  while (cur < end) {
+    unsigned int cp;
+    if (*cur < 0x80) {
+      cp = *cur++;
+    } else {
+      const int res = decode_utf8_multi(cur, end - cur, &cp);
+      if (!res) {
+        if (face) {
+          cairo_ft_scaled_font_unlock_face(sface);
+        }
+        return NULL;
+      }
+      cur += res;
+    }
+
+    const unsigned short gid = fastcmap_lookup(font, cp);
+    if (prev) {
+      if (pkern) {
+        pos += get_kern_unscaled(font, face, prev, gid);
+      }
+      pos += dgkern;
+    }
+
+    glyphs[num_glyphs].index = gid;
+    glyphs[num_glyphs].x = x + pos * sx;
+    glyphs[num_glyphs].y = y + pos * sy;
+    num_glyphs++;
+
+    pos += font->advances[gid];
+    prev = gid;
+  }
+
+  if (face) {
+    cairo_ft_scaled_font_unlock_face(sface);
+  }
+
+  *ret_num_glyphs = num_glyphs;
+  return glyphs;
+}
+// }}}
+#endif
+
+#ifdef WITH_HARFBUZZ
+// i.e. explicit shaping properties, or text beyond U+02FF (combining marks, complex scripts, ...)
+static int needs_shaping(const ftfont_cairo_font_t *font, const ftfont_cairo_shaping_t *shaping, const char *str, size_t len) // {{{
+{
+  if (shaping && (shaping->script || shaping->language || shaping->features)) {
+    return 1;
+  }
+#ifdef WITH_FASTCMAP
+  if (!font->bmp) {
+    return 1;
+  }
+#else
+  (void)font;
+#endif
+
+  for (size_t i = 0; i < len; i++) {
+    if ((unsigned char)str[i] >= 0xcc) { // lead byte of U+0300 and above
+      return 1;
+    }
+  }
+  return 0;
+}
+// }}}
+
+static cairo_glyph_t *hb_get_glyphs(cairo_t *cr, ftfont_cairo_font_t *font, ftfont_cairo_mgr_t *fcm, const ftfont_cairo_shaping_t *shaping, const char *str, size_t len, double x, double y, int pkern, int gkern, int *ret_num_glyphs) // {{{
+{
+  const hbshaper_glyph_t *hglyphs;
+  pthread_mutex_lock(&font->shaper_lock);  // (until hglyphs are copied)
+  const int num_glyphs = hbshaper_shape(font->shaper, str, len,
+                                        shaping ? shaping->script : NULL,
+                                        shaping ? shaping->language : NULL,
+                                        shaping ? shaping->features : NULL,
+                                        pkern, &hglyphs);
+  if (num_glyphs < 0) {
+    pthread_mutex_unlock(&font->shaper_lock);
+    return NULL;
+  }
+
+  cairo_glyph_t *glyphs = reserve_glyphs(fcm, (num_glyphs > 0) ? num_glyphs : 1);
+  if (!glyphs) {
+    pthread_mutex_unlock(&font->shaper_lock);
+    return NULL;
+  }
+
+  // font units (y up) -> user space
+  cairo_matrix_t fm;
+  cairo_get_font_matrix(cr, &fm);
+  cairo_matrix_scale(&fm, 1.0 / font->units_per_EM, -1.0 / font->units_per_EM);
+  const double dgkern = gkern * font->units_per_EM / 1000.0;
+
+  double penx = 0.0, peny = 0.0;
+  for (int i = 0; i < num_glyphs; i++) {
+    if (i > 0) {
+      penx += dgkern;
+    }
+    double gx = penx + hglyphs[i].x_offset,
+           gy = peny + hglyphs[i].y_offset;
+    cairo_matrix_transform_distance(&fm, &gx, &gy);
+
+    glyphs[i].index = hglyphs[i].gid;
+    glyphs[i].x = x + gx;
+    glyphs[i].y = y + gy;
+
+    penx += hglyphs[i].x_advance;
+    peny += hglyphs[i].y_advance;
+  }
+  pthread_mutex_unlock(&font->shaper_lock);
+
+  *ret_num_glyphs = num_glyphs;
+  return glyphs;
+}
+// }}}
+#endif
+
 // len: -1 for strlen(str)
 // pkern: 1 enabled, 0 disabled
 // gkern: tracking in 1/1000 em
-// returns NULL, or must be cairo_glyph_free()d
-cairo_glyph_t *ftfont_cairo_get_glyphs(cairo_t *cr, const char *str, int len, double x, double y, int pkern, int gkern, int *ret_num_glyphs) // {{{
+// returns NULL, or glyphs in fcm's scratch buffer (valid until next call with the same fcm; do not free)
+static cairo_glyph_t *_ftfont_cairo_get_glyphs(cairo_t *cr, ftfont_cairo_mgr_t *fcm, const ftfont_cairo_shaping_t *shaping, const char *str, int len, double x, double y, int pkern, int gkern, int *ret_num_glyphs) // {{{
 {
+#if defined(WITH_FASTCMAP) || defined(WITH_HARFBUZZ)
+  FT_Face fface = cairo_font_face_get_user_data(cairo_get_font_face(cr), &ff_key);
+  if (fface && fface->generic.data) {
+    ftfont_cairo_font_t *font = fface->generic.data;
+#ifdef WITH_HARFBUZZ
+    if (font->shaper && needs_shaping(font, shaping, str, len)) {
+      return hb_get_glyphs(cr, font, fcm, shaping, str, len, x, y, pkern, gkern, ret_num_glyphs);
+    }
+#endif
+#ifdef WITH_FASTCMAP
+    if (font->bmp) {
+      return fastcmap_get_glyphs(cr, font, fcm, str, len, x, y, pkern, gkern, ret_num_glyphs);
+    }
+#endif
+  }
+#endif
+#ifndef WITH_HARFBUZZ
+  (void)shaping;
+#endif
+
   cairo_scaled_font_t *sface = cairo_get_scaled_font(cr);
   if (!sface) {
     return NULL;
   }
 
-  cairo_glyph_t *glyphs = NULL;
+  cairo_glyph_t *glyphs = fcm->glyphs;
+  *ret_num_glyphs = fcm->size_glyphs;
   cairo_status_t status = cairo_scaled_font_text_to_glyphs(
     sface,
     x, y,
@@ -253,6 +675,11 @@ cairo_glyph_t *ftfont_cairo_get_glyphs(cairo_t *cr, const char *str, int len, do
     NULL, NULL,
     NULL
   );
+  if (glyphs && glyphs != fcm->glyphs) { // cairo had to allocate a bigger one: adopt
+    cairo_glyph_free(fcm->glyphs);
+    fcm->glyphs = glyphs;
+    fcm->size_glyphs = *ret_num_glyphs;
+  }
 
   if (status != CAIRO_STATUS_SUCCESS || !glyphs) {
     return NULL;
@@ -297,3 +724,19 @@ cairo_glyph_t *ftfont_cairo_get_glyphs(cairo_t *cr, const char *str, int len, do
 }
 // }}}
 
+cairo_glyph_t *ftfont_cairo_get_glyphs(cairo_t *cr, ftfont_cairo_mgr_t *fcm, const ftfont_cairo_shaping_t *shaping, const char *str, int len, double x, double y, int pkern, int gkern, int *ret_num_glyphs) // {{{
+{
+  if (!fcm || !str) {
+    return NULL;
+  }
+  if (len < 0) {
+    len = strlen(str);
+  }
+
+  XMLCAIRO_PROBE2(glyphs__start, str, len);
+  cairo_glyph_t *ret = _ftfont_cairo_get_glyphs(cr, fcm, shaping, str, len, x, y, pkern, gkern, ret_num_glyphs);
+  XMLCAIRO_PROBE2(glyphs__done, str, (ret) ? *ret_num_glyphs : -1);
+  return ret;
+}
+// }}}
+
@@ -18,11 +18,19 @@ void ftfont_cairo_unload(ftfont_cairo_font_t *font);
 
 void ftfont_cairo_set_font(cairo_t *cr, ftfont_cairo_font_t *font, double size);
 
+// only used when built WITH_HARFBUZZ; NULL members: guess from text
+typedef struct _ftfont_cairo_shaping {
+  const char *script;    // ISO 15924, e.g. "Arab"
+  const char *language;  // BCP 47, e.g. "ar"
+  const char *features;  // comma separated, e.g. "-liga,+smcp"
+} ftfont_cairo_shaping_t;
+
+// shaping: can be NULL
 // len: -1 for strlen(str)
 // pkern: 1 enabled, 0 disabled
 // gkern: tracking in 1/1000 em
-// returns NULL, or must be cairo_glyph_free()d
-cairo_glyph_t *ftfont_cairo_get_glyphs(cairo_t *cr, const char *str, int len, double x, double y, int pkern, int gkern, int *ret_num_glyphs); // of current face
+// returns NULL, or glyphs in fcm's scratch buffer (valid until next call with the same fcm; do not free)
+cairo_glyph_t *ftfont_cairo_get_glyphs(cairo_t *cr, ftfont_cairo_mgr_t *fcm, const ftfont_cairo_shaping_t *shaping, const char *str, int len, double x, double y, int pkern, int gkern, int *ret_num_glyphs); // of current face
 
 #ifdef __cplusplus
 };
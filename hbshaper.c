@@ -0,0 +1,410 @@
+#include "hbshaper.h"
+#include <hb.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HBS_MAX_PLANS  16   // (script, language, direction, features) combinations
+#define HBS_MAX_RUNS   256  // LRU capacity of shaped runs
+#define HBS_NUM_BUCKETS 512 // power of 2
+
+struct _hbs_plan {
+  hb_script_t script;
+  hb_language_t language;
+  hb_direction_t direction;
+  char *features;  // as given (NULL -> "")
+  int kern;
+
+  hb_feature_t *feats;
+  unsigned int num_feats;
+  hb_shape_plan_t *plan;
+};
+
+struct _hbs_run {
+  struct _hbs_run *hnext;        // hash chain
+  struct _hbs_run *prev, *next;  // lru list (head: most recently used)
+  unsigned int hash;
+  size_t keylen;
+  char *key;   // script \0 language \0 features \0 kern text
+
+  int num_glyphs;
+  hbshaper_glyph_t glyphs[];
+};
+
+struct _hbshaper_t {
+  hb_face_t *face;
+  hb_font_t *font;
+  hb_buffer_t *buf;
+
+  int num_plans;
+  struct _hbs_plan plans[HBS_MAX_PLANS];
+
+  int num_runs;
+  struct _hbs_run *head, *tail;
+  struct _hbs_run *buckets[HBS_NUM_BUCKETS];
+
+  char *keybuf;
+  size_t size_keybuf;
+};
+
+hbshaper_t *hbshaper_create(const char *filename, unsigned int index) // {{{
+{
+  if (!filename) {
+    return NULL;
+  }
+
+  hbshaper_t *ret = calloc(1, sizeof(hbshaper_t));
+  if (!ret) {
+    return NULL;
+  }
+
+  // (own blob/face: independent from FT_Face and its locking)
+  hb_blob_t *blob = hb_blob_create_from_file(filename);
+  ret->face = hb_face_create(blob, index);
+  hb_blob_destroy(blob);
+  if (!hb_face_get_glyph_count(ret->face)) { // (i.e. empty face on error)
+    fprintf(stderr, "Could not create harfbuzz face for %s\n", filename);
+    hbshaper_destroy(ret);
+    return NULL;
+  }
+
+  ret->font = hb_font_create(ret->face);
+  const int upem = hb_face_get_upem(ret->face);
+  hb_font_set_scale(ret->font, upem, upem);  // -> positions in font units
+
+  ret->buf = hb_buffer_create();
+  if (!hb_buffer_allocation_successful(ret->buf)) {
+    hbshaper_destroy(ret);
+    return NULL;
+  }
+
+  return ret;
+}
+// }}}
+
+static void free_runs(hbshaper_t *hbs) // {{{
+{
+  for (struct _hbs_run *run = hbs->head, *next; run; run = next) {
+    next = run->next;
+    free(run->key);
+    free(run);
+  }
+  hbs->head = hbs->tail = NULL;
+  hbs->num_runs = 0;
+  memset(hbs->buckets, 0, sizeof(hbs->buckets));
+}
+// }}}
+
+static void free_plans(hbshaper_t *hbs) // {{{
+{
+  for (int i = 0; i < hbs->num_plans; i++) {
+    hb_shape_plan_destroy(hbs->plans[i].plan);
+    free(hbs->plans[i].feats);
+    free(hbs->plans[i].features);
+  }
+  hbs->num_plans = 0;
+}
+// }}}
+
+void hbshaper_destroy(hbshaper_t *hbs) // {{{
+{
+  if (!hbs) {
+    return;
+  }
+
+  free_runs(hbs);
+  free_plans(hbs);
+  free(hbs->keybuf);
+
+  hb_buffer_destroy(hbs->buf);  // (all accept NULL)
+  hb_font_destroy(hbs->font);
+  hb_face_destroy(hbs->face);
+  free(hbs);
+}
+// }}}
+
+static inline int strEqualNull(const char *a, const char *b) // {{{
+{
+  return strcmp(a ? a : "", b ? b : "") == 0;
+}
+// }}}
+
+// returns 0 on success, -1 on error
+static int parse_features(const char *features, int kern, hb_feature_t **ret_feats, unsigned int *ret_num) // {{{
+{
+  unsigned int num = !kern;
+  if (features) {
+    for (const char *cur = features; *cur; cur++) {
+      num += (*cur == ',');
+    }
+    num++;
+  }
+
+  *ret_num = 0;
+  *ret_feats = NULL;
+  if (!num) {
+    return 0;
+  }
+
+  hb_feature_t *feats = malloc(num * sizeof(hb_feature_t));
+  if (!feats) {
+    return -1;
+  }
+
+  unsigned int pos = 0;
+  if (features) {
+    const char *cur = features;
+    while (*cur) {
+      const size_t len = strcspn(cur, ",");
+      if (len > 0) {
+        if (!hb_feature_from_string(cur, len, &feats[pos])) {
+          fprintf(stderr, "Warning: could not parse feature \"%.*s\"\n", (int)len, cur);
+          free(feats);
+          return -1;
+        }
+        pos++;
+      }
+      cur += len;
+      if (*cur == ',') {
+        cur++;
+      }
+    }
+  }
+  if (!kern) {
+    feats[pos].tag = HB_TAG('k', 'e', 'r', 'n');
+    feats[pos].value = 0;
+    feats[pos].start = HB_FEATURE_GLOBAL_START;
+    feats[pos].end = HB_FEATURE_GLOBAL_END;
+    pos++;
+  }
+
+  *ret_feats = feats;
+  *ret_num = pos;
+  return 0;
+}
+// }}}
+
+// props from (filled) hbs->buf
+static struct _hbs_plan *get_plan(hbshaper_t *hbs, const char *features, int kern) // {{{ or NULL
+{
+  hb_segment_properties_t props;
+  hb_buffer_get_segment_properties(hbs->buf, &props);
+
+  for (int i = 0; i < hbs->num_plans; i++) {
+    struct _hbs_plan *plan = &hbs->plans[i];
+    if (plan->script == props.script &&
+        plan->language == props.language &&
+        plan->direction == props.direction &&
+        plan->kern == kern &&
+        strEqualNull(plan->features, features)) {
+      return plan;
+    }
+  }
+
+  if (hbs->num_plans >= HBS_MAX_PLANS) {
+    // (cached runs do not reference plans, but keep it simple: start over)
+    free_plans(hbs);
+  }
+
+  struct _hbs_plan *plan = &hbs->plans[hbs->num_plans];
+  memset(plan, 0, sizeof(*plan));
+  plan->script = props.script;
+  plan->language = props.language;
+  plan->direction = props.direction;
+  plan->kern = kern;
+  if (features) {
+    plan->features = strdup(features);
+    if (!plan->features) {
+      return NULL;
+    }
+  }
+  if (parse_features(features, kern, &plan->feats, &plan->num_feats) != 0) {
+    free(plan->features);
+    return NULL;
+  }
+
+  plan->plan = hb_shape_plan_create(hbs->face, &props, plan->feats, plan->num_feats, NULL);
+  if (!plan->plan) {
+    free(plan->feats);
+    free(plan->features);
+    return NULL;
+  }
+
+  hbs->num_plans++;
+  return plan;
+}
+// }}}
+
+// builds hbs->keybuf, returns keylen or 0 on error
+static size_t build_key(hbshaper_t *hbs, const char *str, size_t len, const char *script, const char *language, const char *features, int kern) // {{{
+{
+  const size_t slen = script ? strlen(script) : 0,
+               llen = language ? strlen(language) : 0,
+               flen = features ? strlen(features) : 0;
+  const size_t keylen = slen + 1 + llen + 1 + flen + 1 + 1 + len;
+  if (keylen > hbs->size_keybuf) {
+    char *tmp = realloc(hbs->keybuf, keylen);
+    if (!tmp) {
+      return 0;
+    }
+    hbs->keybuf = tmp;
+    hbs->size_keybuf = keylen;
+  }
+
+  char *cur = hbs->keybuf;
+  memcpy(cur, script ? script : "", slen + 1);
+  cur += slen + 1;
+  memcpy(cur, language ? language : "", llen + 1);
+  cur += llen + 1;
+  memcpy(cur, features ? features : "", flen + 1);
+  cur += flen + 1;
+  *cur++ = kern ? '1' : '0';
+  memcpy(cur, str, len);
+
+  return keylen;
+}
+// }}}
+
+static unsigned int hash_key(const char *key, size_t len) // {{{
+{
+  // FNV-1a
+  unsigned int ret = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    ret ^= (unsigned char)key[i];
+    ret *= 16777619u;
+  }
+  return ret;
+}
+// }}}
+
+static void lru_unlink(hbshaper_t *hbs, struct _hbs_run *run) // {{{
+{
+  if (run->prev) {
+    run->prev->next = run->next;
+  } else {
+    hbs->head = run->next;
+  }
+  if (run->next) {
+    run->next->prev = run->prev;
+  } else {
+    hbs->tail = run->prev;
+  }
+  run->prev = run->next = NULL;
+}
+// }}}
+
+static void lru_push_front(hbshaper_t *hbs, struct _hbs_run *run) // {{{
+{
+  run->prev = NULL;
+  run->next = hbs->head;
+  if (hbs->head) {
+    hbs->head->prev = run;
+  } else {
+    hbs->tail = run;
+  }
+  hbs->head = run;
+}
+// }}}
+
+static void evict_lru(hbshaper_t *hbs) // {{{
+{
+  struct _hbs_run *run = hbs->tail;
+  if (!run) {
+    return;
+  }
+  lru_unlink(hbs, run);
+
+  struct _hbs_run **pp = &hbs->buckets[run->hash & (HBS_NUM_BUCKETS - 1)];
+  while (*pp && *pp != run) {
+    pp = &(*pp)->hnext;
+  }
+  if (*pp) {
+    *pp = run->hnext;
+  }
+
+  free(run->key);
+  free(run);
+  hbs->num_runs--;
+}
+// }}}
+
+int hbshaper_shape(hbshaper_t *hbs, const char *str, size_t len, const char *script, const char *language, const char *features, int kern, const hbshaper_glyph_t **ret_glyphs) // {{{
+{
+  if (!hbs || !str || !ret_glyphs || len > 0x7fffffff) {
+    return -1;
+  }
+
+  const size_t keylen = build_key(hbs, str, len, script, language, features, kern);
+  if (!keylen) {
+    return -1;
+  }
+  const unsigned int hash = hash_key(hbs->keybuf, keylen);
+
+  struct _hbs_run **bucket = &hbs->buckets[hash & (HBS_NUM_BUCKETS - 1)];
+  for (struct _hbs_run *run = *bucket; run; run = run->hnext) {
+    if (run->hash == hash && run->keylen == keylen &&
+        memcmp(run->key, hbs->keybuf, keylen) == 0) {
+      lru_unlink(hbs, run);
+      lru_push_front(hbs, run);
+      *ret_glyphs = run->glyphs;
+      return run->num_glyphs;
+    }
+  }
+
+  // miss: shape
+  hb_buffer_clear_contents(hbs->buf);
+  hb_buffer_add_utf8(hbs->buf, str, len, 0, len);
+  if (script) {
+    hb_buffer_set_script(hbs->buf, hb_script_from_string(script, -1));
+  }
+  if (language) {
+    hb_buffer_set_language(hbs->buf, hb_language_from_string(language, -1));
+  }
+  hb_buffer_guess_segment_properties(hbs->buf);
+
+  struct _hbs_plan *plan = get_plan(hbs, features, kern);
+  if (!plan) {
+    return -1;
+  }
+  if (!hb_shape_plan_execute(plan->plan, hbs->font, hbs->buf, plan->feats, plan->num_feats)) {
+    return -1;
+  }
+
+  unsigned int num_glyphs;
+  const hb_glyph_info_t *infos = hb_buffer_get_glyph_infos(hbs->buf, &num_glyphs);
+  const hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(hbs->buf, NULL);
+
+  struct _hbs_run *run = malloc(sizeof(struct _hbs_run) + num_glyphs * sizeof(hbshaper_glyph_t));
+  if (!run) {
+    return -1;
+  }
+  run->key = malloc(keylen);
+  if (!run->key) {
+    free(run);
+    return -1;
+  }
+  memcpy(run->key, hbs->keybuf, keylen);
+  run->keylen = keylen;
+  run->hash = hash;
+  run->num_glyphs = num_glyphs;
+  for (unsigned int i = 0; i < num_glyphs; i++) {
+    run->glyphs[i].gid = infos[i].codepoint;
+    run->glyphs[i].x_advance = pos[i].x_advance;
+    run->glyphs[i].y_advance = pos[i].y_advance;
+    run->glyphs[i].x_offset = pos[i].x_offset;
+    run->glyphs[i].y_offset = pos[i].y_offset;
+  }
+
+  if (hbs->num_runs >= HBS_MAX_RUNS) {
+    evict_lru(hbs);
+  }
+  run->hnext = *bucket;
+  *bucket = run;
+  lru_push_front(hbs, run);
+  hbs->num_runs++;
+
+  *ret_glyphs = run->glyphs;
+  return run->num_glyphs;
+}
+// }}}
+
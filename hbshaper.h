@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _hbshaper_t hbshaper_t;
+
+typedef struct _hbshaper_glyph_t {
+  unsigned int gid;
+  int x_advance, y_advance;  // in font units
+  int x_offset, y_offset;
+} hbshaper_glyph_t;
+
+// returns NULL when font file cannot be used
+hbshaper_t *hbshaper_create(const char *filename, unsigned int index);
+
+// str need not be 0-terminated
+// script (ISO 15924, e.g. "Arab"), language (BCP 47, e.g. "ar"), features (comma separated, e.g. "-liga,+smcp") can be NULL
+// kern: 1 enabled, 0 disabled
+// returns number of glyphs (*ret_glyphs valid until next call), or -1
+int hbshaper_shape(hbshaper_t *hbs, const char *str, size_t len, const char *script, const char *language, const char *features, int kern, const hbshaper_glyph_t **ret_glyphs);
+
+void hbshaper_destroy(hbshaper_t *hbs);
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,44 +1,719 @@
+// Command-line driver: renders one or more xmlcairo documents, e.g. for batch jobs.
 #include "xmlcairo.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>  // access()
+#include <pthread.h>
 #include <cairo.h>
 #include <libxml/tree.h>
+#include <libxml/parser.h>
+#include <libxml/xmlreader.h>
+#ifdef WITH_XSLT
+#include <libxslt/xsltInternals.h>
+#include <libxslt/transform.h>
+#include "xmlcairo-xslt.h"
+#define XSLT_OPTSTRING "x:"
+#else
+#define XSLT_OPTSTRING ""
+#endif
 
-int main()
+#define MAX_SEARCH_DIRS 16
+#define MAX_RESOURCES 64
+
+enum resource_kind_e { RES_IMAGE, RES_FONT, RES_BINARY };
+
+struct resource_s {
+  enum resource_kind_e kind;
+  const char *key, *filename;
+};
+
+struct options_s {
+  const char **inputs;
+  int num_inputs, size_inputs;
+
+  const char *output;  // template
+  const char *type, *format, *content;  // NULL: root attribute / default
+  const char *width, *height;  // NULL: root attribute
+
+  const char *search[MAX_SEARCH_DIRS];
+  int num_search;
+  struct resource_s resources[MAX_RESOURCES];
+  int num_resources;
+
+  int jobs, pages;  // threads: per input file / per document (xmlcairo_apply_list_parallel())
+  int stream, optimize, simplify, cull, stats;
+  xmlcairo_trace_t *trace;
+#ifdef WITH_XSLT
+  xsltStylesheetPtr style;  // -x (NULL: none)
+#endif
+};
+
+static double now_ms() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+// }}}
+
+// --- inputs
+
+static int add_input(struct options_s *opts, const char *filename) // {{{ returns 0 on malloc error
+{
+  if (opts->num_inputs >= opts->size_inputs) {
+    const int size = opts->size_inputs ? 2 * opts->size_inputs : 64;
+    const char **tmp = realloc(opts->inputs, size * sizeof(*tmp));
+    if (!tmp) {
+      return 0;
+    }
+    opts->inputs = tmp;
+    opts->size_inputs = size;
+  }
+  opts->inputs[opts->num_inputs++] = filename;
+  return 1;
+}
+// }}}
+
+// one input file per line ("-": stdin); empty lines and lines starting with '#' are skipped.
+// returns 0 on error
+static int read_manifest(struct options_s *opts, const char *filename) // {{{
+{
+  FILE *f = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "could not open manifest %s\n", filename);
+    return 0;
+  }
+
+  int ret = 1;
+  char line[4096];
+  while (ret && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (!*line || *line == '#') {
+      continue;
+    }
+    char *name = strdup(line);  // (lives until exit)
+    ret = name && add_input(opts, name);
+  }
+  if (f != stdin) {
+    fclose(f);
+  }
+  return ret;
+}
+// }}}
+
+// --- surface parameters
+
+// flags override the root <surface> attributes (xmlcairo_surface_create_from_node());
+// type: flag, attribute, else extension of the output template, else png. returns 0 on malloc error
+static int apply_surface_flags(const struct options_s *opts, xmlNodePtr root) // {{{
+{
+  const char *names[] = { "width", "height", "format", "content" };
+  const char *flags[] = { opts->width, opts->height, opts->format, opts->content };
+  for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+    if (flags[i] && !xmlSetProp(root, (const xmlChar *)names[i], (const xmlChar *)flags[i])) {
+      return 0;
+    }
+  }
+
+  const char *type = opts->type;
+  if (!type && !xmlHasProp(root, (const xmlChar *)"type")) {
+    const char *ext = strrchr(opts->output, '.');
+    type = (ext && !strchr(ext, '/') && !strchr(ext, '%')) ? ext + 1 : "png";  // (-o "%b.pdf")
+  }
+  return !type || xmlSetProp(root, (const xmlChar *)"type", (const xmlChar *)type);
+}
+// }}}
+
+// --- names
+
+// %d: directory of input (incl. '/'), %b: basename without extension, %e: extension of the surface type,
+// %i: index of the input, %%: '%'
+static int expand_output(char *dst, size_t len, const char *tmpl, const char *input, int idx, const char *type) // {{{ returns 0 when too long
+{
+  const char *slash = strrchr(input, '/');
+  const char *base = slash ? slash + 1 : input;
+  const char *dot = strrchr(base, '.');
+  const int dirlen = base - input,
+            baselen = dot && dot != base ? dot - base : (int)strlen(base);
+
+  size_t pos = 0;
+  for (const char *cur = tmpl; *cur; cur++) {
+    int n;
+    if (*cur != '%' || !cur[1]) {
+      n = snprintf(dst + pos, len - pos, "%c", *cur);
+    } else {
+      switch (*++cur) {
+      case 'd': n = snprintf(dst + pos, len - pos, "%.*s", dirlen, input); break;
+      case 'b': n = snprintf(dst + pos, len - pos, "%.*s", baselen, base); break;
+      case 'e': n = snprintf(dst + pos, len - pos, "%s", type); break;
+      case 'i': n = snprintf(dst + pos, len - pos, "%d", idx); break;
+      default: n = snprintf(dst + pos, len - pos, "%c", *cur); break;
+      }
+    }
+    if (n < 0 || (size_t)n >= len - pos) {
+      return 0;
+    }
+    pos += n;
+  }
+  return 1;
+}
+// }}}
+
+// relative names: directory of the input first, then the -I directories; otherwise filename as is (e.g. xmlio URLs)
+static const char *find_resource(const struct options_s *opts, const char *input, const char *filename, char *buf, size_t len) // {{{
 {
-  // getopt()...
+  if (*filename == '/' || strstr(filename, "://")) {
+    return filename;
+  }
+  const char *slash = strrchr(input, '/');
+  if (slash) {
+    snprintf(buf, len, "%.*s%s", (int)(slash + 1 - input), input, filename);
+    if (access(buf, R_OK) == 0) {
+      return buf;
+    }
+  }
+  for (int i = 0; i < opts->num_search; i++) {
+    snprintf(buf, len, "%s/%s", opts->search[i], filename);
+    if (access(buf, R_OK) == 0) {
+      return buf;
+    }
+  }
+  return filename;
+}
+// }}}
 
-  xmlDocPtr doc = xmlParseFile("in.xml");
-  if (!doc) {
-    fprintf(stderr, "parsing in.xml failed\n");  // TODO? error info?
-    return 1;
+static int load_resources(const struct options_s *opts, xmlcairo_surface_t *sfc, const char *input) // {{{ returns 0 on error
+{
+  for (int i = 0; i < opts->num_resources; i++) {
+    const struct resource_s *res = &opts->resources[i];
+    char buf[4096];
+    const char *filename = find_resource(opts, input, res->filename, buf, sizeof(buf));
+    cairo_status_t st;
+    switch (res->kind) {
+    case RES_IMAGE: st = xmlcairo_load_image(sfc, res->key, filename); break;
+    case RES_FONT: st = xmlcairo_load_font(sfc, res->key, filename); break;
+    case RES_BINARY: st = xmlcairo_load_binary(sfc, res->key, filename); break;
+    default: st = CAIRO_STATUS_INVALID_STATUS; break;
+    }
+    if (st != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "%s: could not load %s (%s): %s\n", input, res->key, filename, cairo_status_to_string(st));
+      return 0;
+    }
   }
-  xmlNodePtr node = xmlDocGetRootElement(doc);
-printf("root: %s\n", node->name); // TODO?! expect <surface> ?
+  return 1;
+}
+// }}}
+
+// --- stats summary
+
+enum { PH_PARSE, PH_APPLY, PH_ENCODE, NUM_PHASES };
 
-  // TODO:  create xmlcairo_surface_t *sfc = ... from_surface_attrs ...
-  // IDEA: pre-extract  certain elements: font-loading, image-loading, ...
+struct summary_entry_s {
+  xmlcairo_stats_kind_t kind;
+  char *name;
+  unsigned long count;
+  double total_ms, max_ms;
+};
 
-  xmlcairo_surface_t *sfc = xmlcairo_surface_create_png("out.png", CAIRO_FORMAT_RGB24, 100, 100);
+static struct {
+  pthread_mutex_t lock;
+  double phases[NUM_PHASES];
+  int num_ok, num_failed;
+  xmlcairo_memory_t memory;  // (highest per input)
+  struct summary_entry_s *entries;
+  int num_entries, size_entries;
+} summary = {
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
 
-  // TODO: load image/font via xml
-  if (xmlcairo_load_image(sfc, "tex0", "tex0.png") != CAIRO_STATUS_SUCCESS) {
-    fprintf(stderr, "failed to read tex0.png\n");
-//   return 1;  // TODO? (+ xmlcairo_surface_destroy ??)
+// (caller holds summary.lock)
+static void summary_add_stats(const xmlcairo_stats_t *stats) // {{{
+{
+  xmlcairo_memory_t mem;
+  if (xmlcairo_stats_get_memory(stats, &mem) == 0) {
+    for (int k = 0; k < XMLCAIRO_MEMORY_NUM_KINDS; k++) {
+      if (mem.peak[k] > summary.memory.peak[k]) {
+        summary.memory.peak[k] = mem.peak[k];
+      }
+    }
+    if (mem.peak_total > summary.memory.peak_total) {
+      summary.memory.peak_total = mem.peak_total;
+    }
   }
-  if (xmlcairo_load_font(sfc, "font0", "MarkOT-Black.otf") != CAIRO_STATUS_SUCCESS) {
-    fprintf(stderr, "failed to load font0\n");
+
+  const int num = xmlcairo_stats_get_num_entries(stats);
+  for (int i = 0; i < num; i++) {
+    xmlcairo_stats_entry_t e;
+    if (xmlcairo_stats_get_entry(stats, i, &e) != 0) {
+      continue;
+    }
+    int j = 0;
+    while (j < summary.num_entries && (summary.entries[j].kind != e.kind || strcmp(summary.entries[j].name, e.name) != 0)) {
+      j++;
+    }
+    if (j == summary.num_entries) {
+      if (summary.num_entries >= summary.size_entries) {
+        const int size = summary.size_entries ? 2 * summary.size_entries : 32;
+        struct summary_entry_s *tmp = realloc(summary.entries, size * sizeof(*tmp));
+        if (!tmp) {
+          return;  // (best effort)
+        }
+        summary.entries = tmp;
+        summary.size_entries = size;
+      }
+      char *name = strdup(e.name);
+      if (!name) {
+        return;
+      }
+      summary.entries[j] = (struct summary_entry_s){ .kind = e.kind, .name = name };
+      summary.num_entries++;
+    }
+    summary.entries[j].count += e.count;
+    summary.entries[j].total_ms += e.total_ms;
+    if (e.max_ms > summary.entries[j].max_ms) {
+      summary.entries[j].max_ms = e.max_ms;
+    }
   }
+}
+// }}}
 
-  cairo_status_t st = xmlcairo_apply_list(sfc, node->children);
-  printf("status: %d\n", st);
+static void print_summary(double wall_ms) // {{{
+{
+  fprintf(stderr, "# %d ok, %d failed, %.3f ms wall; summed: parse %.3f ms, apply %.3f ms, encode %.3f ms\n",
+          summary.num_ok, summary.num_failed, wall_ms,
+          summary.phases[PH_PARSE], summary.phases[PH_APPLY], summary.phases[PH_ENCODE]);
+  const xmlcairo_memory_t *mem = &summary.memory;
+  fprintf(stderr, "# peak memory (per input): %.1f MiB; images %.1f, glyphs %.1f, paths %.1f, dom %.1f MiB\n",
+          mem->peak_total / 1048576.0, mem->peak[XMLCAIRO_MEMORY_IMAGES] / 1048576.0, mem->peak[XMLCAIRO_MEMORY_GLYPHS] / 1048576.0,
+          mem->peak[XMLCAIRO_MEMORY_PATHS] / 1048576.0, mem->peak[XMLCAIRO_MEMORY_DOM] / 1048576.0);
+  if (summary.num_entries > 0) {
+    fprintf(stderr, "# %-10s %-20s %10s %12s %10s\n", "kind", "name", "count", "total_ms", "max_ms");
+  }
+  for (int i = 0; i < summary.num_entries; i++) {
+    const struct summary_entry_s *e = &summary.entries[i];
+    fprintf(stderr, "# %-10s %-20s %10lu %12.3f %10.3f\n",
+            (e->kind == XMLCAIRO_STATS_ELEMENT) ? "element" : "attribute", e->name, e->count, e->total_ms, e->max_ms);
+    free(e->name);
+  }
+  free(summary.entries);
+}
+// }}}
 
-  st = xmlcairo_surface_destroy(sfc);
+// --- jobs
 
-  xmlFreeDoc(doc);
-  if (st != CAIRO_STATUS_SUCCESS) {
-    return 1;
+// root attributes without parsing the whole document (--stream)
+static xmlNodePtr read_root(const char *filename) // {{{ caller must xmlFreeNode()
+{
+  xmlTextReaderPtr reader = xmlReaderForFile(filename, NULL, 0);
+  if (!reader) {
+    return NULL;
   }
+  xmlNodePtr ret = NULL;
+  int res;
+  while ((res = xmlTextReaderRead(reader)) == 1 && xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+    // (doctype, comments, ... before the root)
+  }
+  if (res == 1) {
+    ret = xmlCopyNode(xmlTextReaderCurrentNode(reader), 2);  // (attributes only)
+  }
+  xmlFreeTextReader(reader);
+  return ret;
+}
+// }}}
+
+#ifdef WITH_XSLT
+struct xslt_prepare_s {
+  const struct options_s *opts;
+  const char *input;
+  xmlcairo_stats_t *stats;
+};
 
+// like run_one() for its own surface; the surface flags (-t -W -H -f -c), -P and -O do not apply to <xc:render>
+static int xslt_prepare(xmlcairo_surface_t *surface, const char *output, void *user) // {{{
+{
+  (void)output;
+  const struct xslt_prepare_s *prep = (const struct xslt_prepare_s *)user;
+  if (!load_resources(prep->opts, surface, prep->input)) {
+    return -1;
+  }
+  xmlcairo_surface_set_stats(surface, prep->stats);
+  xmlcairo_surface_set_trace(surface, prep->opts->trace);
+  xmlcairo_surface_set_simplify(surface, prep->opts->simplify);
+  if (!xmlcairo_surface_set_cull(surface, prep->opts->cull)) {
+    return -1;
+  }
   return 0;
 }
+// }}}
 
+// replaces *doc by the result (<xc:render> elements are rendered meanwhile); returns 0 on error
+static int transform(const struct options_s *opts, const char *input, xmlcairo_stats_t *stats, xmlDocPtr *doc) // {{{
+{
+  xsltTransformContextPtr ctxt = xsltNewTransformContext(opts->style, *doc);
+  if (!ctxt) {
+    return 0;
+  }
+  struct xslt_prepare_s prep = { opts, input, stats };
+  xmlcairo_xslt_set_prepare(ctxt, xslt_prepare, &prep);
+  xmlDocPtr res = xsltApplyStylesheetUser(opts->style, *doc, NULL, NULL, NULL, ctxt);
+  xsltFreeTransformContext(ctxt);
+  if (!res) {
+    return 0;
+  }
+  xmlFreeDoc(*doc);
+  *doc = res;
+  return 1;
+}
+// }}}
+#endif
+
+// --stats: per input line, and summary
+static void report(const struct options_s *opts, const char *input, const double *t, xmlcairo_stats_t *stats, int ret) // {{{
+{
+  if (!opts->stats) {
+    return;
+  }
+  pthread_mutex_lock(&summary.lock);
+  xmlcairo_memory_t mem = { .peak_total = 0 };
+  xmlcairo_stats_get_memory(stats, &mem);  // (stats NULL: stays 0)
+  fprintf(stderr, "# %s: parse %.3f ms, apply %.3f ms, encode %.3f ms, peak %.1f MiB%s\n",
+          input, t[PH_PARSE], t[PH_APPLY], t[PH_ENCODE], mem.peak_total / 1048576.0, ret ? " (failed)" : "");
+  for (int p = 0; p < NUM_PHASES; p++) {
+    summary.phases[p] += t[p];
+  }
+  if (stats) {
+    summary_add_stats(stats);
+  }
+  pthread_mutex_unlock(&summary.lock);
+}
+// }}}
+
+// returns 0 on success
+static int run_one(const struct options_s *opts, const char *input, int idx) // {{{
+{
+  double t[NUM_PHASES] = { 0 };
+
+  xmlcairo_trace_begin(opts->trace, "parse");
+  double start = now_ms();
+  xmlDocPtr doc = NULL;
+  xmlNodePtr root;
+  if (opts->stream) {
+    root = read_root(input);
+  } else {
+    doc = xmlReadFile(input, NULL, XML_PARSE_NONET);
+    root = (doc) ? xmlDocGetRootElement(doc) : NULL;
+  }
+  t[PH_PARSE] = now_ms() - start;
+  xmlcairo_trace_end(opts->trace);
+  xmlcairo_stats_t *stats = (opts->stats) ? xmlcairo_stats_create() : NULL;
+#ifdef WITH_XSLT
+  if (doc && opts->style) {
+    xmlcairo_trace_begin(opts->trace, "transform");
+    start = now_ms();
+    const int ok = transform(opts, input, stats, &doc);
+    t[PH_APPLY] = now_ms() - start;  // (includes <xc:render>)
+    xmlcairo_trace_end(opts->trace);
+    if (!ok) {
+      fprintf(stderr, "%s: transformation failed\n", input);
+      xmlFreeDoc(doc);
+      xmlcairo_stats_destroy(stats);
+      return -1;
+    }
+    root = xmlDocGetRootElement(doc);
+    if (!root) {
+      xmlFreeDoc(doc);  // (all output was rendered by <xc:render>)
+      report(opts, input, t, stats, 0);
+      xmlcairo_stats_destroy(stats);
+      return 0;
+    }
+  }
+#endif
+  if (!root) {
+    fprintf(stderr, "%s: parsing failed\n", input);
+    xmlFreeDoc(doc);  // (accepts NULL)
+    xmlcairo_stats_destroy(stats);
+    return -1;
+  } else if (!xmlStrEqual(root->name, (const xmlChar *)"surface")) {
+    fprintf(stderr, "%s: root element must be <surface>, not <%s>\n", input, root->name);
+    if (!doc) {
+      xmlFreeNode(root);
+    }
+    xmlFreeDoc(doc);
+    xmlcairo_stats_destroy(stats);
+    return -1;
+  }
+
+  char output[4096];
+  xmlcairo_surface_t *sfc = NULL;
+  xmlChar *type = NULL;
+  int ret = -1;
+  if (!apply_surface_flags(opts, root) || (type = xmlGetProp(root, (const xmlChar *)"type")) == NULL) {
+    fprintf(stderr, "%s: out of memory\n", input);
+  } else if (!expand_output(output, sizeof(output), opts->output, input, idx, (const char *)type)) {
+    fprintf(stderr, "%s: output name too long\n", input);
+  } else if ((sfc = xmlcairo_surface_create_from_node(root, output)) == NULL) {
+    fprintf(stderr, "%s: could not create %s surface %s\n", input, type, output);
+  } else if (!xmlcairo_surface_set_cull(sfc, opts->cull)) {
+    fprintf(stderr, "%s: out of memory\n", input);
+  } else if (load_resources(opts, sfc, input)) {
+    ret = 0;
+  }
+
+  if (ret == 0) {
+    xmlcairo_surface_set_stats(sfc, stats);
+    xmlcairo_surface_set_trace(sfc, opts->trace);
+    xmlcairo_surface_set_simplify(sfc, opts->simplify);
+
+    xmlNodePtr insns = root->children;
+    if (doc && opts->optimize) {
+      start = now_ms();
+      insns = xmlcairo_optimize_list(insns, NULL);
+      t[PH_PARSE] += now_ms() - start;
+    }
+
+    start = now_ms();
+    cairo_status_t st;
+    if (opts->stream) {
+      st = xmlcairo_apply_stream(sfc, input);
+    } else if (opts->pages > 1) {
+      st = xmlcairo_apply_list_parallel(sfc, insns, opts->pages);
+    } else {
+      st = xmlcairo_apply_list(sfc, insns);
+    }
+    t[PH_APPLY] += now_ms() - start;
+    if (st != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "%s: %s\n", input, cairo_status_to_string(st));
+      ret = -1;
+    }
+  }
+
+  if (sfc) {
+    start = now_ms();
+    const cairo_status_t st = xmlcairo_surface_destroy(sfc);  // (encodes / finishes output)
+    t[PH_ENCODE] = now_ms() - start;
+    if (st != CAIRO_STATUS_SUCCESS && ret == 0) {
+      fprintf(stderr, "%s: writing %s: %s\n", input, output, cairo_status_to_string(st));
+      ret = -1;
+    }
+  }
+  xmlFree(type);  // (accepts NULL)
+  if (doc) {
+    xmlFreeDoc(doc);
+  } else {
+    xmlFreeNode(root);
+  }
+
+  report(opts, input, t, stats, ret);
+  xmlcairo_stats_destroy(stats);  // (accepts NULL)
+  return ret;
+}
+// }}}
+
+struct jobs_s {
+  const struct options_s *opts;
+  int next;  // (atomic) index of the next input
+  int failed;  // (atomic)
+};
+
+static void *job_thread(void *user) // {{{
+{
+  struct jobs_s *jobs = (struct jobs_s *)user;
+  int idx;
+  while ((idx = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) < jobs->opts->num_inputs) {
+    const int ret = run_one(jobs->opts, jobs->opts->inputs[idx], idx);
+    __atomic_add_fetch((ret == 0) ? &summary.num_ok : &summary.num_failed, 1, __ATOMIC_RELAXED);
+    if (ret != 0) {
+      __atomic_store_n(&jobs->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+// }}}
+
+// --- options
+
+static void usage(const char *argv0) // {{{
+{
+  fprintf(stderr,
+          "Usage: %s [options] input.xml...\n"
+          "  -@ manifest      further inputs, one per line (\"-\": stdin)\n"
+          "  -o template      output name: %%d input directory, %%b input basename, %%e type, %%i input index\n"
+          "                   (default: %%d%%b.%%e)\n"
+          "  -t type          pdf png ps svg script (default: <surface type>, else from -o extension, else png)\n"
+          "  -W width         (default: <surface width>)\n"
+          "  -H height        (default: <surface height>)\n"
+          "  -f format        png: argb32 rgb24 a8 a1 rgb16_565 rgb30 (default: <surface format>, else argb32)\n"
+          "  -c content       script: color alpha color-alpha (default: <surface content>, else color-alpha)\n"
+          "  -i key=file.png  load image, -F key=file.otf: font, -b key=file: binary (each repeatable)\n"
+          "  -I dir           resource search path, after the input's directory (repeatable)\n"
+          "  -j N             render N inputs in parallel\n"
+          "  -P N             render the pages of each input on N threads (xmlcairo_apply_list_parallel())\n"
+          "  --stream         parse and apply each input element by element (xmlcairo_apply_stream())\n"
+          "  -O               optimize the display list (xmlcairo_optimize_list())\n"
+          "  -S               simplify path line runs (xmlcairo_surface_set_simplify())\n"
+          "  -C               skip elements outside of the clip (xmlcairo_surface_set_cull())\n"
+          "  -M size          memory budget per input, e.g. 512M (k, M, G; default: unlimited)\n"
+          "  --max-dashes N   max. entries per <dash> (default: unlimited)\n"
+          "  -T trace.json    write a trace event timeline\n"
+#ifdef WITH_XSLT
+          "  -x style.xsl     transform each input first; <xc:render output=\"...\"> (xmlns:xc=\"" XMLCAIRO_XSLT_NAMESPACE "\")\n"
+          "                   renders its <surface> content in-process; a result without root element is not rendered\n"
+          "                   (-t -W -H -f -c -P and -O do not apply to <xc:render>, the others do)\n"
+#endif
+          "  -s, --stats      print timings per input, and a summary per element / attribute, to stderr\n", argv0);
+}
+// }}}
+
+static int parse_size(const char *arg, unsigned long long *ret) // {{{ [0-9]+[kMG]; returns 0 on error
+{
+  char *end;
+  const unsigned long long val = strtoull(arg, &end, 10);
+  const int shift = (!*end) ? 0 : (!end[1] && *end == 'k') ? 10 : (!end[1] && *end == 'M') ? 20 : (!end[1] && *end == 'G') ? 30 : -1;
+  if (end == arg || shift < 0 || val > (~0ull >> shift)) {
+    return 0;
+  }
+  *ret = val << shift;
+  return 1;
+}
+// }}}
+
+static int add_resource(struct options_s *opts, enum resource_kind_e kind, char *arg) // {{{ key=file; returns 0 on error
+{
+  char *eq = strchr(arg, '=');
+  if (!eq || eq == arg || !eq[1] || opts->num_resources >= MAX_RESOURCES) {
+    return 0;
+  }
+  *eq = 0;
+  opts->resources[opts->num_resources++] = (struct resource_s){ kind, arg, eq + 1 };
+  return 1;
+}
+// }}}
+
+int main(int argc, char **argv)
+{
+  struct options_s opts = {
+    .output = "%d%b.%e",
+    .jobs = 1, .pages = 1
+  };
+  const char *tracefile = NULL, *stylefile = NULL;
+  xmlcairo_limits_t limits = { 0 };
+
+  static const struct option long_options[] = {
+    { "stats", no_argument, NULL, 's' },
+    { "stream", no_argument, NULL, 'R' },
+    { "max-dashes", required_argument, NULL, 'D' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int c, ok = 1;
+  while (ok && (c = getopt_long(argc, argv, "@:o:t:W:H:f:c:i:F:b:I:j:P:OSCM:T:sh" XSLT_OPTSTRING, long_options, NULL)) != -1) {
+    switch (c) {
+    case '@': ok = read_manifest(&opts, optarg); break;
+    case 'o': opts.output = optarg; break;
+    case 't': opts.type = optarg; break;
+    case 'W': opts.width = optarg; break;
+    case 'H': opts.height = optarg; break;
+    case 'f': opts.format = optarg; break;
+    case 'c': opts.content = optarg; break;
+    case 'i': ok = add_resource(&opts, RES_IMAGE, optarg); break;
+    case 'F': ok = add_resource(&opts, RES_FONT, optarg); break;
+    case 'b': ok = add_resource(&opts, RES_BINARY, optarg); break;
+    case 'I':
+      ok = (opts.num_search < MAX_SEARCH_DIRS);
+      if (ok) {
+        opts.search[opts.num_search++] = optarg;
+      }
+      break;
+    case 'j': opts.jobs = atoi(optarg); ok = (opts.jobs > 0); break;
+    case 'P': opts.pages = atoi(optarg); ok = (opts.pages > 0); break;
+    case 'R': opts.stream = 1; break;
+    case 'O': opts.optimize = 1; break;
+    case 'S': opts.simplify = 1; break;
+    case 'C': opts.cull = 1; break;
+    case 'M': ok = parse_size(optarg, &limits.max_memory); break;
+    case 'D': limits.max_dashes = atoi(optarg); ok = (limits.max_dashes > 0); break;
+    case 'T': tracefile = optarg; break;
+    case 's': opts.stats = 1; break;
+    case 'x': stylefile = optarg; break;
+    default: ok = 0; break;
+    }
+  }
+  for (int i = optind; ok && i < argc; i++) {
+    ok = add_input(&opts, argv[i]);
+  }
+  if (!ok || opts.num_inputs == 0 || (stylefile && opts.stream)) {
+    usage(argv[0]);
+    free(opts.inputs);
+    return 2;
+  }
+
+  if (tracefile) {
+    opts.trace = xmlcairo_trace_create(tracefile);
+    if (!opts.trace) {
+      fprintf(stderr, "could not create %s\n", tracefile);
+      free(opts.inputs);
+      return 1;
+    }
+  }
+
+  xmlInitParser();  // (before any threads)
+#ifdef WITH_XSLT
+  if (stylefile) {
+    opts.style = (xmlcairo_xslt_register() == 0) ? xsltParseStylesheetFile((const xmlChar *)stylefile) : NULL;
+    if (!opts.style) {
+      fprintf(stderr, "could not load %s\n", stylefile);
+      if (opts.trace) {
+        xmlcairo_trace_destroy(opts.trace);
+      }
+      free(opts.inputs);
+      return 1;
+    }
+  }
+#endif
+  xmlcairo_set_default_limits(&limits);
+
+  struct jobs_s jobs = {
+    .opts = &opts
+  };
+  const double start = now_ms();
+  if (opts.jobs > opts.num_inputs) {
+    opts.jobs = opts.num_inputs;
+  }
+  pthread_t *threads = (opts.jobs > 1) ? malloc((opts.jobs - 1) * sizeof(pthread_t)) : NULL;
+  if (opts.jobs > 1 && !threads) {
+    fprintf(stderr, "out of memory for -j %d, rendering on one thread\n", opts.jobs);
+  }
+  int num_started = 0;
+  for (int i = 1; threads && i < opts.jobs; i++) {  // (main thread is one of the workers)
+    if (pthread_create(&threads[num_started], NULL, job_thread, &jobs) == 0) {
+      num_started++;
+    }
+  }
+  job_thread(&jobs);
+  for (int i = 0; i < num_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  if (opts.stats) {
+    print_summary(now_ms() - start);
+  }
+
+  int ret = jobs.failed ? 1 : 0;
+  if (opts.trace && xmlcairo_trace_destroy(opts.trace) != 0) {
+    fprintf(stderr, "could not write %s\n", tracefile);
+    ret = 1;
+  }
+#ifdef WITH_XSLT
+  if (opts.style) {
+    xsltFreeStylesheet(opts.style);
+    xsltCleanupGlobals();
+  }
+#endif
+  free(opts.inputs);
+  xmlCleanupParser();
+  return ret;
+}
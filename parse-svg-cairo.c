@@ -1,4 +1,6 @@
 #include "parse-svg-cairo.h"
+#include "parse-svg.h"
+#include "xmlcairo-probes.h"
 #include <cairo.h>
 #include <string.h>
 #include <stdlib.h>
@@ -200,15 +202,6 @@ static const double pi = 3.14159265358979323846;
 
 #define EPS 10e-6
 
-struct _path_builder_t {
-  void (*move_to)(void *user, float x, float y);
-  void (*line_to)(void *user, float x, float y);
-  void (*quad_to)(void *user, float cx0, float cy0, float x, float y);
-  void (*curve_to)(void *user, float cx0, float cy0, float cx1, float cy1, float x, float y);
-  void (*arc_to)(void *user, float cx, float cy, float rx, float ry, float phi, float start, float delta);
-  void (*close)(void *user);
-};
-
 struct _psp_state {
   const struct _path_builder_t *builder;
   void *user;
@@ -597,6 +590,29 @@ int parse_svg_path(const char *path, const struct _path_builder_t *builder, void
   return -1;
 }
 
+int parse_svg_number_record(const char **cur, float *ret, int num, bool first)
+{
+  const char *tmp = skipWS(*cur);
+  if (!*tmp) {
+    *cur = tmp;
+    return 0;
+  }
+  if (!first) {
+    tmp = consumeCommaWS(*cur, false);
+  }
+
+  for (int i = 0; i < num; i++) {
+    const char *next = (i == 0) ? parseCoordinate(tmp, &ret[i]) : parseCoordinateMore(tmp, &ret[i]);
+    if (!next) {
+      *cur = tmp;
+      return -1;
+    }
+    tmp = next;
+  }
+  *cur = tmp;
+  return num;
+}
+
 
 static void _pbcairo_move_to(void *user, float x, float y)
 {
@@ -647,7 +663,324 @@ int apply_svg_cairo_path(cairo_t *cr, const char *path)
 {
   // cairo_new_sub_path(cr);  // not needed, svg always starts with M/m
   cairo_new_path(cr);  // TODO?
-  return parse_svg_path(path, &pbcairo, cr);
+  XMLCAIRO_PROBE1(path__parse__start, path);
+  const int res = parse_svg_path(path, &pbcairo, cr);
+  XMLCAIRO_PROBE2(path__parse__done, path, res);
+  return res;
+}
+
+// --- simplification of line runs (e.g. time series, gps tracks): radial distance filter, then Douglas-Peucker
+
+#define PBS_RUN_MAX 65536  // (points; longer runs are simplified in chunks: bounded memory, chunk ends are kept)
+
+struct _pbs_point {
+  double dx, dy;  // device space
+  float x, y;
+  bool keep;
+};
+
+struct _pbsimplify_state {
+  cairo_t *cr;
+  cairo_matrix_t ctm;
+  double tol2;
+
+  struct _pbs_point *pts;  // pts[0]: current point (already emitted)
+  int num, size;
+  int *stack;  // (first, last) pairs
+  bool skipped;  // last point of the run was dropped by the radial filter, but must still end the run
+  struct _pbs_point last;
+
+  float sx, sy;  // start of subpath
+};
+
+static void pbs_point(const struct _pbsimplify_state *state, float x, float y, struct _pbs_point *ret)
+{
+  ret->x = x;
+  ret->y = y;
+  ret->dx = x;
+  ret->dy = y;
+  cairo_matrix_transform_point(&state->ctm, &ret->dx, &ret->dy);
+  ret->keep = false;
+}
+
+// squared distance of p from segment a-b
+static double pbs_seg_dist2(const struct _pbs_point *p, const struct _pbs_point *a, const struct _pbs_point *b)
+{
+  const double vx = b->dx - a->dx, vy = b->dy - a->dy,
+               wx = p->dx - a->dx, wy = p->dy - a->dy;
+  const double len2 = vx * vx + vy * vy;
+  double t = (len2 > 0.0) ? (wx * vx + wy * vy) / len2 : 0.0;
+  t = (t < 0.0) ? 0.0 : (t > 1.0) ? 1.0 : t;
+  const double ex = wx - t * vx, ey = wy - t * vy;
+  return ex * ex + ey * ey;
+}
+
+static void pbs_douglas_peucker(struct _pbsimplify_state *state)
+{
+  struct _pbs_point *pts = state->pts;
+  const int num = state->num;
+  pts[0].keep = pts[num - 1].keep = true;
+
+  int top = 0;
+  state->stack[top++] = 0;
+  state->stack[top++] = num - 1;
+  while (top > 0) {
+    const int last = state->stack[--top], first = state->stack[--top];
+    double max = state->tol2;
+    int idx = -1;
+    for (int i = first + 1; i < last; i++) {
+      const double d2 = pbs_seg_dist2(&pts[i], &pts[first], &pts[last]);
+      if (d2 > max) {
+        max = d2;
+        idx = i;
+      }
+    }
+    if (idx >= 0) {
+      pts[idx].keep = true;
+      state->stack[top++] = first;  // (pending pairs are disjoint: at most num - 1)
+      state->stack[top++] = idx;
+      state->stack[top++] = idx;
+      state->stack[top++] = last;
+    }
+  }
+}
+
+// emits the run (except its first point); afterwards the run consists of just its last point
+static void pbs_flush(struct _pbsimplify_state *state)
+{
+  if (state->skipped) {
+    state->skipped = false;
+    state->pts[state->num++] = state->last;  // (size: one spare slot, cf. pbs_line_to)
+  }
+  if (state->num < 2) {
+    return;
+  }
+
+  if (state->num > 2) {
+    pbs_douglas_peucker(state);
+  }
+  for (int i = 1; i < state->num; i++) {
+    if (state->num == 2 || state->pts[i].keep) {
+      cairo_line_to(state->cr, state->pts[i].x, state->pts[i].y);
+    }
+  }
+
+  state->pts[0] = state->pts[state->num - 1];
+  state->num = 1;
+}
+
+// after curves / arcs / close: cairo knows the current point
+static void pbs_restart(struct _pbsimplify_state *state)
+{
+  double x, y;
+  cairo_get_current_point(state->cr, &x, &y);
+  pbs_point(state, x, y, &state->pts[0]);
+  state->num = 1;
+}
+
+static void _pbsimplify_move_to(void *user, float x, float y)
+{
+  struct _pbsimplify_state *state = (struct _pbsimplify_state *)user;
+  pbs_flush(state);
+  cairo_move_to(state->cr, x, y);
+  pbs_point(state, x, y, &state->pts[0]);
+  state->num = 1;
+  state->sx = x;
+  state->sy = y;
+}
+
+static void _pbsimplify_line_to(void *user, float x, float y)
+{
+  struct _pbsimplify_state *state = (struct _pbsimplify_state *)user;
+  struct _pbs_point p;
+  pbs_point(state, x, y, &p);
+
+  // radial distance: points close to the last kept one only matter as end of the run
+  const struct _pbs_point *prev = &state->pts[state->num - 1];
+  const double ddx = p.dx - prev->dx, ddy = p.dy - prev->dy;
+  if (ddx * ddx + ddy * ddy <= state->tol2) {
+    state->last = p;
+    state->skipped = true;
+    return;
+  }
+  state->skipped = false;
+
+  if (state->num + 1 >= state->size) {  // (keeps one spare slot for pbs_flush)
+    pbs_flush(state);
+  }
+  state->pts[state->num++] = p;
+}
+
+static void _pbsimplify_quad_to(void *user, float cx0, float cy0, float x, float y)
+{
+  struct _pbsimplify_state *state = (struct _pbsimplify_state *)user;
+  pbs_flush(state);
+  _pbcairo_quad_to(state->cr, cx0, cy0, x, y);
+  pbs_restart(state);
+}
+
+static void _pbsimplify_curve_to(void *user, float cx0, float cy0, float cx1, float cy1, float x, float y)
+{
+  struct _pbsimplify_state *state = (struct _pbsimplify_state *)user;
+  pbs_flush(state);
+  _pbcairo_curve_to(state->cr, cx0, cy0, cx1, cy1, x, y);
+  pbs_restart(state);
+}
+
+static void _pbsimplify_arc_to(void *user, float cx, float cy, float rx, float ry, float phi, float start, float delta)
+{
+  struct _pbsimplify_state *state = (struct _pbsimplify_state *)user;
+  pbs_flush(state);
+  _pbcairo_arc_to(state->cr, cx, cy, rx, ry, phi, start, delta);
+  pbs_restart(state);
+}
+
+static void _pbsimplify_close(void *user)
+{
+  struct _pbsimplify_state *state = (struct _pbsimplify_state *)user;
+  pbs_flush(state);
+  cairo_close_path(state->cr);
+  pbs_point(state, state->sx, state->sy, &state->pts[0]);
+  state->num = 1;
+}
+
+static const struct _path_builder_t pbsimplify = {
+  &_pbsimplify_move_to,
+  &_pbsimplify_line_to,
+  &_pbsimplify_quad_to,
+  &_pbsimplify_curve_to,
+  &_pbsimplify_arc_to,
+  &_pbsimplify_close
+};
+
+// max_points: upper bound of the number of points (smaller buffers); returns false on malloc error
+static bool pbs_init(struct _pbsimplify_state *state, cairo_t *cr, double tolerance, size_t max_points)
+{
+  *state = (struct _pbsimplify_state){
+    .cr = cr,
+    .tol2 = tolerance * tolerance,
+    .size = PBS_RUN_MAX,
+    .num = 1  // (paths start with a move, which sets the actual point)
+  };
+  if ((size_t)state->size > max_points + 3) {  // (min. 3 slots, cf. _pbsimplify_line_to)
+    state->size = max_points + 3;
+  }
+  state->pts = malloc(state->size * sizeof(*state->pts));
+  state->stack = malloc(2 * state->size * sizeof(*state->stack));
+  if (!state->pts || !state->stack) {
+    free(state->pts);
+    free(state->stack);
+    return false;
+  }
+  cairo_get_matrix(cr, &state->ctm);
+  memset(&state->pts[0], 0, sizeof(state->pts[0]));
+  return true;
+}
+
+static void pbs_finish(struct _pbsimplify_state *state)
+{
+  pbs_flush(state);  // (also after parse errors: same partial path as without simplification)
+  free(state->pts);
+  free(state->stack);
+}
+
+int apply_svg_cairo_path_simplified(cairo_t *cr, const char *path, double tolerance)
+{
+  struct _pbsimplify_state state;
+  if (!(tolerance > 0.0) || !pbs_init(&state, cr, tolerance, strlen(path) / 2)) {  // (each point takes at least two characters)
+    return apply_svg_cairo_path(cr, path);  // (just not simplified)
+  }
+
+  cairo_new_path(cr);
+  XMLCAIRO_PROBE1(path__parse__start, path);
+  const int res = parse_svg_path(path, &pbsimplify, &state);
+  pbs_finish(&state);
+  XMLCAIRO_PROBE2(path__parse__done, path, res);
+  return res;
+}
+
+// --- packed binary paths
+
+static inline void readPoint(const unsigned char *cur, enum binpath_format_e format, float *ret_x, float *ret_y)
+{
+  // (memcpy: data need not be aligned)
+  if (format == BINPATH_F64XY) {
+    double xy[2];
+    memcpy(xy, cur, sizeof(xy));
+    *ret_x = xy[0];
+    *ret_y = xy[1];
+  } else {
+    float xy[2];
+    memcpy(xy, cur, sizeof(xy));
+    *ret_x = xy[0];
+    *ret_y = xy[1];
+  }
+}
+
+long parse_binary_path(const void *coords, enum binpath_format_e format, size_t count,
+                       const unsigned char *ops, size_t num_ops,
+                       const struct _path_builder_t *builder, void *user)
+{
+  const size_t stride = (format == BINPATH_F64XY) ? 2 * sizeof(double) : 2 * sizeof(float);
+  const unsigned char *cur = coords;
+  float x[3], y[3];
+
+  if (!ops) {  // polyline
+    for (size_t i = 0; i < count; i++, cur += stride) {
+      readPoint(cur, format, &x[0], &y[0]);
+      if (i == 0) {
+        builder->move_to(user, x[0], y[0]);
+      } else {
+        builder->line_to(user, x[0], y[0]);
+      }
+    }
+    return -1;
+  }
+
+  size_t pos = 0;  // (points)
+  for (size_t i = 0; i < num_ops; i++) {
+    int n;
+    switch (ops[i]) {
+    case 'M': case 'L': n = 1; break;
+    case 'Q': n = 2; break;
+    case 'C': n = 3; break;
+    case 'Z': n = 0; break;
+    default:
+      return i;
+    }
+    if (pos == count && n > 0) {
+      return -1;  // (all points consumed; trailing 'Z's are still applied)
+    } else if (count - pos < (size_t)n || (pos == 0 && ops[i] != 'M')) {  // (first op must be a move)
+      return i;
+    }
+    for (int k = 0; k < n; k++, cur += stride) {
+      readPoint(cur, format, &x[k], &y[k]);
+    }
+    pos += n;
+
+    switch (ops[i]) {
+    case 'M': builder->move_to(user, x[0], y[0]); break;
+    case 'L': builder->line_to(user, x[0], y[0]); break;
+    case 'Q': builder->quad_to(user, x[0], y[0], x[1], y[1]); break;
+    case 'C': builder->curve_to(user, x[0], y[0], x[1], y[1], x[2], y[2]); break;
+    case 'Z': builder->close(user); break;
+    }
+  }
+  return (pos == count) ? -1 : (long)num_ops;
+}
+
+long apply_binary_cairo_path(cairo_t *cr, const void *coords, enum binpath_format_e format, size_t count,
+                             const unsigned char *ops, size_t num_ops, double tolerance)
+{
+  cairo_new_path(cr);
+
+  struct _pbsimplify_state state;
+  if (tolerance > 0.0 && pbs_init(&state, cr, tolerance, count)) {
+    const long res = parse_binary_path(coords, format, count, ops, num_ops, &pbsimplify, &state);
+    pbs_finish(&state);
+    return res;
+  }
+  return parse_binary_path(coords, format, count, ops, num_ops, &pbcairo, cr);
 }
 
 // ---
@@ -657,15 +990,6 @@ int apply_svg_cairo_path(cairo_t *cr, const char *path)
 
 // https://www.w3.org/TR/2011/REC-SVG11-20110816/coords.html#TransformAttribute
 
-struct _transform_builder_t {
-  void (*matrix)(void *user, float a, float b, float c, float d, float e, float f);
-  void (*translate)(void *user, float x, float y);
-  void (*scale)(void *user, float x, float y);
-  void (*rotate)(void *user, float a, float x, float y);
-  void (*skewX)(void *user, float ax);
-  void (*skewY)(void *user, float ay);
-};
-
 static inline const char *parseArgMore(const char *cur, float *ret)
 {
   cur = consumeCommaWS(cur, true);
@@ -899,6 +1223,10 @@ int parse_svg_cairo_dasharray(struct cairo_svg_dasharray_s *ret, const char *str
     if (cur == tmp) {
       return cur - str;
     }
+    if (ret->max_dashes && ret->num_dashes >= ret->max_dashes) {
+      ret->num_dashes++;
+      return cur - str;
+    }
     cur = consumeCommaWS(tmp, false);
     ret->num_dashes++;
   }
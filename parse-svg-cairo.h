@@ -3,15 +3,24 @@
 // ... #include <cairo.h>
 typedef struct _cairo cairo_t;
 typedef struct _cairo_matrix cairo_matrix_t;
+#include "parse-svg.h"  // enum binpath_format_e
 
 // returns < 0 on success, otherwise: position of first problematic character
 int apply_svg_cairo_path(cairo_t *cr, const char *path);
+// same, but runs of line segments are simplified to within tolerance (device units, cf. cairo_get_tolerance())
+// of the original, using the current ctm; curves and arcs are kept as is
+int apply_svg_cairo_path_simplified(cairo_t *cr, const char *path, double tolerance);
+
+// cf. parse_binary_path(); tolerance: simplification as above, 0: none
+long apply_binary_cairo_path(cairo_t *cr, const void *coords, enum binpath_format_e format, size_t count,
+                             const unsigned char *ops, size_t num_ops, double tolerance);
 
 int parse_svg_cairo_transform(cairo_matrix_t *matrix, const char *str);
 
 struct cairo_svg_dasharray_s {
   double *dashes;
   int num_dashes;
+  int max_dashes;  // (in) 0: unlimited; more entries: fails before allocating, with num_dashes > max_dashes
 };
 int parse_svg_cairo_dasharray(struct cairo_svg_dasharray_s *ret, const char *str); // *ret shall be zero-initialized
 void free_dasharray(struct cairo_svg_dasharray_s *da);
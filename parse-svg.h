@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+
+// generic (cairo-independent) svg path / transform parsers (and binary paths), cf. parse-svg-cairo.h
+
+struct _path_builder_t {
+  void (*move_to)(void *user, float x, float y);
+  void (*line_to)(void *user, float x, float y);
+  void (*quad_to)(void *user, float cx0, float cy0, float x, float y);
+  void (*curve_to)(void *user, float cx0, float cy0, float cx1, float cy1, float x, float y);
+  void (*arc_to)(void *user, float cx, float cy, float rx, float ry, float phi, float start, float delta);
+  void (*close)(void *user);
+};
+
+// returns < 0 on success, otherwise: position of first problematic character
+int parse_svg_path(const char *path, const struct _path_builder_t *builder, void *user);
+
+// comma / whitespace separated numbers (e.g. <polygon points>, packed lists), read in records of num values;
+// first: no separator before the first record.
+// returns num (*cur: after the record), 0 at the end of the string, or -1 (*cur: near the first problematic character)
+int parse_svg_number_record(const char **cur, float *ret, int num, _Bool first);
+
+// packed binary path data (e.g. memory-mapped), feeding the same builders
+enum binpath_format_e {
+  BINPATH_F32XY,
+  BINPATH_F64XY
+};
+// coords: count (x, y) pairs in native byte order, need not be aligned;
+// ops: NULL for a polyline (move, then lines), otherwise one byte per segment: 'M' / 'L' (1 point), 'Q' (2), 'C' (3), 'Z',
+// applied until all points are consumed (plus directly following 'Z's)
+// returns < 0 on success, otherwise: index of first problematic op (num_ops: ops ended before the points)
+long parse_binary_path(const void *coords, enum binpath_format_e format, size_t count,
+                       const unsigned char *ops, size_t num_ops,
+                       const struct _path_builder_t *builder, void *user);
+
+struct _transform_builder_t {
+  void (*matrix)(void *user, float a, float b, float c, float d, float e, float f);
+  void (*translate)(void *user, float x, float y);
+  void (*scale)(void *user, float x, float y);
+  void (*rotate)(void *user, float a, float x, float y);
+  void (*skewX)(void *user, float ax);
+  void (*skewY)(void *user, float ay);
+};
+
+// returns < 0 on success, otherwise: position of first problematic character
+int parse_svg_transform(const char *str, const struct _transform_builder_t *builder, void *user);
+
@@ -0,0 +1,208 @@
+// Regression tests for incremental rendering and culling: renders small documents onto png surfaces
+// and compares the pixels against a plain full render. Run via 'make check'.
+#include "../xmlcairo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+#include <libxml/tree.h>
+#include <libxml/parser.h>
+
+#define WIDTH 100
+#define HEIGHT 100
+
+static const char *outdir = ".";
+static int num_failed;
+
+// --- helpers
+
+static void check(int ok, const char *name, const char *what) // {{{
+{
+  printf("%s %s%s%s\n", (ok) ? "ok  " : "FAIL", name, (what) ? ": " : "", (what) ? what : "");
+  if (!ok) {
+    num_failed++;
+  }
+}
+// }}}
+
+static xmlDocPtr parse(const char *body) // {{{ body: children of <surface>
+{
+  char buf[8192];
+  snprintf(buf, sizeof(buf), "<surface>%s</surface>", body);
+  return xmlReadMemory(buf, strlen(buf), "test.xml", NULL, XML_PARSE_NONET);
+}
+// }}}
+
+static const char *out_name(char *buf, size_t size, const char *name, const char *suffix) // {{{
+{
+  snprintf(buf, size, "%s/%s-%s.png", outdir, name, suffix);
+  return buf;
+}
+// }}}
+
+// full render of body (cull: xmlcairo_surface_set_cull()); returns 0 on success
+static int render_full(const char *body, int cull, const char *filename) // {{{
+{
+  xmlDocPtr doc = parse(body);
+  xmlcairo_surface_t *surface = xmlcairo_surface_create_png(filename, CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+  if (!doc || !surface || !xmlcairo_surface_set_cull(surface, cull)) {
+    xmlFreeDoc(doc);
+    xmlcairo_surface_destroy(surface);
+    return -1;
+  }
+  cairo_status_t ret = xmlcairo_apply_list(surface, xmlDocGetRootElement(doc)->children);
+  const cairo_status_t dret = xmlcairo_surface_destroy(surface);
+  xmlFreeDoc(doc);
+  return (ret == CAIRO_STATUS_SUCCESS && dret == CAIRO_STATUS_SUCCESS) ? 0 : -1;
+}
+// }}}
+
+// bodies rendered one after the other with xmlcairo_apply_list_incremental() onto one (culling) surface;
+// ret_rect: damage of the last one. returns 0 on success
+static int render_incremental(const char *const *bodies, int num, const char *filename, int ret_rect[4]) // {{{
+{
+  xmlcairo_surface_t *surface = xmlcairo_surface_create_png(filename, CAIRO_FORMAT_ARGB32, WIDTH, HEIGHT);
+  if (!surface || !xmlcairo_surface_set_cull(surface, 1)) {
+    xmlcairo_surface_destroy(surface);
+    return -1;
+  }
+  cairo_status_t ret = CAIRO_STATUS_SUCCESS;
+  for (int i = 0; i < num && ret == CAIRO_STATUS_SUCCESS; i++) {
+    xmlDocPtr doc = parse(bodies[i]);
+    ret = (doc) ? xmlcairo_apply_list_incremental(surface, xmlDocGetRootElement(doc)->children, ret_rect)
+                : CAIRO_STATUS_READ_ERROR;
+    xmlFreeDoc(doc);
+  }
+  const cairo_status_t dret = xmlcairo_surface_destroy(surface);
+  return (ret == CAIRO_STATUS_SUCCESS && dret == CAIRO_STATUS_SUCCESS) ? 0 : -1;
+}
+// }}}
+
+// same size and pixels; returns 0 when unreadable
+static int same_pixels(const char *file_a, const char *file_b) // {{{
+{
+  cairo_surface_t *a = cairo_image_surface_create_from_png(file_a),
+                  *b = cairo_image_surface_create_from_png(file_b);
+  int ret = (cairo_surface_status(a) == CAIRO_STATUS_SUCCESS && cairo_surface_status(b) == CAIRO_STATUS_SUCCESS &&
+             cairo_image_surface_get_width(a) == cairo_image_surface_get_width(b) &&
+             cairo_image_surface_get_height(a) == cairo_image_surface_get_height(b) &&
+             cairo_image_surface_get_format(a) == cairo_image_surface_get_format(b));
+  if (ret) {
+    cairo_surface_flush(a);
+    cairo_surface_flush(b);
+    const int stride = cairo_image_surface_get_stride(a), height = cairo_image_surface_get_height(a);
+    const int bytes = 4 * cairo_image_surface_get_width(a);  // (ARGB32: stride padding is not compared)
+    const unsigned char *da = cairo_image_surface_get_data(a), *db = cairo_image_surface_get_data(b);
+    for (int y = 0; y < height && ret; y++) {
+      ret = (memcmp(da + y * stride, db + y * stride, bytes) == 0);
+    }
+  }
+  cairo_surface_destroy(a);
+  cairo_surface_destroy(b);
+  return ret;
+}
+// }}}
+
+// renders bodies[0..num-1] incrementally, and bodies[num-1] fully without culling: pixels must match
+static void check_incremental(const char *name, const char *const *bodies, int num) // {{{
+{
+  char inc[4096], full[4096];
+  out_name(inc, sizeof(inc), name, "incremental");
+  out_name(full, sizeof(full), name, "full");
+  if (render_incremental(bodies, num, inc, NULL) != 0 || render_full(bodies[num - 1], 0, full) != 0) {
+    check(0, name, "render failed");
+    return;
+  }
+  check(same_pixels(inc, full), name, "incremental render differs from full render");
+}
+// }}}
+
+// full renders of body with culling and of expected (same drawing, without the construct under test)
+// without: pixels must match
+static void check_same(const char *name, const char *body, const char *expected) // {{{
+{
+  char got[4096], want[4096];
+  out_name(got, sizeof(got), name, "got");
+  out_name(want, sizeof(want), name, "expected");
+  if (render_full(body, 1, got) != 0 || render_full(expected, 0, want) != 0) {
+    check(0, name, "render failed");
+    return;
+  }
+  check(same_pixels(got, want), name, "render differs from expected");
+}
+// }}}
+
+// --- tests
+
+// unbounded operators change everything inside the clip, not only the shape
+static void test_damage_unbounded_op() // {{{
+{
+  static const char *const bodies[] = {
+    "<set-source r='0' g='1' b='0'/><path d='M 80,80 h 10 v 10 h -10 z'/><fill/>"
+    "<set operator='in'/><set-source r='1' g='0' b='0' a='0.5'/><path d='M 10,10 h 10 v 10 h -10 z'/><fill/>",
+    "<set-source r='0' g='0' b='1'/><path d='M 80,80 h 10 v 10 h -10 z'/><fill/>"
+    "<set operator='in'/><set-source r='1' g='0' b='0' a='0.5'/><path d='M 10,10 h 10 v 10 h -10 z'/><fill/>"
+  };
+  check_incremental("damage-operator-in", bodies, 2);
+}
+// }}}
+
+// a <path> culled against the clip must still be drawn when the clip is wider by the time of <fill>
+static void test_cull_clip_changed() // {{{
+{
+  static const char *const expected = "<path d='M 50,50 h 10 v 10 h -10 z'/><fill/>";
+  check_same("cull-reset-clip",
+             "<path d='M 0,0 h 10 v 10 h -10 z'/><clip/>"
+             "<path d='M 50,50 h 10 v 10 h -10 z'/><reset-clip/><fill/>",
+             expected);
+  check_same("cull-sub-clip",
+             "<sub><path d='M 0,0 h 10 v 10 h -10 z'/><clip/><path d='M 50,50 h 10 v 10 h -10 z'/></sub><fill/>",
+             expected);
+  check_same("cull-reset-clip-clip",
+             "<path d='M 0,0 h 10 v 10 h -10 z'/><clip/>"
+             "<path d='M 50,50 h 10 v 10 h -10 z'/><reset-clip/><clip/><paint/>",
+             expected);
+  check_same("cull-sub-reset-clip",
+             "<path d='M 0,0 h 10 v 10 h -10 z'/><clip/>"
+             "<sub><reset-clip/><path d='M 50,50 h 10 v 10 h -10 z'/><fill/></sub>",
+             expected);
+}
+// }}}
+
+#define SYMBOLS(color) \
+  "<linear-gradient id='g' x0='0' y0='0' x1='20' y1='0'><stop offset='0' r='1' g='0' b='0'/>" \
+  "<stop offset='1' r='0' g='0' b='1'/></linear-gradient>" \
+  "<symbol id='dot'><set-source " color "/><path d='M 0,0 h 10 v 10 h -10 z'/><fill/></symbol>" \
+  "<symbol id='bar'><set-source pattern='g'/><path d='M 0,0 h 20 v 5 h -20 z'/><fill/></symbol>" \
+  "<symbol id='pair'><use ref='dot'/><use ref='bar' transform='translate(0,15)'/></symbol>" \
+  "<use ref='pair' transform='translate(10,10)'/><use ref='bar' transform='translate(60,60)'/>"
+
+// symbols are re-recorded only when they, or the symbols / patterns they reference, change
+static void test_symbol_deps() // {{{
+{
+  static const char *const unchanged[] = { SYMBOLS("r='0' g='1' b='0'"), SYMBOLS("r='0' g='1' b='0'") };
+  char name[4096];
+  int rect[4] = { -1, -1, -1, -1 };
+  const int ret = render_incremental(unchanged, 2, out_name(name, sizeof(name), "symbol-unchanged", "incremental"), rect);
+  check(ret == 0 && rect[0] == 0 && rect[1] == 0 && rect[2] == 0 && rect[3] == 0,
+        "symbol-unchanged", "unchanged re-render reports damage");
+
+  static const char *const changed[] = { SYMBOLS("r='0' g='1' b='0'"), SYMBOLS("r='1' g='0' b='1'") };
+  check_incremental("symbol-dep-changed", changed, 2);  // (pair must be re-recorded with the new dot)
+}
+// }}}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) {
+    outdir = argv[1];
+  }
+
+  test_damage_unbounded_op();
+  test_cull_clip_changed();
+  test_symbol_deps();
+
+  xmlCleanupParser();
+  printf("# %d failed\n", num_failed);
+  return (num_failed) ? 1 : 0;
+}
@@ -1,11 +1,20 @@
 #include "xmlcairo-int.h"
+#include "xmlcairo.h"  // xmlcairo_stats_kind_t
 #include <cairo.h>
 #include <assert.h>
 #include <string.h>  // strlen() can be inlined by compilers
+#include <stdint.h>
 #include <math.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
+#include <libxml/xmlIO.h>  // xmlOutputBufferFlush()
+#include <pthread.h>
 #include "parse-svg-cairo.h"
 #include "ftfont-cairo.h"
+#include "xmlcairo-probes.h"
+#include "xmlcairo-damage.h"
+#include "xmlcairo-cull.h"
+#include "xmlcairo-mem.h"
 
 #if __has_attribute(unused)
 #define UNUSED __attribute__((unused))
@@ -20,13 +29,15 @@ typedef int (*for_content_fn_t)(const xmlChar *value, void *user);
 
 // NOTE: xmlHasProp also searches DTD, this does not
 // returns first fn() returning !=0
-static int for_each_attr(xmlNodePtr node, for_each_attr_fn_t fn, void *user) // {{{
+// stats: can be NULL, otherwise each fn() call is timed
+static int for_each_attr(xmlcairo_stats_t *stats, xmlNodePtr node, for_each_attr_fn_t fn, void *user) // {{{
 {
   int ret;
   for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
     if (attr->type != XML_ATTRIBUTE_NODE) {
       continue;
     }
+    const unsigned long long start = (stats) ? _xmlcairo_stats_now() : 0;
     if (attr->children && !attr->children->next &&
         (attr->children->type == XML_TEXT_NODE ||
          attr->children->type == XML_CDATA_SECTION_NODE)) {
@@ -36,6 +47,9 @@ static int for_each_attr(xmlNodePtr node, for_each_attr_fn_t fn, void *user) //
       ret = fn(attr->name, val, user);
       xmlFree(val);
     }
+    if (stats) {
+      _xmlcairo_stats_add(stats, XMLCAIRO_STATS_ATTRIBUTE, (const char *)attr->name, _xmlcairo_stats_now() - start);
+    }
     if (ret != 0) {
       return ret;
     }
@@ -270,6 +284,40 @@ static cairo_operator_t parse_operator(const xmlChar *str) // {{{ or -1
 }
 // }}}
 
+static cairo_extend_t parse_extend(const xmlChar *str) // {{{ or -1
+{
+  if (strEqual(str, "none")) {
+    return CAIRO_EXTEND_NONE;
+  } else if (strEqual(str, "repeat")) {
+    return CAIRO_EXTEND_REPEAT;
+  } else if (strEqual(str, "reflect")) {
+    return CAIRO_EXTEND_REFLECT;
+  } else if (strEqual(str, "pad")) {
+    return CAIRO_EXTEND_PAD;
+  } else {
+    return -1;
+  }
+}
+// }}}
+
+static cairo_filter_t parse_filter(const xmlChar *str) // {{{ or -1
+{
+  if (strEqual(str, "fast")) {
+    return CAIRO_FILTER_FAST;
+  } else if (strEqual(str, "good")) {
+    return CAIRO_FILTER_GOOD;
+  } else if (strEqual(str, "best")) {
+    return CAIRO_FILTER_BEST;
+  } else if (strEqual(str, "nearest")) {
+    return CAIRO_FILTER_NEAREST;
+  } else if (strEqual(str, "bilinear")) {
+    return CAIRO_FILTER_BILINEAR;
+  } else {
+    return -1;
+  }
+}
+// }}}
+
 enum gravity_e {
   GRAVITY_CENTER = 0x00,
   GRAVITY_N = 0x10, GRAVITY_NE = 0x12,
@@ -419,16 +467,90 @@ static int alpha_attrs(const xmlChar *name, const xmlChar *value, void *user) //
 }
 // }}}
 
+struct _path_attrs_t {
+  xmlcairo_surface_t *surface;
+  xmlcairo_cull_t *cull;  // NULL: do not cull
+  int simplify;
+  cairo_t *cr;
+  xmlNodePtr node;
+
+  int has_d, binary;
+  // binary: applied after all attributes
+  const struct _xmlcairo_binary_t *src, *ops;
+  enum binpath_format_e format;
+  double offset, count, ops_offset;  // count: NAN = rest of src
+};
+
+static double parse_size(const xmlChar *str) // {{{ non-negative integer, or NAN
+{
+  const double ret = parse_double(str);
+  if (!(ret >= 0.0) || ret != floor(ret)) {
+    return NAN;
+  }
+  return ret;
+}
+// }}}
+
+// @d  OR  @src [@format] [@offset] [@count] [@ops] [@ops-offset]
 static int apply_path_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
 {
-  cairo_t *cr = (cairo_t *)user;
+  struct _path_attrs_t *attrs = (struct _path_attrs_t *)user;
+  cairo_t *cr = attrs->cr;
+
+  if (strEqual(name, "src") || strEqual(name, "ops")) {
+    attrs->binary = 1;
+    const struct _xmlcairo_binary_t *bin = xmlHashLookup(attrs->surface->binaries, value);
+    if (!bin) {
+      WARN("binary \"%s\" not found", value);
+      return ATTR_NOT_FOUND;
+    }
+    *((name[0] == 's') ? &attrs->src : &attrs->ops) = bin;
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "format")) {
+    attrs->binary = 1;
+    if (strEqual(value, "f32xy")) {
+      attrs->format = BINPATH_F32XY;
+    } else if (strEqual(value, "f64xy")) {
+      attrs->format = BINPATH_F64XY;
+    } else {
+      WARN("could not parse <path format=\"%s\">", value);
+      return ATTR_PARSE;
+    }
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "offset") || strEqual(name, "count") || strEqual(name, "ops-offset")) {
+    attrs->binary = 1;
+    const double val = parse_size(value);
+    if (isnan(val)) {
+      WARN("could not parse <path %s=\"%s\">", name, value);
+      return ATTR_PARSE;
+    }
+    *((name[0] == 'c') ? &attrs->count : (name[0] == 'o' && name[1] == 'f') ? &attrs->offset : &attrs->ops_offset) = val;
+    return ATTR_SUCCESS;
 
-  if (!strEqual(name, "d")) {
-    WARN("expected @d, got @%s", name);
+  } else if (!strEqual(name, "d")) {
+    WARN("expected @d or @src, got @%s", name);
     return ATTR_UNKNOWN;
   }
+  attrs->has_d = 1;
+
+  if (attrs->cull && value) {
+    const double margin = _xmlcairo_cull_stroke_margin(cr);  // (in case it will be stroked)
+    double bounds[4];
+    if (_xmlcairo_cull_path_bounds(attrs->cull, (const char *)value, bounds) &&
+        _xmlcairo_cull_bounded_op(cr) &&
+        _xmlcairo_cull_outside(cr, bounds, margin)) {
+      cairo_new_path(cr);
+      _xmlcairo_cull_set_culled_path(attrs->cull, cr, attrs->node, bounds, margin);
+      return ATTR_SUCCESS;
+    }
+    _xmlcairo_cull_set_culled_path(attrs->cull, cr, NULL, NULL, 0.0);
+  }
 
-  const int res = apply_svg_cairo_path(cr, (const char *)value);
+  const int res = (attrs->simplify)
+    ? apply_svg_cairo_path_simplified(cr, (const char *)value, cairo_get_tolerance(cr))
+    : apply_svg_cairo_path(cr, (const char *)value);
   if (res >= 0) {
     WARN("could not parse <path d=...%s\"", value + res);
     return ATTR_PARSE;
@@ -437,6 +559,285 @@ static int apply_path_attrs(const xmlChar *name, const xmlChar *value, void *use
 }
 // }}}
 
+// packed coordinates straight from the (memory-mapped) data, no text parsing; not culled
+static int apply_binary_path(const struct _path_attrs_t *attrs) // {{{
+{
+  if (attrs->has_d) {
+    WARN("only either <path d=\"...\"/> or <path src=\"...\"/> is allowed");
+    return ELEM_BADATTR;
+  } else if (!attrs->src) {
+    WARN("<path src=\"...\"/> is required");
+    return ELEM_BADATTR;
+  }
+
+  if (attrs->offset > attrs->src->len) {
+    WARN("<path offset=\"%.0f\"/> exceeds the data (%lu bytes)", attrs->offset, attrs->src->len);
+    return ELEM_BADATTR;
+  }
+  const double stride = (attrs->format == BINPATH_F64XY) ? 2 * sizeof(double) : 2 * sizeof(float);
+  const double avail = ((double)attrs->src->len - attrs->offset) / stride;
+  const double count = !isnan(attrs->count) ? attrs->count : floor(avail);
+  if (!(count <= avail)) {
+    WARN("<path src=\"...\" offset=\"%.0f\" count=\"%.0f\"/> exceeds the data (%lu bytes)", attrs->offset, count, attrs->src->len);
+    return ELEM_BADATTR;
+  }
+  const unsigned char *ops = NULL;
+  size_t num_ops = 0;
+  if (attrs->ops) {
+    if (attrs->ops_offset > attrs->ops->len) {
+      WARN("<path ops-offset=\"%.0f\"/> exceeds the data (%lu bytes)", attrs->ops_offset, attrs->ops->len);
+      return ELEM_BADATTR;
+    }
+    ops = attrs->ops->data + (size_t)attrs->ops_offset;
+    num_ops = attrs->ops->len - (size_t)attrs->ops_offset;
+  }
+
+  if (attrs->cull) {
+    _xmlcairo_cull_set_culled_path(attrs->cull, attrs->cr, NULL, NULL, 0.0);
+  }
+  const long res = apply_binary_cairo_path(attrs->cr, attrs->src->data + (size_t)attrs->offset, attrs->format, (size_t)count,
+                                           ops, num_ops, (attrs->simplify) ? cairo_get_tolerance(attrs->cr) : 0.0);
+  if (res >= 0) {
+    WARN("could not apply <path src=\"...\" ops=\"...\"/>: bad op at %ld", res);
+    return ELEM_BADATTR;
+  }
+  return ELEM_SUCCESS;
+}
+// }}}
+
+// --- <rect>, <circle>, <ellipse>, <polygon> and the batch forms <rects>, <circles>:
+// like <path>, they replace the current path (without building / parsing svg path strings)
+
+enum shape_kind_e {
+  SHAPE_RECT,
+  SHAPE_CIRCLE,
+  SHAPE_ELLIPSE,
+  SHAPE_POLYGON,
+  SHAPE_RECTS,
+  SHAPE_CIRCLES
+};
+
+static const char *const shape_elems[] = {"rect", "circle", "ellipse", "polygon", "rects", "circles"};
+static const char *const shape_attr_names[][7] = {
+  {"x", "y", "width", "height", "rx", "ry", NULL},
+  {"cx", "cy", "r", NULL},
+  {"cx", "cy", "rx", "ry", NULL},
+  {NULL},  // (@points)
+  {"rx", "ry", NULL},  // (content: x y width height ...)
+  {NULL}  // (content: cx cy r ...)
+};
+
+struct _shape_attrs_t {
+  enum shape_kind_e kind;
+  double vals[6];  // NAN: not given
+  cairo_t *cr;
+};
+
+static void ellipse_arc(cairo_t *cr, double cx, double cy, double rx, double ry, double angle1, double angle2) // {{{
+{
+  if (rx == ry) {
+    cairo_arc(cr, cx, cy, rx, angle1, angle2);
+    return;
+  }
+  // assert(rx > 0.0 && ry > 0.0);
+  cairo_matrix_t saved;
+  cairo_get_matrix(cr, &saved);  // (cheaper than cairo_save / _restore)
+  cairo_translate(cr, cx, cy);
+  cairo_scale(cr, rx, ry);
+  cairo_arc(cr, 0.0, 0.0, 1.0, angle1, angle2);
+  cairo_set_matrix(cr, &saved);
+}
+// }}}
+
+// svg semantics: missing rx / ry is the same as the other one, both clamped to half the width / height
+static void rect_path(cairo_t *cr, double x, double y, double width, double height, double rx, double ry) // {{{
+{
+  if (isnan(rx)) {
+    rx = ry;
+  } else if (isnan(ry)) {
+    ry = rx;
+  }
+  if (!(rx > 0.0 && ry > 0.0) || width == 0.0 || height == 0.0) {
+    cairo_rectangle(cr, x, y, width, height);
+    return;
+  }
+
+  if (width < 0.0) {
+    x += width;
+    width = -width;
+  }
+  if (height < 0.0) {
+    y += height;
+    height = -height;
+  }
+  rx = fmin(rx, width / 2.0);
+  ry = fmin(ry, height / 2.0);
+
+  cairo_new_sub_path(cr);
+  ellipse_arc(cr, x + width - rx, y + ry, rx, ry, -M_PI / 2.0, 0.0);
+  ellipse_arc(cr, x + width - rx, y + height - ry, rx, ry, 0.0, M_PI / 2.0);
+  ellipse_arc(cr, x + rx, y + height - ry, rx, ry, M_PI / 2.0, M_PI);
+  ellipse_arc(cr, x + rx, y + ry, rx, ry, M_PI, 1.5 * M_PI);
+  cairo_close_path(cr);
+}
+// }}}
+
+// zero radius: nothing (svg: disables rendering)
+static void ellipse_path(cairo_t *cr, double cx, double cy, double rx, double ry) // {{{
+{
+  if (rx > 0.0 && ry > 0.0) {
+    cairo_new_sub_path(cr);
+    ellipse_arc(cr, cx, cy, rx, ry, 0.0, 2.0 * M_PI);
+    cairo_close_path(cr);
+  }
+}
+// }}}
+
+static int shape_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
+{
+  struct _shape_attrs_t *attrs = (struct _shape_attrs_t *)user;
+
+  if (attrs->kind == SHAPE_POLYGON && strEqual(name, "points")) {
+    return ATTR_SUCCESS;  // (cf. apply_shape)
+  }
+
+  for (int i = 0; shape_attr_names[attrs->kind][i]; i++) {
+    if (strEqual(name, shape_attr_names[attrs->kind][i])) {
+      attrs->vals[i] = parse_double(value);
+      if (isnan(attrs->vals[i])) {
+        WARN("could not parse <%s %s=\"%s\">", shape_elems[attrs->kind], name, value);
+        return ATTR_PARSE;
+      } else if (attrs->vals[i] < 0.0 && name[0] == 'r') {  // (r, rx, ry)
+        WARN("<%s %s=\"%s\"> must not be negative", shape_elems[attrs->kind], name, value);
+        return ATTR_PARSE;
+      }
+      return ATTR_SUCCESS;
+    }
+  }
+
+  WARN("attribute <%s %s=...> not known", shape_elems[attrs->kind], name);
+  return ATTR_UNKNOWN;
+}
+// }}}
+
+// <polygon points>, <rects>, <circles>
+static int shape_list(const xmlChar *value, void *user) // {{{
+{
+  if (!value) {
+    return ELEM_CAIRO_ERROR;  // TODO... malloc error ?
+  }
+
+  const struct _shape_attrs_t *attrs = (const struct _shape_attrs_t *)user;
+  cairo_t *cr = attrs->cr;
+  const int num = (attrs->kind == SHAPE_RECTS) ? 4 : (attrs->kind == SHAPE_CIRCLES) ? 3 : 2;
+
+  const char *cur = (const char *)value;
+  float v[4];
+  int res;
+  for (int first = 1; (res = parse_svg_number_record(&cur, v, num, first)) > 0; first = 0) {
+    switch (attrs->kind) {
+    case SHAPE_POLYGON:
+      if (first) {
+        cairo_move_to(cr, v[0], v[1]);
+      } else {
+        cairo_line_to(cr, v[0], v[1]);
+      }
+      break;
+    case SHAPE_RECTS:
+      rect_path(cr, v[0], v[1], v[2], v[3], attrs->vals[0], attrs->vals[1]);
+      break;
+    case SHAPE_CIRCLES:
+      if (v[2] < 0.0) {
+        WARN("<circles> radius must not be negative: ...%s", cur);
+        return ELEM_BADATTR;
+      }
+      ellipse_path(cr, v[0], v[1], v[2], v[2]);
+      break;
+    default:
+      assert(0);
+    }
+  }
+  if (res < 0) {
+    WARN("could not parse <%s>...%s", shape_elems[attrs->kind], cur);
+    return ELEM_BADATTR;
+  }
+  if (attrs->kind == SHAPE_POLYGON && cairo_has_current_point(cr)) {
+    cairo_close_path(cr);
+  }
+  return ELEM_SUCCESS;
+}
+// }}}
+
+static int apply_shape(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insn, enum shape_kind_e kind) // {{{
+{
+  struct _shape_attrs_t attrs = {
+    .kind = kind,
+    .vals = {NAN, NAN, NAN, NAN, NAN, NAN},
+    .cr = cr
+  };
+  if (kind == SHAPE_RECT || kind == SHAPE_CIRCLE || kind == SHAPE_ELLIPSE) {
+    attrs.vals[0] = attrs.vals[1] = 0.0;  // x, y / cx, cy
+  }
+
+  cairo_new_path(cr);
+  if (surface->cull) {
+    _xmlcairo_cull_set_culled_path(surface->cull, cr, NULL, NULL, 0.0);
+  }
+  if (kind == SHAPE_POLYGON) {
+    // (the value passed to shape_attrs() is not valid afterwards)
+    int res = ELEM_BADATTR;
+    xmlChar *points = xmlGetNoNsProp(insn, (const xmlChar *)"points");
+    if (for_each_attr(surface->stats, insn, shape_attrs, &attrs)) {
+      // res = ELEM_BADATTR;
+    } else if (!points) {
+      WARN("<polygon points=\"...\"/> is required");
+    } else {
+      res = shape_list(points, &attrs);
+    }
+    xmlFree(points);
+    return res;
+  }
+
+  if (for_each_attr(surface->stats, insn, shape_attrs, &attrs)) {
+    return ELEM_BADATTR;
+  }
+  const double *v = attrs.vals;
+  switch (kind) {
+  case SHAPE_RECT:
+    if (isnan(v[2]) || isnan(v[3])) {
+      WARN("<rect width=\"...\" height=\"...\"/> are required");
+      return ELEM_BADATTR;
+    }
+    rect_path(cr, v[0], v[1], v[2], v[3], v[4], v[5]);
+    return ELEM_SUCCESS;
+
+  case SHAPE_CIRCLE:
+    if (isnan(v[2])) {
+      WARN("<circle r=\"...\"/> is required");
+      return ELEM_BADATTR;
+    }
+    ellipse_path(cr, v[0], v[1], v[2], v[2]);
+    return ELEM_SUCCESS;
+
+  case SHAPE_ELLIPSE:
+    if (isnan(v[2]) || isnan(v[3])) {
+      WARN("<ellipse rx=\"...\" ry=\"...\"/> are required");
+      return ELEM_BADATTR;
+    }
+    ellipse_path(cr, v[0], v[1], v[2], v[3]);
+    return ELEM_SUCCESS;
+
+  case SHAPE_RECTS:
+  case SHAPE_CIRCLES:
+    return for_content(insn, shape_list, &attrs);
+
+  default:
+    assert(0);
+    return ELEM_UNKNOWN;
+  }
+}
+// }}}
+
 static int apply_transform_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
 {
   cairo_t *cr = (cairo_t *)user;
@@ -531,6 +932,44 @@ err_parse:
 }
 // }}}
 
+// for xmlcairo-optimize.c, same semantics as apply_set_attrs() (but silent)
+int _xmlcairo_parse_set_attr(const xmlChar *name, const xmlChar *value, double *ret) // {{{
+{
+  if (!value) {
+    return -2;
+  }
+
+  double val;
+#define ENUM_ATTR(attr, IDX, parse_fn, type) \
+  if (strEqual(name, attr)) { \
+    const type e = parse_fn(value); \
+    *ret = e; \
+    return (e == (type)-1) ? -2 : IDX; \
+  }
+  ENUM_ATTR("antialias", XMLCAIRO_SET_ANTIALIAS, parse_antialias, cairo_antialias_t)
+  ENUM_ATTR("fill-rule", XMLCAIRO_SET_FILL_RULE, parse_fill_rule, cairo_fill_rule_t)
+  ENUM_ATTR("line-cap", XMLCAIRO_SET_LINE_CAP, parse_line_cap, cairo_line_cap_t)
+  ENUM_ATTR("line-join", XMLCAIRO_SET_LINE_JOIN, parse_line_join, cairo_line_join_t)
+  ENUM_ATTR("operator", XMLCAIRO_SET_OPERATOR, parse_operator, cairo_operator_t)
+#undef ENUM_ATTR
+
+  if (strEqual(name, "line-width")) {
+    val = parse_double(value);
+    *ret = (val < 0.0) ? 0.0 : val;
+    return isnan(val) ? -2 : XMLCAIRO_SET_LINE_WIDTH;
+  } else if (strEqual(name, "miter-limit")) {
+    val = parse_double(value);
+    *ret = (val < 1.0) ? 1.0 : val;
+    return isnan(val) ? -2 : XMLCAIRO_SET_MITER_LIMIT;
+  } else if (strEqual(name, "tolerance")) {
+    val = parse_double(value);
+    *ret = (val < 0.0) ? 0.0 : val;
+    return isnan(val) ? -2 : XMLCAIRO_SET_TOLERANCE;
+  }
+  return -1;
+}
+// }}}
+
 static int offset_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
 {
   if (!strEqual(name, "offset")) {
@@ -560,7 +999,10 @@ static int dash_content(const xmlChar *value, void *user) // {{{
   struct cairo_svg_dasharray_s *da = (struct cairo_svg_dasharray_s *)user;
 
   const int res = parse_svg_cairo_dasharray(da, (const char *)value);
-  if (res >= 0) {
+  if (res >= 0 && da->max_dashes && da->num_dashes > da->max_dashes) {
+    WARN("<dash> has more than %d entries (cf. xmlcairo_limits_t)", da->max_dashes);
+    return ELEM_CAIRO_ERROR;
+  } else if (res >= 0) {
     WARN("could not parse ...%s</dash>", value + res);
     return ELEM_CAIRO_ERROR;
   }
@@ -582,6 +1024,21 @@ static int dash_content(const xmlChar *value, void *user) // {{{
 }
 // }}}
 
+// <linear-gradient id>, <radial-gradient id>, <surface-pattern id>;
+// shared by all <set-source pattern> / <mask pattern> (cairo_set_source() just takes a reference)
+struct _xmlcairo_pattern_def_t {
+  cairo_pattern_t *pattern;
+  unsigned long long key;  // hash of element + resource generation: only rebuilt when changed
+};
+
+void _xmlcairo_pattern_free(void *entry, const xmlChar *name UNUSED) // {{{
+{
+  struct _xmlcairo_pattern_def_t *def = (struct _xmlcairo_pattern_def_t *)entry;
+  cairo_pattern_destroy(def->pattern);
+  free(def);
+}
+// }}}
+
 struct _set_source_mask_attrs_t {
   xmlcairo_surface_t *surface;
   enum {
@@ -604,19 +1061,17 @@ static int set_source_mask_attrs(const xmlChar *name, const xmlChar *value, void
   struct _set_source_mask_attrs_t *attrs = (struct _set_source_mask_attrs_t *)user;
   const int is_mask = !!(attrs->type & SSTYPE_MASK_NORGB);
 
-/*
   if (strEqual(name, "pattern")) {
     attrs->type |= SSTYPE_PATTERN;
-    attrs->pattern = xmlHashLookup(attrs->surface->..., value);
-    if (!attrs->pattern) {
+    const struct _xmlcairo_pattern_def_t *def = xmlHashLookup(attrs->surface->patterns, value);
+    if (!def) {
       WARN("pattern \"%s\" not found", value);
       return ATTR_NOT_FOUND;
     }
+    attrs->pattern = def->pattern;
     return ATTR_SUCCESS;
 
-  } else
-*/
-  if (strEqual(name, "image")) {
+  } else if (strEqual(name, "image")) {
     attrs->type |= SSTYPE_IMAGE;
     attrs->image = xmlHashLookup(attrs->surface->imgs, value);
     if (!attrs->image) {
@@ -701,8 +1156,10 @@ struct _text_attrs_t {
   double size;
   double x, y;
   double max_width;
+  xmlChar *script, *lang, *features;  // must be xmlFree()d
 
   cairo_t *cr; // for text_content
+  unsigned long long cull_key;  // 0: do not cull
 };
 
 static int text_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
@@ -740,6 +1197,18 @@ static int text_attrs(const xmlChar *name, const xmlChar *value, void *user) //
       goto err_parse;
     }
 
+  } else if (strEqual(name, "script")) {
+    xmlFree(attrs->script);
+    attrs->script = xmlStrdup(value);
+
+  } else if (strEqual(name, "lang")) {
+    xmlFree(attrs->lang);
+    attrs->lang = xmlStrdup(value);
+
+  } else if (strEqual(name, "features")) {
+    xmlFree(attrs->features);
+    attrs->features = xmlStrdup(value);
+
   } else {
     WARN("attribute <text %s=...> not known", name);
     return ATTR_UNKNOWN;
@@ -753,22 +1222,31 @@ err_parse:
 }
 // }}}
 
-static int text_content(const xmlChar *value, void *user) // {{{
+static int show_text(const xmlChar *value, struct _text_attrs_t *attrs) // {{{
 {
-  if (!value) {
-    return ELEM_CAIRO_ERROR;  // TODO... malloc error ?
-  } else if (!*value) {
-    return ELEM_SUCCESS;
-  }
 
-  struct _text_attrs_t *attrs = (struct _text_attrs_t *)user;
+  // bounds are only known after the first render
+  int cached = 0;
+  if (attrs->cull_key) {
+    double bounds[4];
+    cached = _xmlcairo_cull_text_lookup(attrs->surface->cull, attrs->cull_key, bounds);
+    if (cached && _xmlcairo_cull_bounded_op(attrs->cr) && _xmlcairo_cull_outside(attrs->cr, bounds, 0.0)) {
+      return ELEM_SUCCESS;
+    }
+  }
 
   ftfont_cairo_set_font(attrs->cr, attrs->font, attrs->size);
 
+  const ftfont_cairo_shaping_t shaping = {
+    .script = (const char *)attrs->script,
+    .language = (const char *)attrs->lang,
+    .features = (const char *)attrs->features
+  };
+
   int num_glyphs;
   cairo_glyph_t *glyphs;
   if (!isnan(attrs->max_width) && attrs->max_width > 0.0) { // TODO?
-    glyphs = ftfont_cairo_get_glyphs(attrs->cr, (const char *)value, -1, 0.0, 0.0, 1, 0, &num_glyphs);
+    glyphs = ftfont_cairo_get_glyphs(attrs->cr, attrs->surface->fmgr, &shaping, (const char *)value, -1, 0.0, 0.0, 1, 0, &num_glyphs);
     if (glyphs) {
       cairo_text_extents_t ext;
       cairo_glyph_extents(attrs->cr, glyphs, num_glyphs, &ext);
@@ -781,83 +1259,1259 @@ static int text_content(const xmlChar *value, void *user) // {{{
       }
     }
   } else {
-    glyphs = ftfont_cairo_get_glyphs(attrs->cr, (const char *)value, -1, attrs->x, attrs->y, 1, 0, &num_glyphs);
+    glyphs = ftfont_cairo_get_glyphs(attrs->cr, attrs->surface->fmgr, &shaping, (const char *)value, -1, attrs->x, attrs->y, 1, 0, &num_glyphs);
   }
   if (!glyphs) {
     return ELEM_CAIRO_ERROR;
   }
 
+  if (attrs->cull_key && !cached) {
+    cairo_text_extents_t ext;
+    cairo_glyph_extents(attrs->cr, glyphs, num_glyphs, &ext);
+    const double bounds[4] = { ext.x_bearing, ext.y_bearing, ext.x_bearing + ext.width, ext.y_bearing + ext.height };
+    _xmlcairo_cull_text_insert(attrs->surface->cull, attrs->cull_key, bounds);
+  }
+
+  if (attrs->surface->damage && _xmlcairo_damage_glyphs(attrs->surface->damage, attrs->cr, glyphs, num_glyphs)) {
+    return ELEM_SUCCESS;
+  }
   cairo_show_glyphs(attrs->cr, glyphs, num_glyphs);
-  cairo_glyph_free(glyphs);
 
   return ELEM_SUCCESS;
 }
 // }}}
 
+// glyph buffer for value: at most one glyph per byte
+static inline unsigned long long glyph_bytes(const xmlChar *value) // {{{
+{
+  return (unsigned long long)xmlStrlen(value) * sizeof(cairo_glyph_t);
+}
+// }}}
 
-static cairo_status_t _xmlcairo_apply_list(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insns);
+static int text_content(const xmlChar *value, void *user) // {{{
+{
+  if (!value) {
+    return ELEM_CAIRO_ERROR;  // TODO... malloc error ?
+  } else if (!*value) {
+    return ELEM_SUCCESS;
+  }
 
-static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insn)
+  struct _text_attrs_t *attrs = (struct _text_attrs_t *)user;
+  const unsigned long long bytes = glyph_bytes(value);
+  if (!_xmlcairo_mem_charge(attrs->surface->mem, XMLCAIRO_MEMORY_GLYPHS, bytes)) {
+    return ELEM_CAIRO_ERROR;
+  }
+  const int ret = show_text(value, attrs);
+  _xmlcairo_mem_release(attrs->surface->mem, XMLCAIRO_MEMORY_GLYPHS, bytes);
+  return ret;
+}
+// }}}
+
+// --- <labels font="..." size="..." [script] [lang] [features]>x y anchor text (one per line)...</labels>
+// font set once, all glyphs emitted with a single cairo_show_glyphs()
+
+struct _labels_t {
+  const struct _text_attrs_t *attrs;
+  cairo_glyph_t *glyphs;
+  int num_glyphs, size;
+};
+
+static int labels_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{ <text> attributes, except positioning
 {
-  if (!insn || insn->type != XML_ELEMENT_NODE) {
-    return ELEM_NOT_ELEMENT;
+  if (strEqual(name, "x") || strEqual(name, "y") || strEqual(name, "max-width")) {
+    WARN("attribute <labels %s=...> not known", name);
+    return ATTR_UNKNOWN;
   }
-  if (!insn->name || !*insn->name) {
-    WARN("empty element name");
-    return ELEM_UNKNOWN; // unknown element
+  return text_attrs(name, value, user);
+}
+// }}}
+
+// anchor: 0 start, 1 middle, 2 end (svg text-anchor); returns 0 on malloc error
+static int add_label(struct _labels_t *labels, const ftfont_cairo_shaping_t *shaping, const char *str, int len, double x, double y, int anchor) // {{{
+{
+  const struct _text_attrs_t *attrs = labels->attrs;
+
+  int num;
+  cairo_glyph_t *glyphs = ftfont_cairo_get_glyphs(attrs->cr, attrs->surface->fmgr, shaping, str, len, x, y, 1, 0, &num);
+  if (!glyphs) {
+    return 0;
+  }
+  double dx = 0.0;
+  if (anchor && num > 0) {
+    cairo_text_extents_t ext;
+    cairo_glyph_extents(attrs->cr, glyphs, num, &ext);
+    dx = (anchor == 1) ? -ext.x_advance / 2.0 : -ext.x_advance;
   }
 
-#define CASE(c0, c1) case (((const xmlChar)(c0) << 8) + (const xmlChar)(c1))
-#define EQ(full) strEqual(insn->name, full)   // +2, +2  (but probably not more efficient)
-  switch ((insn->name[0] << 8) | insn->name[1]) {
-  CASE('c', 'l'):
-    if (EQ("clip")) {
-      int preserve = 0;
-      if (for_each_attr(insn, preserve_attrs, &preserve)) {
-        return ELEM_BADATTR;
-      }
-      if (preserve) {
-        cairo_clip_preserve(cr);
-      } else {
-        cairo_clip(cr);
-      }
-      return ELEM_SUCCESS;
+  if (labels->num_glyphs + num > labels->size) {
+    const int size = 2 * labels->size + num;
+    cairo_glyph_t *tmp = realloc(labels->glyphs, size * sizeof(cairo_glyph_t));
+    if (!tmp) {
+      return 0;
     }
-    break;
+    labels->glyphs = tmp;
+    labels->size = size;
+  }
+  // (glyphs are in the font manager's scratch buffer)
+  cairo_glyph_t *dst = labels->glyphs + labels->num_glyphs;
+  for (int i = 0; i < num; i++) {
+    dst[i] = glyphs[i];
+    dst[i].x += dx;
+  }
+  labels->num_glyphs += num;
+  return 1;
+}
+// }}}
 
-  CASE('c', 'o'):
-    if (EQ("copy-page")) {
-      if (for_each_attr(insn, no_attrs, NULL)) {
-        return ELEM_BADATTR;
-      }
-      cairo_copy_page(cr);
-      return ELEM_SUCCESS;
+static int show_labels(const xmlChar *value, const struct _text_attrs_t *attrs) // {{{
+{
+  struct _labels_t labels = {
+    .attrs = attrs
+  };
+
+  ftfont_cairo_set_font(attrs->cr, attrs->font, attrs->size);
+  const ftfont_cairo_shaping_t shaping = {
+    .script = (const char *)attrs->script,
+    .language = (const char *)attrs->lang,
+    .features = (const char *)attrs->features
+  };
+
+  const char *cur = (const char *)value;
+  while (*cur) {
+    const char *line = cur + strspn(cur, " \t\r\n");
+    const char *eol = line + strcspn(line, "\n");
+    cur = (*eol) ? eol + 1 : eol;
+    if (line == eol) {
+      continue;
     }
-    break;
 
-  CASE('d', 'a'):
-    if (EQ("dash")) {
-      double offset = 0.0;
-      if (for_each_attr(insn, offset_attrs, &offset)) {
-        return ELEM_BADATTR;
-      }
-      struct cairo_svg_dasharray_s da = {};
-      const int res = for_content(insn, dash_content, &da);
-      if (res == ELEM_SUCCESS) {
-        cairo_set_dash(cr, da.dashes, da.num_dashes, offset);
-        free_dasharray(&da);
-      }
-      return res;
+    // (strtod() returns 0 when nothing was parsed, and skips any whitespace, also newlines)
+    char *end;
+    const double x = strtod(line, &end);
+    const char *ystr = end;
+    const double y = (ystr != line) ? strtod(ystr, &end) : 0.0;
+    const char *anchor = end + strspn(end, " \t");
+    const size_t alen = strcspn(anchor, " \t\r\n");
+    const int a = (alen == 5 && strncmp(anchor, "start", 5) == 0) ? 0 :
+                  (alen == 6 && strncmp(anchor, "middle", 6) == 0) ? 1 :
+                  (alen == 3 && strncmp(anchor, "end", 3) == 0) ? 2 : -1;
+    if (ystr == line || end == ystr || end > eol || end == anchor || a < 0) {
+      WARN("could not parse <labels> line: %.*s", (int)(eol - line), line);
+      free(labels.glyphs);
+      return ELEM_BADATTR;
     }
-    break;
 
-  CASE('f', 'i'):
-    if (EQ("fill")) {
+    const char *str = anchor + alen;
+    if (*str == ' ' || *str == '\t') {
+      str++;  // (single separator: further whitespace is part of the text)
+    }
+    int len = eol - str;
+    if (len > 0 && str[len - 1] == '\r') {
+      len--;
+    }
+    if (len > 0 && !add_label(&labels, &shaping, str, len, x, y, a)) {
+      free(labels.glyphs);
+      return ELEM_CAIRO_ERROR;
+    }
+  }
+
+  if (labels.num_glyphs > 0 &&
+      (!attrs->surface->damage || !_xmlcairo_damage_glyphs(attrs->surface->damage, attrs->cr, labels.glyphs, labels.num_glyphs))) {
+    cairo_show_glyphs(attrs->cr, labels.glyphs, labels.num_glyphs);
+  }
+  free(labels.glyphs);
+  return ELEM_SUCCESS;
+}
+// }}}
+
+static int labels_content(const xmlChar *value, void *user) // {{{
+{
+  if (!value) {
+    return ELEM_CAIRO_ERROR;  // TODO... malloc error ?
+  }
+
+  const struct _text_attrs_t *attrs = (const struct _text_attrs_t *)user;
+  const unsigned long long bytes = glyph_bytes(value);  // (labels.glyphs; positions and anchors only make it smaller)
+  if (!_xmlcairo_mem_charge(attrs->surface->mem, XMLCAIRO_MEMORY_GLYPHS, bytes)) {
+    return ELEM_CAIRO_ERROR;
+  }
+  const int ret = show_labels(value, attrs);
+  _xmlcairo_mem_release(attrs->surface->mem, XMLCAIRO_MEMORY_GLYPHS, bytes);
+  return ret;
+}
+// }}}
+
+static cairo_status_t _xmlcairo_apply_list(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insns);
+
+// --- <symbol id="..."> ... </symbol>, <use ref="..." [transform="..."]/>
+
+#define STAMP_SUBPIXEL 4  // offset buckets per pixel (and axis)
+#define STAMP_MAX_PIXELS (256 * 256)
+#define STAMP_MAX_PER_SYMBOL 64
+
+// <use cache="raster">: symbol rasterized for one ctm (linear part + subpixel offset bucket)
+struct _xmlcairo_stamp_t {
+  double xx, yx, xy, yy;
+  int bx, by;
+  cairo_surface_t *image;
+  double x, y;  // image position, relative to the integer part of the ctm translation
+};
+
+struct _xmlcairo_symbol_t {
+  cairo_surface_t *recording;  // (unbounded)
+  unsigned long long key;  // hash of subtree, resource generation and referenced symbols / patterns: only re-recorded when changed
+  double ink[4];  // x0, y0, x1, y1; empty: x0 > x1
+
+  struct _xmlcairo_stamp_t stamps[STAMP_MAX_PER_SYMBOL];
+  int num_stamps, next_evict;
+  struct _xmlcairo_mem_t *mem;  // (stamps are charged as XMLCAIRO_MEMORY_IMAGES)
+};
+
+static inline unsigned long long stamp_bytes(cairo_surface_t *image) // {{{
+{
+  return (unsigned long long)cairo_image_surface_get_stride(image) * cairo_image_surface_get_height(image);
+}
+// }}}
+
+static void free_stamps(struct _xmlcairo_symbol_t *symbol) // {{{
+{
+  for (int i = 0; i < symbol->num_stamps; i++) {
+    _xmlcairo_mem_release(symbol->mem, XMLCAIRO_MEMORY_IMAGES, stamp_bytes(symbol->stamps[i].image));
+    cairo_surface_destroy(symbol->stamps[i].image);
+  }
+  symbol->num_stamps = symbol->next_evict = 0;
+}
+// }}}
+
+void _xmlcairo_symbol_free(void *entry, const xmlChar *name UNUSED) // {{{
+{
+  struct _xmlcairo_symbol_t *symbol = (struct _xmlcairo_symbol_t *)entry;
+  free_stamps(symbol);
+  cairo_surface_destroy(symbol->recording);
+  free(symbol);
+}
+// }}}
+
+static inline unsigned long long hash_bytes(unsigned long long h, const void *data, size_t len) // {{{ FNV-1a
+{
+  const unsigned char *cur = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= cur[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+// }}}
+
+// element names, attributes and text of node and its following siblings
+static unsigned long long hash_subtree(unsigned long long h, xmlNodePtr node) // {{{
+{
+  for (; node; node = node->next) {
+    h = hash_bytes(h, &node->type, sizeof(node->type));
+    if (node->type == XML_ELEMENT_NODE) {
+      h = hash_bytes(h, node->name, xmlStrlen(node->name) + 1);
+      for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+        h = hash_bytes(h, attr->name, xmlStrlen(attr->name) + 1);
+        h = hash_subtree(h, attr->children);
+      }
+      h = hash_subtree(h, node->children);
+    } else if (node->content) {
+      h = hash_bytes(h, node->content, xmlStrlen(node->content) + 1);
+    }
+  }
+  return h;
+}
+// }}}
+
+static int symbol_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
+{
+  if (!strEqual(name, "id")) {
+    WARN("expected @id, got @%s", name);
+    return ATTR_UNKNOWN;
+  }
+
+  xmlChar **id = (xmlChar **)user;
+  xmlFree(*id);
+  *id = xmlStrdup(value);
+  return ATTR_SUCCESS;
+}
+// }}}
+
+// keys of the symbols (<use ref>, <instances ref>) and pattern definitions (<set-source pattern>, <mask pattern>)
+// referenced by node and its following siblings; 0 for those not defined (yet)
+static unsigned long long hash_deps(const xmlcairo_surface_t *surface, unsigned long long h, xmlNodePtr node) // {{{
+{
+  for (; node; node = node->next) {
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    const int is_ref = strEqual(node->name, "use") || strEqual(node->name, "instances"),
+              is_pattern = strEqual(node->name, "set-source") || strEqual(node->name, "mask");
+    xmlChar *value = (is_ref || is_pattern) ? xmlGetProp(node, (const xmlChar *)((is_ref) ? "ref" : "pattern")) : NULL;
+    if (value) {
+      unsigned long long key = 0;
+      if (is_ref) {
+        const struct _xmlcairo_symbol_t *symbol = xmlHashLookup(surface->symbols, value);
+        key = (symbol) ? symbol->key : 0;
+      } else {
+        const struct _xmlcairo_pattern_def_t *def = xmlHashLookup(surface->patterns, value);
+        key = (def) ? def->key : 0;
+      }
+      h = hash_bytes(h, &key, sizeof(key));
+      xmlFree(value);
+    }
+    h = hash_deps(surface, h, node->children);
+  }
+  return h;
+}
+// }}}
+
+// content, loaded resources and referenced symbols / pattern definitions (i.e. recursively their content):
+// other symbols and patterns can change without re-recording this one
+static unsigned long long symbol_key(const xmlcairo_surface_t *surface, xmlNodePtr insn) // {{{
+{
+  unsigned long long h = hash_bytes(14695981039346656037ull, &surface->resource_gen, sizeof(surface->resource_gen));
+  h = hash_deps(surface, h, insn->children);
+  return hash_subtree(h, insn->children);
+}
+// }}}
+
+static int record_symbol(xmlcairo_surface_t *surface, const xmlChar *id, xmlNodePtr insn) // {{{
+{
+  const unsigned long long key = symbol_key(surface, insn);
+  struct _xmlcairo_symbol_t *symbol = xmlHashLookup(surface->symbols, id);
+  if (symbol && symbol->key == key) {
+    return ELEM_SUCCESS;  // (e.g. same document rendered again)
+  }
+
+  cairo_surface_t *recording = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, NULL);
+  cairo_t *rcr = cairo_create(recording);
+
+  // (nothing is drawn onto the target here: no damage tracking / culling; final resolution unknown: no simplification)
+  xmlcairo_damage_t *damage = surface->damage;
+  xmlcairo_cull_t *cull = surface->cull;
+  const int simplify = surface->simplify;
+  surface->damage = NULL;
+  surface->cull = NULL;
+  surface->simplify = 0;
+  cairo_status_t status = _xmlcairo_apply_list(surface, rcr, insn->children);
+  surface->damage = damage;
+  surface->cull = cull;
+  surface->simplify = simplify;
+
+  cairo_destroy(rcr);
+  if (status == CAIRO_STATUS_SUCCESS) {
+    status = cairo_surface_status(recording);
+  }
+  if (status != CAIRO_STATUS_SUCCESS) {
+    WARN("could not record <symbol id=\"%s\">: %s", id, cairo_status_to_string(status));
+    cairo_surface_destroy(recording);
+    return ELEM_CAIRO_ERROR;
+  }
+
+  if (!symbol) {
+    symbol = calloc(1, sizeof(struct _xmlcairo_symbol_t));
+    if (!symbol || xmlHashAddEntry(surface->symbols, id, symbol) != 0) {
+      free(symbol);
+      cairo_surface_destroy(recording);
+      return ELEM_CAIRO_ERROR;  // TODO... malloc error
+    }
+    symbol->mem = surface->mem;
+  } else {
+    free_stamps(symbol);
+    cairo_surface_destroy(symbol->recording);
+  }
+  symbol->recording = recording;
+  symbol->key = symbol_key(surface, insn);  // (symbols / pattern definitions inside of the symbol might just have been updated)
+  cairo_surface_set_user_data(recording, &_xmlcairo_damage_serial_key, (void *)(uintptr_t)++surface->symbol_serial, NULL);
+
+  double x, y, width, height;
+  cairo_recording_surface_ink_extents(recording, &x, &y, &width, &height);
+  if (width > 0.0 && height > 0.0) {
+    symbol->ink[0] = x;
+    symbol->ink[1] = y;
+    symbol->ink[2] = x + width;
+    symbol->ink[3] = y + height;
+  } else {
+    symbol->ink[0] = symbol->ink[1] = 0.0;
+    symbol->ink[2] = symbol->ink[3] = -1.0;
+  }
+
+  return ELEM_SUCCESS;
+}
+// }}}
+
+// NULL when too large (or on error); ret_x/_y: device position of the image
+static cairo_surface_t *get_stamp(xmlcairo_surface_t *surface, struct _xmlcairo_symbol_t *symbol, const cairo_matrix_t *ctm, double *ret_x, double *ret_y) // {{{
+{
+  const double ix = floor(ctm->x0), iy = floor(ctm->y0);
+  int bx = (int)((ctm->x0 - ix) * STAMP_SUBPIXEL),
+      by = (int)((ctm->y0 - iy) * STAMP_SUBPIXEL);
+  bx = (bx < STAMP_SUBPIXEL) ? bx : STAMP_SUBPIXEL - 1;  // (rounding)
+  by = (by < STAMP_SUBPIXEL) ? by : STAMP_SUBPIXEL - 1;
+
+  for (int i = 0; i < symbol->num_stamps; i++) {
+    const struct _xmlcairo_stamp_t *stamp = &symbol->stamps[i];
+    if (stamp->bx == bx && stamp->by == by &&
+        stamp->xx == ctm->xx && stamp->yx == ctm->yx && stamp->xy == ctm->xy && stamp->yy == ctm->yy) {
+      *ret_x = ix + stamp->x;
+      *ret_y = iy + stamp->y;
+      return stamp->image;
+    }
+  }
+
+  // render at the center of the bucket (i.e. off by at most 1/(2*STAMP_SUBPIXEL) pixel)
+  cairo_matrix_t mtx = *ctm;
+  mtx.x0 = (bx + 0.5) / STAMP_SUBPIXEL;
+  mtx.y0 = (by + 0.5) / STAMP_SUBPIXEL;
+
+  double x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    double x = symbol->ink[(i & 1) ? 2 : 0],
+           y = symbol->ink[(i & 2) ? 3 : 1];
+    cairo_matrix_transform_point(&mtx, &x, &y);
+    x0 = fmin(x0, x);
+    y0 = fmin(y0, y);
+    x1 = fmax(x1, x);
+    y1 = fmax(y1, y);
+  }
+  x0 = floor(x0) - 1.0;
+  y0 = floor(y0) - 1.0;
+  const double width = ceil(x1) + 1.0 - x0,
+               height = ceil(y1) + 1.0 - y0;
+  if (!(width * height <= STAMP_MAX_PIXELS)) {  // (also: NAN)
+    return NULL;
+  }
+  const unsigned long long bytes = (unsigned long long)cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, (int)width) * (int)height;
+  if (!_xmlcairo_mem_try_charge(symbol->mem, XMLCAIRO_MEMORY_IMAGES, bytes)) {
+    return NULL;  // (over budget: replay the recording instead)
+  }
+
+  cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, (int)width, (int)height);
+  cairo_t *scr = cairo_create(image);
+  cairo_translate(scr, -x0, -y0);
+  cairo_transform(scr, &mtx);
+  cairo_set_source_surface(scr, symbol->recording, 0.0, 0.0);
+  cairo_paint(scr);
+  const cairo_status_t status = cairo_status(scr);
+  cairo_destroy(scr);
+  if (status != CAIRO_STATUS_SUCCESS) {
+    _xmlcairo_mem_release(symbol->mem, XMLCAIRO_MEMORY_IMAGES, bytes);
+    cairo_surface_destroy(image);
+    return NULL;
+  }
+  cairo_surface_set_user_data(image, &_xmlcairo_damage_serial_key, (void *)(uintptr_t)++surface->symbol_serial, NULL);
+
+  struct _xmlcairo_stamp_t *stamp;
+  if (symbol->num_stamps < STAMP_MAX_PER_SYMBOL) {
+    stamp = &symbol->stamps[symbol->num_stamps++];
+  } else {
+    stamp = &symbol->stamps[symbol->next_evict];
+    symbol->next_evict = (symbol->next_evict + 1) % STAMP_MAX_PER_SYMBOL;
+    _xmlcairo_mem_release(symbol->mem, XMLCAIRO_MEMORY_IMAGES, stamp_bytes(stamp->image));
+    cairo_surface_destroy(stamp->image);
+  }
+  *stamp = (struct _xmlcairo_stamp_t){
+    .xx = ctm->xx, .yx = ctm->yx, .xy = ctm->xy, .yy = ctm->yy,
+    .bx = bx, .by = by,
+    .image = image,
+    .x = x0, .y = y0
+  };
+
+  *ret_x = ix + x0;
+  *ret_y = iy + y0;
+  return image;
+}
+// }}}
+
+struct _use_attrs_t {
+  xmlcairo_surface_t *surface;
+  struct _xmlcairo_symbol_t *symbol;
+  cairo_matrix_t transform;
+  int raster;
+};
+
+static int use_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
+{
+  struct _use_attrs_t *attrs = (struct _use_attrs_t *)user;
+
+  if (strEqual(name, "ref")) {
+    attrs->symbol = xmlHashLookup(attrs->surface->symbols, value);
+    if (!attrs->symbol) {
+      WARN("symbol \"%s\" not found", value);
+      return ATTR_NOT_FOUND;
+    }
+
+  } else if (strEqual(name, "transform")) {
+    const int res = parse_svg_cairo_transform(&attrs->transform, (const char *)value);
+    if (res >= 0) {
+      WARN("could not parse <use transform=...%s\"", value + res);
+      return ATTR_PARSE;
+    }
+
+  } else if (strEqual(name, "cache")) {
+    if (strEqual(value, "raster")) {
+      attrs->raster = 1;
+    } else if (strEqual(value, "none")) {
+      attrs->raster = 0;
+    } else {
+      WARN("could not parse <use cache=\"%s\">", value);
+      return ATTR_PARSE;
+    }
+
+  } else {
+    WARN("attribute <use %s=...> not known", name);
+    return ATTR_UNKNOWN;
+  }
+
+  return ATTR_SUCCESS;
+}
+// }}}
+
+// pixel-aligned device rect (x, y, width, height) covering ink under ctm (plus a pixel for antialiasing)
+static void ink_device_rect(const cairo_matrix_t *ctm, const double ink[4], double ret[4]) // {{{
+{
+  double x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    double x = ink[(i & 1) ? 2 : 0],
+           y = ink[(i & 2) ? 3 : 1];
+    cairo_matrix_transform_point(ctm, &x, &y);
+    x0 = fmin(x0, x);
+    y0 = fmin(y0, y);
+    x1 = fmax(x1, x);
+    y1 = fmax(y1, y);
+  }
+  ret[0] = floor(x0) - 1.0;
+  ret[1] = floor(y0) - 1.0;
+  ret[2] = ceil(x1) - ret[0] + 1.0;
+  ret[3] = ceil(y1) - ret[1] + 1.0;
+}
+// }}}
+
+// raster: only for image surfaces, otherwise ignored
+static void use_symbol(xmlcairo_surface_t *surface, cairo_t *cr, struct _xmlcairo_symbol_t *symbol, const cairo_matrix_t *transform, int raster) // {{{
+{
+  if (symbol->ink[0] > symbol->ink[2]) {
+    return;  // (draws nothing)
+  }
+
+  // (cairo_clip() below would consume the current path, which is not part of the gstate)
+  cairo_path_t *path = (cairo_has_current_point(cr)) ? cairo_copy_path(cr) : NULL;
+  cairo_new_path(cr);
+
+  cairo_save(cr);
+  const unsigned long long dsaved = (surface->damage) ? _xmlcairo_damage_save(surface->damage) : 0;
+  cairo_transform(cr, transform);
+
+  if (!surface->cull || !_xmlcairo_cull_outside(cr, symbol->ink, 0.0)) {
+    // clip to the pixel-aligned device extents: bounds compositing (and the damage region)
+    cairo_matrix_t ctm;
+    cairo_get_matrix(cr, &ctm);
+    double rect[4];
+    ink_device_rect(&ctm, symbol->ink, rect);
+    cairo_identity_matrix(cr);
+    cairo_rectangle(cr, rect[0], rect[1], rect[2], rect[3]);
+    if (surface->damage) {
+      _xmlcairo_damage_clip(surface->damage, cr);
+    }
+    cairo_clip(cr);
+
+    double sx, sy;
+    cairo_surface_t *stamp = (raster && cairo_surface_get_type(cairo_get_target(cr)) == CAIRO_SURFACE_TYPE_IMAGE)
+      ? get_stamp(surface, symbol, &ctm, &sx, &sy) : NULL;
+    if (stamp) {
+      cairo_set_source_surface(cr, stamp, sx, sy);  // (device space, pixel-aligned)
+    } else {
+      cairo_set_matrix(cr, &ctm);
+      cairo_set_source_surface(cr, symbol->recording, 0.0, 0.0);
+    }
+    if (!surface->damage || !_xmlcairo_damage_paint(surface->damage, cr, NAN, NULL, NULL, 0.0, 0.0)) {
+      cairo_paint(cr);
+    }
+  }
+
+  cairo_restore(cr);
+  if (surface->damage) {
+    _xmlcairo_damage_restore(surface->damage, dsaved);
+  }
+
+  if (path) {
+    cairo_append_path(cr, path);
+    cairo_path_destroy(path);
+  }
+}
+// }}}
+
+// --- <instances ref="symbol" | d="..." [op="fill|stroke"] [fields="x y ..."]>x y ... x y ...</instances>
+// one element (and one cairo_save / _restore) for many copies: no per-copy <sub transform>, DOM node, or path parsing
+
+enum instance_field_e {
+  INST_X, INST_Y, INST_S, INST_SX, INST_SY, INST_ANGLE,  // (translate, rotate [degrees], scale)
+  INST_R, INST_G, INST_B, INST_A,
+  INST_NUM_FIELDS
+};
+
+static const char *const instance_fields[] = {"x", "y", "s", "sx", "sy", "angle", "r", "g", "b", "a"};
+
+struct _instances_attrs_t {
+  xmlcairo_surface_t *surface;
+  cairo_t *cr;
+  struct _xmlcairo_symbol_t *symbol;  // either symbol or path
+  cairo_path_t *path;
+  double bounds[4];  // of path
+  int stroke;
+  enum instance_field_e fields[INST_NUM_FIELDS];
+  int num_fields;
+};
+
+// returns -1 on error
+static int parse_instance_fields(const xmlChar *str, enum instance_field_e *ret) // {{{
+{
+  int num = 0, seen = 0;
+  const char *cur = (const char *)str;
+  while (*(cur += strspn(cur, " \t\r\n"))) {
+    const size_t len = strcspn(cur, " \t\r\n");
+    int i = 0;
+    while (i < INST_NUM_FIELDS && (strlen(instance_fields[i]) != len || strncmp(cur, instance_fields[i], len) != 0)) {
+      i++;
+    }
+    if (i == INST_NUM_FIELDS || (seen & (1 << i))) {
+      return -1;  // (unknown or duplicate)
+    }
+    seen |= 1 << i;
+    ret[num++] = i;
+    cur += len;
+  }
+  const int rgb = seen & ((1 << INST_R) | (1 << INST_G) | (1 << INST_B));
+  if ((rgb && rgb != ((1 << INST_R) | (1 << INST_G) | (1 << INST_B))) || (!rgb && (seen & (1 << INST_A)))) {
+    return -1;  // (color needs r, g and b)
+  }
+  if ((seen & (1 << INST_S)) && (seen & ((1 << INST_SX) | (1 << INST_SY)))) {
+    return -1;
+  }
+  return num;
+}
+// }}}
+
+static int instances_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
+{
+  struct _instances_attrs_t *attrs = (struct _instances_attrs_t *)user;
+
+  if (strEqual(name, "ref")) {
+    attrs->symbol = xmlHashLookup(attrs->surface->symbols, value);
+    if (!attrs->symbol) {
+      WARN("symbol \"%s\" not found", value);
+      return ATTR_NOT_FOUND;
+    }
+
+  } else if (strEqual(name, "d")) {
+    // parsed once, in untransformed coordinates
+    cairo_t *cr = attrs->cr;
+    cairo_matrix_t saved;
+    cairo_get_matrix(cr, &saved);
+    cairo_identity_matrix(cr);
+    const int res = apply_svg_cairo_path(cr, (const char *)value);
+    if (res < 0) {
+      cairo_path_destroy(attrs->path);  // (accepts NULL)
+      attrs->path = cairo_copy_path(cr);
+      cairo_path_extents(cr, &attrs->bounds[0], &attrs->bounds[1], &attrs->bounds[2], &attrs->bounds[3]);
+    }
+    cairo_new_path(cr);
+    cairo_set_matrix(cr, &saved);
+    if (res >= 0) {
+      WARN("could not parse <instances d=...%s\"", value + res);
+      return ATTR_PARSE;
+    }
+
+  } else if (strEqual(name, "op")) {
+    if (strEqual(value, "fill")) {
+      attrs->stroke = 0;
+    } else if (strEqual(value, "stroke")) {
+      attrs->stroke = 1;
+    } else {
+      WARN("could not parse <instances op=\"%s\">", value);
+      return ATTR_PARSE;
+    }
+
+  } else if (strEqual(name, "fields")) {
+    attrs->num_fields = parse_instance_fields(value, attrs->fields);
+    if (attrs->num_fields <= 0) {
+      WARN("could not parse <instances fields=\"%s\">", value);
+      return ATTR_PARSE;
+    }
+
+  } else {
+    WARN("attribute <instances %s=...> not known", name);
+    return ATTR_UNKNOWN;
+  }
+
+  return ATTR_SUCCESS;
+}
+// }}}
+
+static void draw_instance(xmlcairo_surface_t *surface, cairo_t *cr, const struct _instances_attrs_t *attrs, // {{{
+                          const cairo_matrix_t *base, const cairo_matrix_t *mtx, const double *rgba)
+{
+  cairo_set_matrix(cr, mtx);
+
+  if (attrs->path) {
+    if (rgba) {
+      cairo_set_source_rgba(cr, rgba[0], rgba[1], rgba[2], rgba[3]);
+    }
+    cairo_append_path(cr, attrs->path);
+    if (attrs->stroke) {
+      cairo_set_matrix(cr, base);  // (line width etc. are not scaled)
+      if (!surface->damage || !_xmlcairo_damage_stroke(surface->damage, cr)) {
+        cairo_stroke(cr);
+      } else {
+        cairo_new_path(cr);
+      }
+    } else if (!surface->damage || !_xmlcairo_damage_fill(surface->damage, cr)) {
+      cairo_fill(cr);
+    } else {
+      cairo_new_path(cr);
+    }
+    return;
+  }
+
+  // symbol: fill of the pixel-aligned ink rect, i.e. bounded without clipping
+  // (unbounded operators would clear everything outside of it: clip and paint instead, like <use>)
+  const struct _xmlcairo_symbol_t *symbol = attrs->symbol;
+  double rect[4];
+  ink_device_rect(mtx, symbol->ink, rect);
+  if (!rgba && _xmlcairo_cull_bounded_op(cr)) {
+    cairo_set_source_surface(cr, symbol->recording, 0.0, 0.0);
+    cairo_identity_matrix(cr);
+    cairo_rectangle(cr, rect[0], rect[1], rect[2], rect[3]);
+    if (!surface->damage || !_xmlcairo_damage_fill(surface->damage, cr)) {
+      cairo_fill(cr);
+    } else {
+      cairo_new_path(cr);
+    }
+    return;
+  }
+
+  // colored: symbol as mask (alpha only)
+  cairo_save(cr);
+  const unsigned long long dsaved = (surface->damage) ? _xmlcairo_damage_save(surface->damage) : 0;
+  cairo_identity_matrix(cr);
+  cairo_rectangle(cr, rect[0], rect[1], rect[2], rect[3]);
+  if (surface->damage) {
+    _xmlcairo_damage_clip(surface->damage, cr);
+  }
+  cairo_clip(cr);
+  cairo_set_matrix(cr, mtx);
+  if (!rgba) {
+    cairo_set_source_surface(cr, symbol->recording, 0.0, 0.0);
+    if (!surface->damage || !_xmlcairo_damage_paint(surface->damage, cr, NAN, NULL, NULL, 0.0, 0.0)) {
+      cairo_paint(cr);
+    }
+  } else {
+    cairo_set_source_rgba(cr, rgba[0], rgba[1], rgba[2], rgba[3]);
+    if (!surface->damage || !_xmlcairo_damage_paint(surface->damage, cr, NAN, NULL, symbol->recording, 0.0, 0.0)) {
+      cairo_mask_surface(cr, symbol->recording, 0.0, 0.0);
+    }
+  }
+  cairo_restore(cr);
+  if (surface->damage) {
+    _xmlcairo_damage_restore(surface->damage, dsaved);
+  }
+}
+// }}}
+
+static int instances_content(const xmlChar *value, void *user) // {{{
+{
+  if (!value) {
+    return ELEM_CAIRO_ERROR;  // TODO... malloc error ?
+  }
+
+  const struct _instances_attrs_t *attrs = (const struct _instances_attrs_t *)user;
+  xmlcairo_surface_t *surface = attrs->surface;
+  cairo_t *cr = attrs->cr;
+
+  const double *bounds = (attrs->path) ? attrs->bounds : attrs->symbol->ink;
+  if (bounds[0] > bounds[2] && !attrs->stroke) {
+    return ELEM_SUCCESS;  // (draws nothing)
+  }
+  // (stroke: margin would depend on the instance transform)
+  const int cull = surface->cull && !attrs->stroke && _xmlcairo_cull_bounded_op(cr);
+
+  cairo_matrix_t base;
+  cairo_get_matrix(cr, &base);
+
+  const char *cur = (const char *)value;
+  float v[INST_NUM_FIELDS];
+  int res;
+  for (int first = 1; (res = parse_svg_number_record(&cur, v, attrs->num_fields, first)) > 0; first = 0) {
+    double f[INST_NUM_FIELDS] = {
+      [INST_X] = 0.0, [INST_Y] = 0.0, [INST_S] = NAN, [INST_SX] = 1.0, [INST_SY] = 1.0, [INST_ANGLE] = 0.0,
+      [INST_R] = NAN, [INST_G] = NAN, [INST_B] = NAN, [INST_A] = 1.0
+    };
+    for (int i = 0; i < attrs->num_fields; i++) {
+      f[attrs->fields[i]] = v[i];
+    }
+    if (!isnan(f[INST_S])) {
+      f[INST_SX] = f[INST_SY] = f[INST_S];
+    }
+
+    const double c = cos(f[INST_ANGLE] * M_PI / 180.0), s = sin(f[INST_ANGLE] * M_PI / 180.0);
+    cairo_matrix_t mtx, inst = {
+      .xx = c * f[INST_SX], .yx = s * f[INST_SX],
+      .xy = -s * f[INST_SY], .yy = c * f[INST_SY],
+      .x0 = f[INST_X], .y0 = f[INST_Y]
+    };
+    if (f[INST_SX] == 0.0 || f[INST_SY] == 0.0 || !isfinite(inst.xx + inst.yx + inst.xy + inst.yy + inst.x0 + inst.y0)) {
+      continue;  // (degenerate: nothing visible, but would put cr into an error state)
+    }
+    cairo_matrix_multiply(&mtx, &inst, &base);
+
+    if (cull) {
+      cairo_set_matrix(cr, &mtx);
+      if (_xmlcairo_cull_outside(cr, bounds, 0.0)) {
+        continue;
+      }
+    }
+    draw_instance(surface, cr, attrs, &base, &mtx, !isnan(f[INST_R]) ? &f[INST_R] : NULL);
+  }
+  if (res < 0) {
+    WARN("could not parse <instances>...%s", cur);
+    return ELEM_BADATTR;
+  }
+  return ELEM_SUCCESS;
+}
+// }}}
+
+static int apply_instances(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insn) // {{{
+{
+  // (fills would consume the current path, which is not part of the gstate)
+  cairo_path_t *saved_path = (cairo_has_current_point(cr)) ? cairo_copy_path(cr) : NULL;
+  cairo_new_path(cr);
+
+  struct _instances_attrs_t attrs = {
+    .surface = surface,
+    .cr = cr,
+    .symbol = NULL,
+    .path = NULL,
+    .stroke = 0,
+    .fields = {INST_X, INST_Y},
+    .num_fields = 2
+  };
+  int res = ELEM_BADATTR;
+  if (for_each_attr(surface->stats, insn, instances_attrs, &attrs)) {
+    // res = ELEM_BADATTR;
+  } else if (!attrs.symbol == !attrs.path) {
+    WARN("either <instances ref=\"...\"> or <instances d=\"...\"> is required");
+  } else if (attrs.symbol && attrs.stroke) {
+    WARN("<instances ref=\"...\" op=\"stroke\"> is not supported");
+  } else {
+    cairo_save(cr);  // (source, matrix)
+    const unsigned long long dsaved = (surface->damage) ? _xmlcairo_damage_save(surface->damage) : 0;
+    res = for_content(insn, instances_content, &attrs);
+    cairo_restore(cr);
+    if (surface->damage) {
+      _xmlcairo_damage_restore(surface->damage, dsaved);
+    }
+  }
+  cairo_path_destroy(attrs.path);  // (accepts NULL)
+
+  if (saved_path) {
+    cairo_new_path(cr);
+    cairo_append_path(cr, saved_path);
+    cairo_path_destroy(saved_path);
+  }
+  return res;
+}
+// }}}
+
+enum pattern_kind_e {
+  PATTERN_LINEAR,
+  PATTERN_RADIAL,
+  PATTERN_SURFACE
+};
+
+static const char *const pattern_elems[] = {"linear-gradient", "radial-gradient", "surface-pattern"};
+static const char *const pattern_coords[][7] = {
+  {"x0", "y0", "x1", "y1", NULL},
+  {"cx0", "cy0", "r0", "cx1", "cy1", "r1", NULL},
+  {"x", "y", "width", "height", NULL}  // (cf. <set-source image>)
+};
+
+struct _pattern_def_attrs_t {
+  xmlcairo_surface_t *surface;
+  enum pattern_kind_e kind;
+  xmlChar *id;
+  double coords[6];
+  cairo_extend_t extend;
+  cairo_filter_t filter;
+  cairo_matrix_t transform;  // pattern space -> user space
+  cairo_surface_t *image;
+  enum gravity_e gravity;
+};
+
+// @id [@extend] [@filter] [@transform]  AND  @x0 @y0 @x1 @y1  OR  @cx0 @cy0 @r0 @cx1 @cy1 @r1  OR  @image [@x] [@y] [@width] [@height] [@gravity]
+static int pattern_def_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
+{
+  struct _pattern_def_attrs_t *attrs = (struct _pattern_def_attrs_t *)user;
+  const char *elem = pattern_elems[attrs->kind];
+
+  if (strEqual(name, "id")) {
+    xmlFree(attrs->id);
+    attrs->id = xmlStrdup(value);
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "extend")) {
+    attrs->extend = parse_extend(value);
+    if (attrs->extend == (cairo_extend_t)-1) {
+      WARN("could not parse <%s %s=\"%s\">", elem, name, value);
+      return ATTR_PARSE;
+    }
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "filter")) {
+    attrs->filter = parse_filter(value);
+    if (attrs->filter == (cairo_filter_t)-1) {
+      WARN("could not parse <%s %s=\"%s\">", elem, name, value);
+      return ATTR_PARSE;
+    }
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "transform")) {
+    const int res = parse_svg_cairo_transform(&attrs->transform, (const char *)value);
+    if (res >= 0) {
+      WARN("could not parse <%s transform=...%s\"", elem, value + res);
+      return ATTR_PARSE;
+    }
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "image") && attrs->kind == PATTERN_SURFACE) {
+    attrs->image = xmlHashLookup(attrs->surface->imgs, value);
+    if (!attrs->image) {
+      WARN("image \"%s\" not found", value);
+      return ATTR_NOT_FOUND;
+    }
+    return ATTR_SUCCESS;
+
+  } else if (strEqual(name, "gravity") && attrs->kind == PATTERN_SURFACE) {
+    attrs->gravity = parse_gravity(value);
+    if (attrs->gravity == (enum gravity_e)-1) {
+      WARN("could not parse <%s %s=\"%s\">", elem, name, value);
+      return ATTR_PARSE;
+    }
+    return ATTR_SUCCESS;
+  }
+
+  for (int i = 0; pattern_coords[attrs->kind][i]; i++) {
+    if (strEqual(name, pattern_coords[attrs->kind][i])) {
+      attrs->coords[i] = parse_double(value);
+      if (isnan(attrs->coords[i])) {
+        WARN("could not parse <%s %s=\"%s\">", elem, name, value);
+        return ATTR_PARSE;
+      }
+      return ATTR_SUCCESS;
+    }
+  }
+
+  WARN("attribute <%s %s=...> not known", elem, name);
+  return ATTR_UNKNOWN;
+}
+// }}}
+
+// @offset @r @g @b [@a]
+static int stop_attrs(const xmlChar *name, const xmlChar *value, void *user) // {{{
+{
+  double *stop = (double *)user;  // offset, r, g, b, a
+
+  const char *pos = (name[0] && !name[1]) ? strchr("rgba", name[0]) : NULL;
+  const int idx = (strEqual(name, "offset")) ? 0 : (pos) ? 1 + (pos - "rgba") : -1;
+  if (idx < 0) {
+    WARN("attribute <stop %s=...> not known", name);
+    return ATTR_UNKNOWN;
+  }
+
+  stop[idx] = parse_double(value);
+  if (isnan(stop[idx])) {
+    WARN("could not parse <stop %s=\"%s\">", name, value);
+    return ATTR_PARSE;
+  }
+  return ATTR_SUCCESS;
+}
+// }}}
+
+static int add_color_stops(xmlcairo_surface_t *surface, cairo_pattern_t *pattern, xmlNodePtr node) // {{{
+{
+  for (; node; node = node->next) {
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;  // (whitespace, comments)
+    } else if (!strEqual(node->name, "stop")) {
+      WARN("expected <stop>, got <%s>", node->name);
+      return ELEM_UNKNOWN;
+    }
+
+    double stop[5] = {NAN, NAN, NAN, NAN, 1.0};
+    if (for_each_attr(surface->stats, node, stop_attrs, stop)) {
+      return ELEM_BADATTR;
+    } else if (isnan(stop[0]) || isnan(stop[1]) || isnan(stop[2]) || isnan(stop[3])) {
+      WARN("<stop offset=\"...\" r=\"...\" g=\"...\" b=\"...\"/> are required");
+      return ELEM_BADATTR;
+    }
+    cairo_pattern_add_color_stop_rgba(pattern, stop[0], stop[1], stop[2], stop[3], stop[4]);
+  }
+  return ELEM_SUCCESS;
+}
+// }}}
+
+// returns NULL (after warning) on error
+static cairo_pattern_t *create_pattern(xmlcairo_surface_t *surface, xmlNodePtr insn, const struct _pattern_def_attrs_t *attrs) // {{{
+{
+  const double *c = attrs->coords;
+  cairo_matrix_t matrix = attrs->transform;
+  if (cairo_matrix_invert(&matrix) != CAIRO_STATUS_SUCCESS) {
+    WARN("<%s transform=\"...\"> is not invertible", pattern_elems[attrs->kind]);
+    return NULL;
+  }
+
+  cairo_pattern_t *pattern;
+  switch (attrs->kind) {
+  case PATTERN_LINEAR:
+  case PATTERN_RADIAL:
+    for (int i = 0; pattern_coords[attrs->kind][i]; i++) {
+      if (isnan(c[i])) {
+        WARN("<%s %s=\"...\"> is required", pattern_elems[attrs->kind], pattern_coords[attrs->kind][i]);
+        return NULL;
+      }
+    }
+    pattern = (attrs->kind == PATTERN_LINEAR)
+      ? cairo_pattern_create_linear(c[0], c[1], c[2], c[3])
+      : cairo_pattern_create_radial(c[0], c[1], c[2], c[3], c[4], c[5]);
+    if (add_color_stops(surface, pattern, insn->children) != ELEM_SUCCESS) {
+      cairo_pattern_destroy(pattern);
+      return NULL;
+    }
+    break;
+
+  case PATTERN_SURFACE: {
+    if (!attrs->image) {
+      WARN("<surface-pattern image=\"...\"> is required");
+      return NULL;
+    } else if (xmlChildElementCount(insn) > 0) {
+      WARN("<surface-pattern> expects no child elements");
+      return NULL;
+    }
+    struct _set_source_mask_attrs_t ssm = {
+      .image = attrs->image,
+      .x = c[0], .y = c[1], .width = c[2], .height = c[3],
+      .gravity = attrs->gravity
+    };
+    pattern = get_ssm_image_pattern(&ssm);
+    cairo_matrix_t fit;
+    cairo_pattern_get_matrix(pattern, &fit);
+    cairo_matrix_multiply(&matrix, &matrix, &fit);  // user -> pattern space -> image
+    break;
+  }
+
+  default:
+    assert(0);
+    return NULL;
+  }
+
+  cairo_pattern_set_matrix(pattern, &matrix);
+  cairo_pattern_set_extend(pattern, attrs->extend);
+  cairo_pattern_set_filter(pattern, attrs->filter);
+
+  const cairo_status_t status = cairo_pattern_status(pattern);
+  if (status != CAIRO_STATUS_SUCCESS) {
+    WARN("could not create <%s id=\"%s\">: %s", pattern_elems[attrs->kind], attrs->id, cairo_status_to_string(status));
+    cairo_pattern_destroy(pattern);
+    return NULL;
+  }
+  return pattern;
+}
+// }}}
+
+static int define_pattern(xmlcairo_surface_t *surface, xmlNodePtr insn, enum pattern_kind_e kind) // {{{
+{
+  struct _pattern_def_attrs_t attrs = {
+    .surface = surface,
+    .kind = kind,
+    .id = NULL,
+    .coords = {NAN, NAN, NAN, NAN, NAN, NAN},
+    .extend = (kind == PATTERN_SURFACE) ? CAIRO_EXTEND_NONE : CAIRO_EXTEND_PAD,  // (cairo defaults)
+    .filter = CAIRO_FILTER_GOOD,
+    .image = NULL,
+    .gravity = GRAVITY_CENTER
+  };
+  if (kind == PATTERN_SURFACE) {
+    attrs.coords[0] = attrs.coords[1] = 0.0;
+  }
+  cairo_matrix_init_identity(&attrs.transform);
+  if (for_each_attr(surface->stats, insn, pattern_def_attrs, &attrs)) {
+    xmlFree(attrs.id);
+    return ELEM_BADATTR;
+  } else if (!attrs.id) {
+    WARN("<%s id=\"...\"> is required", pattern_elems[kind]);
+    return ELEM_BADATTR;
+  }
+
+  // (thousands of <fill>s then share one pattern: color stops are set up once, not per use)
+  unsigned long long key = hash_bytes(14695981039346656037ull, &surface->resource_gen, sizeof(surface->resource_gen));
+  key = hash_bytes(key, insn->name, xmlStrlen(insn->name) + 1);
+  for (xmlAttrPtr attr = insn->properties; attr; attr = attr->next) {
+    key = hash_bytes(key, attr->name, xmlStrlen(attr->name) + 1);
+    key = hash_subtree(key, attr->children);
+  }
+  key = hash_subtree(key, insn->children);
+
+  struct _xmlcairo_pattern_def_t *def = xmlHashLookup(surface->patterns, attrs.id);
+  if (def && def->key == key) {
+    xmlFree(attrs.id);
+    return ELEM_SUCCESS;  // (e.g. same document rendered again)
+  }
+
+  cairo_pattern_t *pattern = create_pattern(surface, insn, &attrs);
+  if (!pattern) {
+    xmlFree(attrs.id);
+    return ELEM_BADATTR;
+  }
+
+  if (!def) {
+    def = calloc(1, sizeof(struct _xmlcairo_pattern_def_t));
+    if (!def || xmlHashAddEntry(surface->patterns, attrs.id, def) != 0) {
+      free(def);
+      cairo_pattern_destroy(pattern);
+      xmlFree(attrs.id);
+      return ELEM_CAIRO_ERROR;  // TODO... malloc error
+    }
+  } else {
+    cairo_pattern_destroy(def->pattern);
+  }
+  def->pattern = pattern;
+  def->key = key;
+
+  xmlFree(attrs.id);
+  return ELEM_SUCCESS;
+}
+// }}}
+
+// the current (empty) path might stand for a culled <path>, which <fill> / <stroke> needs after all
+static void uncull_path(xmlcairo_surface_t *surface, cairo_t *cr, int stroke) // {{{
+{
+  cairo_matrix_t ctm, saved;
+  struct _path_attrs_t attrs = {
+    .surface = surface,
+    .cull = NULL,
+    .simplify = surface->simplify,
+    .cr = cr,
+    .node = _xmlcairo_cull_need_path(surface->cull, cr, stroke, &ctm),
+    .count = NAN
+  };
+  if (!attrs.node) {
+    return;
+  }
+  cairo_get_matrix(cr, &saved);
+  cairo_set_matrix(cr, &ctm);
+  for_each_attr(NULL, attrs.node, apply_path_attrs, &attrs);
+  cairo_set_matrix(cr, &saved);
+}
+// }}}
+
+static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insn)
+{
+  if (!insn || insn->type != XML_ELEMENT_NODE) {
+    return ELEM_NOT_ELEMENT;
+  }
+  if (!insn->name || !*insn->name) {
+    WARN("empty element name");
+    return ELEM_UNKNOWN; // unknown element
+  }
+
+#define CASE(c0, c1) case (((const xmlChar)(c0) << 8) + (const xmlChar)(c1))
+#define EQ(full) strEqual(insn->name, full)   // +2, +2  (but probably not more efficient)
+  switch ((insn->name[0] << 8) | insn->name[1]) {
+  CASE('c', 'i'):
+    if (EQ("circle")) {
+      return apply_shape(surface, cr, insn, SHAPE_CIRCLE);
+    } else if (EQ("circles")) {
+      return apply_shape(surface, cr, insn, SHAPE_CIRCLES);
+    }
+    break;
+
+  CASE('c', 'l'):
+    if (EQ("clip")) {
       int preserve = 0;
-      if (for_each_attr(insn, preserve_attrs, &preserve)) {
+      if (for_each_attr(surface->stats, insn, preserve_attrs, &preserve)) {
         return ELEM_BADATTR;
       }
+      if (surface->cull) {
+        uncull_path(surface, cr, 0);  // (the clip might have changed since the <path>)
+      }
+      if (surface->damage) {
+        _xmlcairo_damage_clip(surface->damage, cr);
+      }
       if (preserve) {
+        cairo_clip_preserve(cr);
+      } else {
+        cairo_clip(cr);  // (still culled path: clips everything, too)
+        if (surface->cull) {
+          _xmlcairo_cull_set_culled_path(surface->cull, cr, NULL, NULL, 0.0);
+        }
+      }
+      return ELEM_SUCCESS;
+    }
+    break;
+
+  CASE('c', 'o'):
+    if (EQ("copy-page")) {
+      if (for_each_attr(surface->stats, insn, no_attrs, NULL)) {
+        return ELEM_BADATTR;
+      }
+      cairo_copy_page(cr);
+      return ELEM_SUCCESS;
+    }
+    break;
+
+  CASE('d', 'a'):
+    if (EQ("dash")) {
+      double offset = 0.0;
+      if (for_each_attr(surface->stats, insn, offset_attrs, &offset)) {
+        return ELEM_BADATTR;
+      }
+      struct cairo_svg_dasharray_s da = {
+        .max_dashes = (surface->mem) ? surface->mem->limits.max_dashes : 0
+      };
+      const int res = for_content(insn, dash_content, &da);
+      if (res == ELEM_SUCCESS) {
+        cairo_set_dash(cr, da.dashes, da.num_dashes, offset);
+        free_dasharray(&da);
+      } else if (da.max_dashes && da.num_dashes > da.max_dashes) {
+        _xmlcairo_mem_fail(surface->mem, CAIRO_STATUS_INVALID_DASH);
+      }
+      return res;
+    }
+    break;
+
+  CASE('e', 'l'):
+    if (EQ("ellipse")) {
+      return apply_shape(surface, cr, insn, SHAPE_ELLIPSE);
+    }
+    break;
+
+  CASE('f', 'i'):
+    if (EQ("fill")) {
+      int preserve = 0;
+      if (for_each_attr(surface->stats, insn, preserve_attrs, &preserve)) {
+        return ELEM_BADATTR;
+      }
+      if (surface->cull) {
+        uncull_path(surface, cr, 0);
+        if (!preserve) {
+          _xmlcairo_cull_set_culled_path(surface->cull, cr, NULL, NULL, 0.0);
+        }
+      }
+      if (surface->damage && _xmlcairo_damage_fill(surface->damage, cr)) {
+        if (!preserve) {
+          cairo_new_path(cr);
+        }
+      } else if (preserve) {
         cairo_fill_preserve(cr);
       } else {
         cairo_fill(cr);
@@ -866,6 +2520,41 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
     }
     break;
 
+  CASE('i', 'n'):
+    if (EQ("instances")) {
+      return apply_instances(surface, cr, insn);
+    }
+    break;
+
+  CASE('l', 'a'):
+    if (EQ("labels")) {
+      struct _text_attrs_t attrs = {
+        .surface = surface,
+        .font = NULL,
+        .size = NAN
+      };
+      int res = ELEM_BADATTR;
+      if (for_each_attr(surface->stats, insn, labels_attrs, &attrs)) {
+        // res = ELEM_BADATTR;
+      } else if (!attrs.font || isnan(attrs.size)) {
+        WARN("<labels font=\"...\" size=\"...\"/> are required");
+      } else {
+        attrs.cr = cr;
+        res = for_content(insn, labels_content, &attrs);
+      }
+      xmlFree(attrs.script);  // (accepts NULL)
+      xmlFree(attrs.lang);
+      xmlFree(attrs.features);
+      return res;
+    }
+    break;
+
+  CASE('l', 'i'):
+    if (EQ("linear-gradient")) {
+      return define_pattern(surface, insn, PATTERN_LINEAR);
+    }
+    break;
+
   CASE('m', 'a'):
     if (EQ("mask")) {
       struct _set_source_mask_attrs_t attrs = {
@@ -874,7 +2563,7 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
         .x = 0.0, .y = 0.0, .width = NAN, .height = NAN,
         .gravity = GRAVITY_CENTER
       };
-      const int res = for_each_attr(insn, set_source_mask_attrs, &attrs);
+      const int res = for_each_attr(surface->stats, insn, set_source_mask_attrs, &attrs);
       if (res) {
         return ELEM_BADATTR;
       }
@@ -884,18 +2573,25 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
         return ELEM_BADATTR;
       }
       switch (attrs.type) {
-/* FIXME
       case SSTYPE_PATTERN:
-        cairo_set_source(cr, attrs.pattern);
+        if (!surface->damage || !_xmlcairo_damage_paint(surface->damage, cr, NAN, attrs.pattern, NULL, 0.0, 0.0)) {
+          cairo_mask(cr, attrs.pattern);
+        }
         break;
-*/
+
       case SSTYPE_IMAGE:
         if (!isnan(attrs.width) || !isnan(attrs.height)) {
           cairo_pattern_t *pattern = get_ssm_image_pattern(&attrs);
-          cairo_mask(cr, pattern);
+          if (!surface->damage || !_xmlcairo_damage_paint(surface->damage, cr, NAN, pattern, NULL, 0.0, 0.0)) {
+            cairo_mask(cr, pattern);
+          }
           cairo_pattern_destroy(pattern);
         } else {
-          cairo_mask_surface(cr, attrs.image, (!isnan(attrs.x) ? attrs.x : 0.0), (!isnan(attrs.y) ? attrs.y : 0.0));
+          const double x = !isnan(attrs.x) ? attrs.x : 0.0,
+                       y = !isnan(attrs.y) ? attrs.y : 0.0;
+          if (!surface->damage || !_xmlcairo_damage_paint(surface->damage, cr, NAN, NULL, attrs.image, x, y)) {
+            cairo_mask_surface(cr, attrs.image, x, y);
+          }
         }
         break;
 
@@ -909,10 +2605,12 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
   CASE('p', 'a'):
     if (EQ("paint")) {
       double alpha = NAN;
-      if (for_each_attr(insn, alpha_attrs, &alpha)) {
+      if (for_each_attr(surface->stats, insn, alpha_attrs, &alpha)) {
         return ELEM_BADATTR;
       }
-      if (!isnan(alpha)) {
+      if (surface->damage && _xmlcairo_damage_paint(surface->damage, cr, alpha, NULL, NULL, 0.0, 0.0)) {
+        // (not drawn)
+      } else if (!isnan(alpha)) {
         cairo_paint_with_alpha(cr, alpha);
       } else {
         cairo_paint(cr);
@@ -920,26 +2618,56 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
       return ELEM_SUCCESS;
     } else if (EQ("path")) {
       // TODO? ensure xmlHasProp(insn, "d"); ?  (but: default = '')
-      if (for_each_attr(insn, apply_path_attrs, cr)) {
+      struct _path_attrs_t attrs = {
+        .surface = surface,
+        .cull = surface->cull,
+        .simplify = surface->simplify,
+        .cr = cr,
+        .node = insn,
+        .format = BINPATH_F32XY,
+        .offset = 0.0, .count = NAN, .ops_offset = 0.0
+      };
+      if (for_each_attr(surface->stats, insn, apply_path_attrs, &attrs)) {
         return ELEM_BADATTR;
+      } else if (attrs.binary) {
+        return apply_binary_path(&attrs);
       }
       return ELEM_SUCCESS;
     }
     break;
 
+  CASE('p', 'o'):
+    if (EQ("polygon")) {
+      return apply_shape(surface, cr, insn, SHAPE_POLYGON);
+    }
+    break;
+
+  CASE('r', 'a'):
+    if (EQ("radial-gradient")) {
+      return define_pattern(surface, insn, PATTERN_RADIAL);
+    }
+    break;
+
   CASE('r', 'e'):
-    if (EQ("reset-clip")) {
-      if (for_each_attr(insn, no_attrs, NULL)) {
+    if (EQ("rect")) {
+      return apply_shape(surface, cr, insn, SHAPE_RECT);
+    } else if (EQ("rects")) {
+      return apply_shape(surface, cr, insn, SHAPE_RECTS);
+    } else if (EQ("reset-clip")) {
+      if (for_each_attr(surface->stats, insn, no_attrs, NULL)) {
         return ELEM_BADATTR;
       }
       cairo_reset_clip(cr);
+      if (surface->damage) {
+        _xmlcairo_damage_reset_clip(surface->damage, cr);
+      }
       return ELEM_SUCCESS;
     }
     break;
 
   CASE('s', 'e'):
     if (EQ("set")) {
-      const int res = for_each_attr(insn, apply_set_attrs, cr);
+      const int res = for_each_attr(surface->stats, insn, apply_set_attrs, cr);
       if (res) {
         return ELEM_BADATTR;
       }
@@ -953,7 +2681,7 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
         .x = 0.0, .y = 0.0, .width = NAN, .height = NAN,
         .gravity = GRAVITY_CENTER
       };
-      const int res = for_each_attr(insn, set_source_mask_attrs, &attrs);
+      const int res = for_each_attr(surface->stats, insn, set_source_mask_attrs, &attrs);
       if (res) {
         return ELEM_BADATTR;
       }
@@ -962,11 +2690,10 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
         return ELEM_BADATTR;
       }
       switch (attrs.type) {
-/* FIXME
       case SSTYPE_PATTERN:
         cairo_set_source(cr, attrs.pattern);
         break;
-*/
+
       case SSTYPE_IMAGE:
         if (!isnan(attrs.width) || !isnan(attrs.height)) {
           cairo_pattern_t *pattern = get_ssm_image_pattern(&attrs);
@@ -994,7 +2721,7 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
 
   CASE('s', 'h'):
     if (EQ("show-page")) {
-      if (for_each_attr(insn, no_attrs, NULL)) {
+      if (for_each_attr(surface->stats, insn, no_attrs, NULL)) {
         return ELEM_BADATTR;
       }
       cairo_show_page(cr);
@@ -1005,10 +2732,20 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
   CASE('s', 't'):
     if (EQ("stroke")) {
       int preserve = 0;
-      if (for_each_attr(insn, preserve_attrs, &preserve)) {
+      if (for_each_attr(surface->stats, insn, preserve_attrs, &preserve)) {
         return ELEM_BADATTR;
       }
-      if (preserve) {
+      if (surface->cull) {
+        uncull_path(surface, cr, 1);
+        if (!preserve) {
+          _xmlcairo_cull_set_culled_path(surface->cull, cr, NULL, NULL, 0.0);
+        }
+      }
+      if (surface->damage && _xmlcairo_damage_stroke(surface->damage, cr)) {
+        if (!preserve) {
+          cairo_new_path(cr);
+        }
+      } else if (preserve) {
         cairo_stroke_preserve(cr);
       } else {
         cairo_stroke(cr);
@@ -1020,16 +2757,40 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
   CASE('s', 'u'):
     if (EQ("sub")) {
       cairo_save(cr);
-      if (for_each_attr(insn, apply_transform_attrs, cr)) {
+      const unsigned long long dsaved = (surface->damage) ? _xmlcairo_damage_save(surface->damage) : 0;
+      if (for_each_attr(surface->stats, insn, apply_transform_attrs, cr)) {
         cairo_restore(cr);
         return ELEM_BADATTR;
       }
-      const cairo_status_t s = _xmlcairo_apply_list(surface, cr, insn->children);
+      const cairo_status_t s = (surface->cull && _xmlcairo_cull_sub(surface->cull, cr, insn))
+        ? CAIRO_STATUS_SUCCESS
+        : _xmlcairo_apply_list(surface, cr, insn->children);
       cairo_restore(cr);
+      if (surface->damage) {
+        _xmlcairo_damage_restore(surface->damage, dsaved);
+      }
       if (s != CAIRO_STATUS_SUCCESS) {
         return ELEM_CAIRO_ERROR; // caller will itself check cairo_status() ...
       }
       return ELEM_SUCCESS;
+    } else if (EQ("surface-pattern")) {
+      return define_pattern(surface, insn, PATTERN_SURFACE);
+    }
+    break;
+
+  CASE('s', 'y'):
+    if (EQ("symbol")) {
+      xmlChar *id = NULL;
+      if (for_each_attr(surface->stats, insn, symbol_attrs, &id)) {
+        xmlFree(id);
+        return ELEM_BADATTR;
+      } else if (!id) {
+        WARN("<symbol id=\"...\"> is required");
+        return ELEM_BADATTR;
+      }
+      const int res = record_symbol(surface, id, insn);
+      xmlFree(id);
+      return res;
     }
     break;
 
@@ -1042,16 +2803,39 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
         .x = 0, .y = 0,
         .max_width = NAN
       };
-      if (for_each_attr(insn, text_attrs, &attrs)) {
-        return ELEM_BADATTR;
-      }
-      if (!attrs.font || isnan(attrs.size)) {
+      int res = ELEM_BADATTR;
+      if (for_each_attr(surface->stats, insn, text_attrs, &attrs)) {
+        // res = ELEM_BADATTR;
+      } else if (!attrs.font || isnan(attrs.size)) {
         WARN("<text font=\"...\" size=\"...\"/> are required");
-        return ELEM_BADATTR;
+      } else {
+        attrs.cr = cr;
+        attrs.cull_key = (surface->cull) ? _xmlcairo_cull_text_key(insn) : 0;
+        res = for_content(insn, text_content, &attrs);
       }
+      xmlFree(attrs.script);  // (accepts NULL)
+      xmlFree(attrs.lang);
+      xmlFree(attrs.features);
+      return res;
+    }
+    break;
 
-      attrs.cr = cr;
-      return for_content(insn, text_content, &attrs);
+  CASE('u', 's'):
+    if (EQ("use")) {
+      struct _use_attrs_t attrs = {
+        .surface = surface,
+        .symbol = NULL,
+        .raster = 0
+      };
+      cairo_matrix_init_identity(&attrs.transform);
+      if (for_each_attr(surface->stats, insn, use_attrs, &attrs)) {
+        return ELEM_BADATTR;
+      } else if (!attrs.symbol) {
+        WARN("<use ref=\"...\"/> is required");
+        return ELEM_BADATTR;
+      }
+      use_symbol(surface, cr, attrs.symbol, &attrs.transform, attrs.raster);
+      return ELEM_SUCCESS;
     }
     break;
 
@@ -1065,38 +2849,104 @@ static int _xmlcairo_apply_one(xmlcairo_surface_t *surface, cairo_t *cr, xmlNode
   return ELEM_UNKNOWN; // unknown element
 }
 
+// after each element: cairo's error, or the first limit hit (cf. xmlcairo_limits_t)
+static inline cairo_status_t apply_status(const xmlcairo_surface_t *surface, cairo_t *cr) // {{{
+{
+  const cairo_status_t ret = cairo_status(cr);
+  return (ret == CAIRO_STATUS_SUCCESS) ? _xmlcairo_mem_status(surface->mem) : ret;
+}
+// }}}
+
+// instructions being applied (siblings: insns and all following); only walked with a budget or stats.
+// returns 0 when over budget, otherwise *ret_bytes must be released afterwards
+static int charge_dom(xmlcairo_surface_t *surface, xmlNodePtr insns, int siblings, unsigned long long *ret_bytes) // {{{
+{
+  *ret_bytes = (surface->mem && (surface->mem->limits.max_memory || surface->stats))
+    ? _xmlcairo_mem_dom_size(insns, siblings) : 0;
+  return _xmlcairo_mem_charge(surface->mem, XMLCAIRO_MEMORY_DOM, *ret_bytes);
+}
+// }}}
+
+static int _xmlcairo_apply_one_timed(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insn) // {{{
+{
+  if (!insn || insn->type != XML_ELEMENT_NODE) {
+    return _xmlcairo_apply_one(surface, cr, insn);
+  } else if (!surface->stats && !surface->trace) {
+    XMLCAIRO_PROBE1(element__start, insn->name);
+    const int ret = _xmlcairo_apply_one(surface, cr, insn);
+    XMLCAIRO_PROBE2(element__done, insn->name, ret);
+    return ret;
+  }
+
+  // NOTE: vector surfaces (pdf, ps, ...) defer most of the drawing work until show-page / encode
+  const unsigned long long start = _xmlcairo_stats_now();
+  XMLCAIRO_PROBE1(element__start, insn->name);
+  const int ret = _xmlcairo_apply_one(surface, cr, insn);
+  XMLCAIRO_PROBE2(element__done, insn->name, ret);
+  if (surface->stats) {
+    _xmlcairo_stats_add(surface->stats, XMLCAIRO_STATS_ELEMENT, (const char *)insn->name, _xmlcairo_stats_now() - start);
+    _xmlcairo_stats_memory(surface->stats, surface->mem);
+  }
+  if (surface->trace) {
+    _xmlcairo_trace_complete(surface->trace, "element", (const char *)insn->name, start, NULL);
+  }
+  return ret;
+}
+// }}}
+
 static cairo_status_t _xmlcairo_apply_list(xmlcairo_surface_t *surface, cairo_t *cr, xmlNodePtr insns) // {{{
 {
-  cairo_status_t ret = cairo_status(cr);
+  cairo_status_t ret = apply_status(surface, cr);
   for (; insns && ret == CAIRO_STATUS_SUCCESS; insns = insns->next) {
     if (insns->type != XML_ELEMENT_NODE) {
       // TODO? error for (/allow) XML_TEXT_NODE, _CDATA_SECTION_NODE, ...?
       continue;
     }
-    _xmlcairo_apply_one(surface, cr, insns);  // TODO? check error?
-    ret = cairo_status(cr);
+    _xmlcairo_apply_one_timed(surface, cr, insns);  // TODO? check error?
+    ret = apply_status(surface, cr);
   }
   return ret;
 }
 // }}}
 
+// before running on a new cairo_t
+static void _xmlcairo_cull_begin(xmlcairo_surface_t *surface) // {{{
+{
+  if (!surface->cull) {
+    return;
+  }
+  if (surface->cull_resource_gen != surface->resource_gen) {
+    _xmlcairo_cull_clear(surface->cull);  // (font key might now map to another font)
+    surface->cull_resource_gen = surface->resource_gen;
+  }
+  _xmlcairo_cull_set_culled_path(surface->cull, NULL, NULL, NULL, 0.0);
+}
+// }}}
 
 cairo_status_t xmlcairo_apply(xmlcairo_surface_t *surface, xmlNodePtr insn) // {{{
 {
   if (!surface) {
     return CAIRO_STATUS_NULL_POINTER;
   }
+  _xmlcairo_mem_begin(surface->mem);
+
+  unsigned long long dom;
+  if (!charge_dom(surface, insn, 0, &dom)) {
+    return CAIRO_STATUS_NO_MEMORY;
+  }
 
   cairo_t *cr = cairo_create(surface->surface);
   // assert(cr);
+  _xmlcairo_cull_begin(surface);
 
-  cairo_status_t ret = cairo_status(cr);
+  cairo_status_t ret = apply_status(surface, cr);
   if (ret == CAIRO_STATUS_SUCCESS) {
-    _xmlcairo_apply_one(surface, cr, insn);  // TODO? check error?
-    ret = cairo_status(cr);
+    _xmlcairo_apply_one_timed(surface, cr, insn);  // TODO? check error?
+    ret = apply_status(surface, cr);
   }
 
   cairo_destroy(cr);
+  _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_DOM, dom);
   return ret;
 }
 // }}}
@@ -1106,14 +2956,561 @@ cairo_status_t xmlcairo_apply_list(xmlcairo_surface_t *surface, xmlNodePtr insns
   if (!surface) {
     return CAIRO_STATUS_NULL_POINTER;
   }
+  _xmlcairo_mem_begin(surface->mem);
+
+  unsigned long long dom;
+  if (!charge_dom(surface, insns, 1, &dom)) {
+    return CAIRO_STATUS_NO_MEMORY;
+  }
 
   cairo_t *cr = cairo_create(surface->surface);
   // assert(cr);
+  _xmlcairo_cull_begin(surface);
 
   const cairo_status_t ret = _xmlcairo_apply_list(surface, cr, insns);
 
   cairo_destroy(cr);
+  _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_DOM, dom);
+  return ret;
+}
+// }}}
+
+// every child of the root is expanded, applied and freed by the reader before the next one is parsed
+cairo_status_t xmlcairo_apply_stream(xmlcairo_surface_t *surface, const char *filename) // {{{
+{
+  if (!surface || !filename) {
+    return CAIRO_STATUS_NULL_POINTER;
+  }
+  _xmlcairo_mem_begin(surface->mem);
+
+  xmlTextReaderPtr reader = xmlReaderForFile(filename, NULL, 0);
+  if (!reader) {
+    return CAIRO_STATUS_READ_ERROR;
+  }
+
+  cairo_t *cr = cairo_create(surface->surface);
+  // assert(cr);
+  _xmlcairo_cull_begin(surface);
+
+  cairo_status_t ret = apply_status(surface, cr);
+  int res;
+  while ((res = xmlTextReaderRead(reader)) == 1 && xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+    // (doctype, comments, ... before the root)
+  }
+  if (res == 1 && !xmlTextReaderIsEmptyElement(reader)) {
+    res = xmlTextReaderRead(reader);  // (first child of the root)
+    while (res == 1 && ret == CAIRO_STATUS_SUCCESS && xmlTextReaderDepth(reader) > 0) {
+      if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+        res = xmlTextReaderNext(reader);
+        continue;
+      }
+      xmlNodePtr insn = xmlTextReaderExpand(reader);
+      unsigned long long dom;
+      if (!insn) {
+        res = -1;
+        break;
+      } else if (!charge_dom(surface, insn, 0, &dom)) {  // (only the current element is in memory)
+        ret = CAIRO_STATUS_NO_MEMORY;
+        break;
+      }
+      _xmlcairo_apply_one_timed(surface, cr, insn);  // TODO? check error?
+      ret = apply_status(surface, cr);
+      _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_DOM, dom);
+
+      if (surface->cull && !_xmlcairo_cull_detach_culled_path(surface->cull)) {
+        ret = CAIRO_STATUS_NO_MEMORY;
+      } else if (surface->obuf && xmlStrEqual(insn->name, (const xmlChar *)"show-page")) {
+        xmlOutputBufferFlush(surface->obuf);  // (page is complete)
+      }
+      res = xmlTextReaderNext(reader);  // (frees insn)
+    }
+  }
+  if (res < 0 && ret == CAIRO_STATUS_SUCCESS) {
+    ret = CAIRO_STATUS_READ_ERROR;  // (libxml2 already reported the parse error)
+  }
+
+  cairo_destroy(cr);
+  xmlFreeTextReader(reader);
+  return ret;
+}
+// }}}
+
+// --- xmlcairo_apply_list_parallel()
+// workers render chunks of consecutive pages into recording surfaces; the calling thread replays them in order
+// onto the real surface, so cairo still shares font subsets and images across the whole document.
+
+struct _parallel_page_t {
+  xmlNodePtr first, end;  // top-level [first, end); end: its <show-page/>, NULL for a last page without one
+  int num_states;         // state nodes before first
+
+  cairo_surface_t *recording;
+  cairo_status_t status;
+  int done;
+};
+
+struct _parallel_t {
+  xmlcairo_surface_t *surface;
+  struct _parallel_page_t *pages;
+  int num_pages;
+  xmlNodePtr *states;  // cf. collect_states()
+  int num_states, size_states;
+  int chunk, window;  // (pages)
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;  // page done / replayed / abort
+  int next_page, replayed, abort;
+};
+
+static int is_definition(const xmlChar *name) // {{{ surface-global, independent of the drawing state
+{
+  return strEqual(name, "symbol") || strEqual(name, "linear-gradient") || strEqual(name, "radial-gradient") ||
+         strEqual(name, "surface-pattern");
+}
+// }}}
+
+static int replaces_path(const xmlChar *name) // {{{
+{
+  if (strEqual(name, "path")) {
+    return 1;
+  }
+  for (size_t i = 0; i < sizeof(shape_elems) / sizeof(*shape_elems); i++) {
+    if (strEqual(name, shape_elems[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+// }}}
+
+// one element besides a top-level <show-page/>; open_path: current path (also through <sub>, which does not
+// save it); returns 0 when the element would break a page inside a worker's recording: <copy-page/>, or
+// <show-page/> within <sub>
+static int scan_page_elem(xmlNodePtr node, int *open_path) // {{{
+{
+  const xmlChar *name = node->name;
+  if (strEqual(name, "copy-page")) {
+    return 0;
+  } else if (strEqual(name, "sub")) {
+    for (xmlNodePtr child = node->children; child; child = child->next) {
+      if (child->type != XML_ELEMENT_NODE) {
+        continue;
+      } else if (strEqual(child->name, "show-page") || !scan_page_elem(child, open_path)) {
+        return 0;
+      }
+    }
+  } else if (replaces_path(name)) {
+    *open_path = 1;
+  } else if (strEqual(name, "fill") || strEqual(name, "stroke")) {
+    *open_path = (xmlHasProp(node, (const xmlChar *)"preserve") != NULL);
+  }
+  return 1;
+}
+// }}}
+
+// splits at top-level <show-page/>; returns -1 when a page could see more of the previous pages than
+// collect_states() replays: a top-level <clip>, or a current path left open across <show-page/>,
+// or when a page break would not be top-level: any <copy-page/>, or <show-page/> inside <sub>
+static int count_pages(xmlNodePtr insns) // {{{
+{
+  int num = 0, open_path = 0, empty = 1;
+  for (xmlNodePtr node = insns; node; node = node->next) {
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    const xmlChar *name = node->name;
+    empty = 0;
+    if (strEqual(name, "clip")) {
+      return -1;
+    } else if (strEqual(name, "show-page")) {
+      if (open_path) {
+        return -1;
+      }
+      num++;
+      empty = 1;
+    } else if (!scan_page_elem(node, &open_path)) {
+      return -1;
+    }
+  }
+  return num + !empty;
+}
+// }}}
+
+// state later pages depend on: top-level <set>, <set-source>, <dash>, <reset-clip>, and definitions (also nested);
+// returns 0 on malloc error
+static int collect_states(struct _parallel_t *par, xmlNodePtr node, int top) // {{{
+{
+  for (; node; node = node->next) {
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    const xmlChar *name = node->name;
+    if (strEqual(name, "sub")) {
+      if (!collect_states(par, node->children, 0)) {
+        return 0;
+      }
+      continue;
+    } else if (!is_definition(name) &&
+               (!top || (!strEqual(name, "set") && !strEqual(name, "set-source") && !strEqual(name, "dash") && !strEqual(name, "reset-clip")))) {
+      continue;
+    }
+
+    if (par->num_states >= par->size_states) {
+      const int size = par->size_states ? 2 * par->size_states : 64;
+      xmlNodePtr *tmp = realloc(par->states, size * sizeof(xmlNodePtr));
+      if (!tmp) {
+        return 0;
+      }
+      par->states = tmp;
+      par->size_states = size;
+    }
+    par->states[par->num_states++] = node;
+  }
+  return 1;
+}
+// }}}
+
+static int split_pages(struct _parallel_t *par, xmlNodePtr insns) // {{{ returns 0 on malloc error
+{
+  struct _parallel_page_t *page = par->pages;
+  for (xmlNodePtr node = insns; node; node = node->next) {
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    if (!page->first) {
+      page->first = node;
+      page->num_states = par->num_states;
+    }
+    if (strEqual(node->name, "show-page")) {
+      page->end = node;
+      page++;
+    } else if (!collect_states(par, node, 1)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+// }}}
+
+// what collect_states() would have set up: <set>, <set-source>, <dash> (definitions are per surface)
+static cairo_status_t copy_page_state(cairo_t *dst, cairo_t *src) // {{{
+{
+  cairo_set_source(dst, cairo_get_source(src));
+  cairo_set_antialias(dst, cairo_get_antialias(src));
+  cairo_set_fill_rule(dst, cairo_get_fill_rule(src));
+  cairo_set_line_cap(dst, cairo_get_line_cap(src));
+  cairo_set_line_join(dst, cairo_get_line_join(src));
+  cairo_set_line_width(dst, cairo_get_line_width(src));
+  cairo_set_miter_limit(dst, cairo_get_miter_limit(src));
+  cairo_set_operator(dst, cairo_get_operator(src));
+  cairo_set_tolerance(dst, cairo_get_tolerance(src));
+
+  const int num_dashes = cairo_get_dash_count(src);
+  if (num_dashes > 0) {
+    double *dashes = malloc(num_dashes * sizeof(double)), offset;
+    if (!dashes) {
+      return CAIRO_STATUS_NO_MEMORY;
+    }
+    cairo_get_dash(src, dashes, &offset);
+    cairo_set_dash(dst, dashes, num_dashes, offset);
+    free(dashes);
+  }
+  return cairo_status(dst);
+}
+// }}}
+
+// (worker->surface: target of cr)
+static cairo_status_t apply_nodes(xmlcairo_surface_t *worker, cairo_t *cr, xmlNodePtr *nodes, int num) // {{{
+{
+  cairo_status_t ret = cairo_status(cr);
+  for (int i = 0; i < num && ret == CAIRO_STATUS_SUCCESS; i++) {
+    _xmlcairo_apply_one_timed(worker, cr, nodes[i]);  // TODO? check error?
+    ret = apply_status(worker, cr);
+  }
+  return ret;
+}
+// }}}
+
+static cairo_status_t render_page(xmlcairo_surface_t *worker, cairo_t *cr, const struct _parallel_page_t *page) // {{{
+{
+  cairo_status_t ret = cairo_status(cr);
+  for (xmlNodePtr node = page->first; node != page->end && ret == CAIRO_STATUS_SUCCESS; node = node->next) {
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    _xmlcairo_apply_one_timed(worker, cr, node);  // TODO? check error?
+    ret = apply_status(worker, cr);
+  }
+  return ret;
+}
+// }}}
+
+static void *parallel_worker(void *user) // {{{
+{
+  struct _parallel_t *par = (struct _parallel_t *)user;
+  xmlcairo_surface_t *worker = _xmlcairo_surface_create_worker(par->surface);
+  const cairo_content_t content = cairo_surface_get_content(par->surface->surface);
+
+  pthread_mutex_lock(&par->lock);
+  while (!par->abort && par->next_page < par->num_pages) {
+    if (par->next_page >= par->replayed + par->window) {
+      pthread_cond_wait(&par->cond, &par->lock);  // (bounds the finished, not yet replayed recordings)
+      continue;
+    }
+    const int start = par->next_page,
+              end = (start + par->chunk < par->num_pages) ? start + par->chunk : par->num_pages;
+    par->next_page = end;
+    pthread_mutex_unlock(&par->lock);
+
+    // first page of the chunk: replay the state of all previous pages; later ones: copy it from the page before
+    cairo_surface_t *recording = cairo_recording_surface_create(content, NULL);
+    cairo_t *cr = cairo_create(recording);
+    cairo_status_t ret = CAIRO_STATUS_NO_MEMORY;
+    if (worker) {
+      worker->surface = recording;
+      _xmlcairo_cull_begin(worker);
+      ret = apply_nodes(worker, cr, par->states, par->pages[start].num_states);
+    }
+    for (int i = start; i < end; i++) {
+      if (ret == CAIRO_STATUS_SUCCESS) {
+        ret = render_page(worker, cr, &par->pages[i]);
+      }
+
+      cairo_surface_t *next_recording = NULL;
+      cairo_t *next_cr = NULL;
+      cairo_status_t next_ret = CAIRO_STATUS_SUCCESS;
+      if (ret == CAIRO_STATUS_SUCCESS && i + 1 < end) {
+        next_recording = cairo_recording_surface_create(content, NULL);
+        next_cr = cairo_create(next_recording);
+        next_ret = copy_page_state(next_cr, cr);
+        worker->surface = next_recording;
+        _xmlcairo_cull_begin(worker);
+      }
+      cairo_destroy(cr);  // (recording is complete)
+
+      pthread_mutex_lock(&par->lock);
+      par->pages[i].recording = recording;
+      par->pages[i].status = ret;
+      par->pages[i].done = 1;
+      pthread_cond_broadcast(&par->cond);
+      pthread_mutex_unlock(&par->lock);
+
+      if (!next_cr) {
+        break;  // (end of chunk, or error: the caller aborts when it gets there)
+      }
+      recording = next_recording;
+      cr = next_cr;
+      ret = next_ret;
+    }
+
+    pthread_mutex_lock(&par->lock);
+  }
+  pthread_mutex_unlock(&par->lock);
+
+  if (worker) {
+    _xmlcairo_surface_free(worker);
+  }
+  return NULL;
+}
+// }}}
+
+static cairo_status_t apply_parallel(xmlcairo_surface_t *surface, xmlNodePtr insns, int num_pages, int num_threads) // {{{
+{
+  struct _parallel_t par = {
+    .surface = surface,
+    .num_pages = num_pages,
+    .chunk = (num_pages / (8 * num_threads) > 0) ? num_pages / (8 * num_threads) : 1
+  };
+  par.window = 2 * num_threads * par.chunk;
+
+  par.pages = calloc(num_pages, sizeof(struct _parallel_page_t));
+  pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+  if (!par.pages || !threads || !split_pages(&par, insns)) {
+    free(par.pages);
+    free(par.states);
+    free(threads);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  if (pthread_mutex_init(&par.lock, NULL) != 0) {
+    free(par.pages);
+    free(par.states);
+    free(threads);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  if (pthread_cond_init(&par.cond, NULL) != 0) {
+    pthread_mutex_destroy(&par.lock);
+    free(par.pages);
+    free(par.states);
+    free(threads);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+
+  int num_started = 0;
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[num_started], NULL, parallel_worker, &par) == 0) {
+      num_started++;
+    }
+  }
+
+  cairo_t *cr = cairo_create(surface->surface);
+  cairo_status_t ret = (num_started > 0) ? cairo_status(cr) : CAIRO_STATUS_NO_MEMORY;  // (TODO? sequential fallback)
+  for (int i = 0; i < num_pages && ret == CAIRO_STATUS_SUCCESS; i++) {
+    struct _parallel_page_t *page = &par.pages[i];
+    pthread_mutex_lock(&par.lock);
+    while (!page->done) {
+      pthread_cond_wait(&par.cond, &par.lock);
+    }
+    pthread_mutex_unlock(&par.lock);
+
+    ret = page->status;
+    if (ret == CAIRO_STATUS_SUCCESS) {
+      cairo_set_source_surface(cr, page->recording, 0.0, 0.0);
+      cairo_paint(cr);
+      if (page->end) {
+        _xmlcairo_apply_one_timed(surface, cr, page->end);  // <show-page/>
+      }
+      ret = apply_status(surface, cr);
+    }
+    cairo_surface_destroy(page->recording);
+    page->recording = NULL;
+
+    pthread_mutex_lock(&par.lock);
+    par.replayed = i + 1;
+    par.abort = (ret != CAIRO_STATUS_SUCCESS);
+    pthread_cond_broadcast(&par.cond);
+    pthread_mutex_unlock(&par.lock);
+  }
+
+  for (int i = 0; i < num_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  for (int i = 0; i < num_pages; i++) {
+    if (par.pages[i].recording) {
+      cairo_surface_destroy(par.pages[i].recording);  // (after abort)
+    }
+  }
+
+  // definitions stay with the surface, as with xmlcairo_apply_list()
+  for (int i = 0; i < par.num_states && ret == CAIRO_STATUS_SUCCESS; i++) {
+    if (is_definition(par.states[i]->name)) {
+      _xmlcairo_apply_one_timed(surface, cr, par.states[i]);
+      ret = apply_status(surface, cr);
+    }
+  }
+
+  cairo_destroy(cr);
+  pthread_cond_destroy(&par.cond);
+  pthread_mutex_destroy(&par.lock);
+  free(par.pages);
+  free(par.states);
+  free(threads);
+  return ret;
+}
+// }}}
+
+cairo_status_t xmlcairo_apply_list_parallel(xmlcairo_surface_t *surface, xmlNodePtr insns, int num_threads) // {{{
+{
+  if (!surface) {
+    return CAIRO_STATUS_NULL_POINTER;
+  }
+  _xmlcairo_mem_begin(surface->mem);
+
+  // (only paginated surfaces: elsewhere, painting a page's recording over the previous pages would
+  // composite differently than the page's own operators / blend modes did in serial mode)
+  const cairo_surface_type_t type = cairo_surface_get_type(surface->surface);
+  const int num_pages = count_pages(insns);
+  if (num_threads < 2 || num_pages < 2 ||
+      (type != CAIRO_SURFACE_TYPE_PDF && type != CAIRO_SURFACE_TYPE_PS) ||
+      xmlHashSize(surface->symbols) > 0 || xmlHashSize(surface->patterns) > 0) {  // (workers could not see those)
+    return xmlcairo_apply_list(surface, insns);
+  }
+  if (num_threads > num_pages) {
+    num_threads = num_pages;
+  }
+
+  unsigned long long dom;
+  if (!charge_dom(surface, insns, 1, &dom)) {
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  const cairo_status_t ret = apply_parallel(surface, insns, num_pages, num_threads);
+  _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_DOM, dom);
+  return ret;
+}
+// }}}
+
+static cairo_status_t apply_incremental(xmlcairo_surface_t *surface, xmlNodePtr insns, int ret_rect[4]) // {{{
+{
+  if (!surface->damage) {
+    surface->damage = _xmlcairo_damage_create();
+    if (!surface->damage) {
+      return CAIRO_STATUS_NO_MEMORY;
+    }
+  } else if (surface->damage_resource_gen != surface->resource_gen) {
+    _xmlcairo_damage_invalidate(surface->damage);  // (e.g. image replaced under the same key)
+  }
+  surface->damage_resource_gen = surface->resource_gen;
+
+  int rect[4];
+  if (!ret_rect) {
+    ret_rect = rect;
+  }
+
+  // 1. record drawing ops (extents + fingerprints), without drawing
+  cairo_t *cr = cairo_create(surface->surface);
+  _xmlcairo_damage_set_mode(surface->damage, DAMAGE_RECORD);
+  _xmlcairo_cull_begin(surface);
+  cairo_status_t ret = _xmlcairo_apply_list(surface, cr, insns);
+  cairo_destroy(cr);
+  if (ret != CAIRO_STATUS_SUCCESS) {
+    _xmlcairo_damage_set_mode(surface->damage, DAMAGE_OFF);
+    _xmlcairo_damage_invalidate(surface->damage);  // (surface content unknown)
+    return ret;
+  }
+
+  // 2. diff against previous call
+  const int width = cairo_image_surface_get_width(surface->surface),
+            height = cairo_image_surface_get_height(surface->surface);
+  if (!_xmlcairo_damage_compute(surface->damage, width, height, ret_rect)) {
+    _xmlcairo_damage_set_mode(surface->damage, DAMAGE_OFF);
+    return CAIRO_STATUS_SUCCESS;
+  }
+
+  // 3. clear and redraw damaged region, skipping ops outside of it
+  cr = cairo_create(surface->surface);
+  cairo_rectangle(cr, ret_rect[0], ret_rect[1], ret_rect[2], ret_rect[3]);
+  cairo_clip(cr);
+  cairo_save(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_restore(cr);
+
+  _xmlcairo_damage_set_mode(surface->damage, DAMAGE_CULL);
+  _xmlcairo_cull_begin(surface);
+  ret = _xmlcairo_apply_list(surface, cr, insns);
+  _xmlcairo_damage_set_mode(surface->damage, DAMAGE_OFF);
+  cairo_destroy(cr);
+  if (ret != CAIRO_STATUS_SUCCESS) {
+    _xmlcairo_damage_invalidate(surface->damage);
+  }
+
   return ret;
 }
 // }}}
 
+cairo_status_t xmlcairo_apply_list_incremental(xmlcairo_surface_t *surface, xmlNodePtr insns, int ret_rect[4]) // {{{
+{
+  if (!surface) {
+    return CAIRO_STATUS_NULL_POINTER;
+  } else if (cairo_surface_get_type(surface->surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+    return CAIRO_STATUS_SURFACE_TYPE_MISMATCH;
+  }
+  _xmlcairo_mem_begin(surface->mem);
+
+  unsigned long long dom;
+  if (!charge_dom(surface, insns, 1, &dom)) {
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  const cairo_status_t ret = apply_incremental(surface, insns, ret_rect);
+  _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_DOM, dom);
+  return ret;
+}
+// }}}
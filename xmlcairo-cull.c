@@ -0,0 +1,547 @@
+#include "xmlcairo-cull.h"
+#include "xmlcairo-mem.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "parse-svg.h"
+#include "parse-svg-cairo.h"
+
+#if __has_attribute(unused)
+#define UNUSED __attribute__((unused))
+#else
+#define UNUSED
+#endif
+
+// Bounds are cached by a hash of the path data / the <text> element (not by node pointer, which
+// is reused after xmlFreeDoc), so e.g. tiles of the same document share them.
+
+struct _xmlcairo_cull_entry {
+  unsigned long long key;  // 0: unused
+  double x0, y0, x1, y1;
+};
+
+struct _xmlcairo_cull_t {
+  struct _xmlcairo_cull_entry *entries;
+  unsigned int size, num;  // size: power of two
+
+  // current (empty) path stands for culled_path (cf. _xmlcairo_cull_need_path)
+  xmlNodePtr culled_path;
+  cairo_matrix_t culled_ctm;
+  double culled_bounds[4], culled_margin;  // (re-tested against the clip at use, which might have changed)
+
+  xmlNodePtr detached_path;  // (owned) copy, cf. _xmlcairo_cull_detach_culled_path
+
+  struct _xmlcairo_mem_t *mem;  // (entries are charged as XMLCAIRO_MEMORY_PATHS)
+};
+
+#define CULL_MAX_ENTRIES (1 << 16)  // (at most 128k slots of 40 bytes; more distinct paths: start over)
+
+xmlcairo_cull_t *_xmlcairo_cull_create(struct _xmlcairo_mem_t *mem) // {{{
+{
+  xmlcairo_cull_t *ret = calloc(1, sizeof(xmlcairo_cull_t));
+  if (ret) {
+    ret->mem = mem;
+  }
+  return ret;
+}
+// }}}
+
+void _xmlcairo_cull_destroy(xmlcairo_cull_t *cull) // {{{
+{
+  if (!cull) {
+    return;
+  }
+  _xmlcairo_mem_release(cull->mem, XMLCAIRO_MEMORY_PATHS, cull->size * sizeof(*cull->entries));
+  free(cull->entries);
+  xmlFreeNode(cull->detached_path);  // (accepts NULL)
+  free(cull);
+}
+// }}}
+
+void _xmlcairo_cull_clear(xmlcairo_cull_t *cull) // {{{
+{
+  if (cull->entries) {
+    memset(cull->entries, 0, cull->size * sizeof(*cull->entries));
+  }
+  cull->num = 0;
+  cull->culled_path = NULL;
+}
+// }}}
+
+// --- hash table
+
+static inline unsigned long long hash_bytes(unsigned long long h, const void *data, size_t len) // {{{ FNV-1a
+{
+  const unsigned char *cur = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= cur[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+// }}}
+
+static inline unsigned long long finish_key(unsigned long long h) // {{{
+{
+  return (h) ? h : 1;  // (0 marks unused entries)
+}
+// }}}
+
+static struct _xmlcairo_cull_entry *find_entry(const xmlcairo_cull_t *cull, unsigned long long key) // {{{ or NULL
+{
+  if (!cull->size) {
+    return NULL;
+  }
+  const unsigned int mask = cull->size - 1;
+  for (unsigned int i = (unsigned int)(key ^ (key >> 32)) & mask; ; i = (i + 1) & mask) {
+    struct _xmlcairo_cull_entry *entry = &cull->entries[i];
+    if (entry->key == key) {
+      return entry;
+    } else if (!entry->key) {
+      return NULL;
+    }
+  }
+}
+// }}}
+
+static void insert_entry(xmlcairo_cull_t *cull, unsigned long long key, const double bounds[4]) // {{{
+{
+  if (cull->num >= CULL_MAX_ENTRIES) {
+    _xmlcairo_cull_clear(cull);  // (just start over)
+  }
+  if (2 * (cull->num + 1) > cull->size) {
+    const unsigned int size = (cull->size) ? 2 * cull->size : 256;
+    if (!_xmlcairo_mem_try_charge(cull->mem, XMLCAIRO_MEMORY_PATHS, size * sizeof(struct _xmlcairo_cull_entry))) {
+      return;  // (over budget: just not cached)
+    }
+    struct _xmlcairo_cull_entry *entries = calloc(size, sizeof(*entries));
+    if (!entries) {
+      _xmlcairo_mem_release(cull->mem, XMLCAIRO_MEMORY_PATHS, size * sizeof(*entries));
+      return;  // (just not cached)
+    }
+    for (unsigned int i = 0; i < cull->size; i++) {
+      if (!cull->entries[i].key) {
+        continue;
+      }
+      unsigned int j = (unsigned int)(cull->entries[i].key ^ (cull->entries[i].key >> 32)) & (size - 1);
+      while (entries[j].key) {
+        j = (j + 1) & (size - 1);
+      }
+      entries[j] = cull->entries[i];
+    }
+    _xmlcairo_mem_release(cull->mem, XMLCAIRO_MEMORY_PATHS, cull->size * sizeof(*entries));
+    free(cull->entries);
+    cull->entries = entries;
+    cull->size = size;
+  }
+
+  const unsigned int mask = cull->size - 1;
+  unsigned int i = (unsigned int)(key ^ (key >> 32)) & mask;
+  while (cull->entries[i].key && cull->entries[i].key != key) {
+    i = (i + 1) & mask;
+  }
+  if (!cull->entries[i].key) {
+    cull->num++;
+  }
+  cull->entries[i] = (struct _xmlcairo_cull_entry){ key, bounds[0], bounds[1], bounds[2], bounds[3] };
+}
+// }}}
+
+static inline int lookup_entry(const xmlcairo_cull_t *cull, unsigned long long key, double ret[4]) // {{{
+{
+  const struct _xmlcairo_cull_entry *entry = find_entry(cull, key);
+  if (!entry) {
+    return 0;
+  }
+  ret[0] = entry->x0;
+  ret[1] = entry->y0;
+  ret[2] = entry->x1;
+  ret[3] = entry->y1;
+  return 1;
+}
+// }}}
+
+// --- bounds
+
+static inline void bounds_empty(double ret[4]) // {{{
+{
+  ret[0] = ret[1] = INFINITY;
+  ret[2] = ret[3] = -INFINITY;
+}
+// }}}
+
+static inline void bounds_add(double ret[4], double x, double y) // {{{
+{
+  ret[0] = fmin(ret[0], x);
+  ret[1] = fmin(ret[1], y);
+  ret[2] = fmax(ret[2], x);
+  ret[3] = fmax(ret[3], y);
+}
+// }}}
+
+static void bounds_union(double ret[4], const double bounds[4], double margin) // {{{
+{
+  if (bounds[0] > bounds[2] || bounds[1] > bounds[3]) {
+    return;
+  }
+  bounds_add(ret, bounds[0] - margin, bounds[1] - margin);
+  bounds_add(ret, bounds[2] + margin, bounds[3] + margin);
+}
+// }}}
+
+// (bounds non-empty)
+static void bounds_transform(double ret[4], const cairo_matrix_t *mtx, const double bounds[4]) // {{{
+{
+  for (int i = 0; i < 4; i++) {
+    double x = bounds[(i & 1) ? 2 : 0],
+           y = bounds[(i & 2) ? 3 : 1];
+    cairo_matrix_transform_point(mtx, &x, &y);
+    bounds_add(ret, x, y);
+  }
+}
+// }}}
+
+static void pbbounds_move_to(void *user, float x, float y) // {{{
+{
+  bounds_add((double *)user, x, y);
+}
+// }}}
+
+static void pbbounds_quad_to(void *user, float cx0, float cy0, float x, float y) // {{{
+{
+  bounds_add((double *)user, cx0, cy0);
+  bounds_add((double *)user, x, y);
+}
+// }}}
+
+static void pbbounds_curve_to(void *user, float cx0, float cy0, float cx1, float cy1, float x, float y) // {{{
+{
+  bounds_add((double *)user, cx0, cy0);
+  bounds_add((double *)user, cx1, cy1);
+  bounds_add((double *)user, x, y);
+}
+// }}}
+
+static void pbbounds_arc_to(void *user, float cx, float cy, float rx, float ry, float phi UNUSED, float start UNUSED, float delta UNUSED) // {{{
+{
+  const double r = fmax(rx, ry);
+  bounds_add((double *)user, cx - r, cy - r);
+  bounds_add((double *)user, cx + r, cy + r);
+}
+// }}}
+
+static void pbbounds_close(void *user UNUSED) // {{{
+{
+}
+// }}}
+
+static const struct _path_builder_t pbbounds = {
+  .move_to = pbbounds_move_to,
+  .line_to = pbbounds_move_to,
+  .quad_to = pbbounds_quad_to,
+  .curve_to = pbbounds_curve_to,
+  .arc_to = pbbounds_arc_to,
+  .close = pbbounds_close
+};
+
+int _xmlcairo_cull_path_bounds(xmlcairo_cull_t *cull, const char *d, double ret[4]) // {{{
+{
+  const size_t len = strlen(d);
+  unsigned long long key = hash_bytes(14695981039346656037ull, "P", 1);
+  key = finish_key(hash_bytes(hash_bytes(key, &len, sizeof(len)), d, len));
+  if (lookup_entry(cull, key, ret)) {
+    return 1;
+  }
+
+  bounds_empty(ret);
+  if (parse_svg_path(d, &pbbounds, ret) >= 0) {
+    return 0;
+  }
+  insert_entry(cull, key, ret);
+  return 1;
+}
+// }}}
+
+static unsigned long long hash_content(unsigned long long h, xmlNodePtr node) // {{{ node: attribute or element
+{
+  if (!node->children) {
+    return hash_bytes(h, "", 1);
+  } else if (!node->children->next &&
+             (node->children->type == XML_TEXT_NODE ||
+              node->children->type == XML_CDATA_SECTION_NODE)) {
+    const xmlChar *str = node->children->content;
+    return (str) ? hash_bytes(h, str, xmlStrlen(str) + 1) : h;
+  }
+
+  xmlChar *str = xmlNodeGetContent(node);
+  if (str) {
+    h = hash_bytes(h, str, xmlStrlen(str) + 1);
+    xmlFree(str);
+  }
+  return h;
+}
+// }}}
+
+unsigned long long _xmlcairo_cull_text_key(xmlNodePtr text) // {{{
+{
+  unsigned long long h = hash_bytes(14695981039346656037ull, "T", 1);
+  for (xmlAttrPtr attr = text->properties; attr; attr = attr->next) {
+    if (attr->type != XML_ATTRIBUTE_NODE) {
+      continue;
+    }
+    h = hash_bytes(h, attr->name, xmlStrlen(attr->name) + 1);
+    h = hash_content(h, (xmlNodePtr)attr);
+  }
+  h = hash_bytes(h, "", 1);  // (separates attributes and content)
+  return finish_key(hash_content(h, text));
+}
+// }}}
+
+int _xmlcairo_cull_text_lookup(xmlcairo_cull_t *cull, unsigned long long key, double ret[4]) // {{{
+{
+  return lookup_entry(cull, key, ret);
+}
+// }}}
+
+void _xmlcairo_cull_text_insert(xmlcairo_cull_t *cull, unsigned long long key, const double bounds[4]) // {{{
+{
+  insert_entry(cull, key, bounds);
+}
+// }}}
+
+// --- culling
+
+double _xmlcairo_cull_stroke_margin(cairo_t *cr) // {{{
+{
+  double factor = (cairo_get_line_cap(cr) == CAIRO_LINE_CAP_SQUARE) ? sqrt(2.0) : 1.0;
+  if (cairo_get_line_join(cr) == CAIRO_LINE_JOIN_MITER) {
+    factor = fmax(factor, cairo_get_miter_limit(cr));
+  }
+  return 0.5 * fabs(cairo_get_line_width(cr)) * factor;
+}
+// }}}
+
+int _xmlcairo_cull_bounded_op(cairo_t *cr) // {{{
+{
+  switch (cairo_get_operator(cr)) {
+  case CAIRO_OPERATOR_IN:
+  case CAIRO_OPERATOR_OUT:
+  case CAIRO_OPERATOR_DEST_IN:
+  case CAIRO_OPERATOR_DEST_ATOP:
+    return 0;
+  default:
+    return 1;
+  }
+}
+// }}}
+
+static void device_bounds(const cairo_matrix_t *ctm, double x0, double y0, double x1, double y1, double ret[4]) // {{{
+{
+  const double bounds[4] = { x0, y0, x1, y1 };
+  bounds_empty(ret);
+  bounds_transform(ret, ctm, bounds);
+}
+// }}}
+
+// bounds in the user space of ctm (not necessarily the current one)
+static int outside_clip(cairo_t *cr, const cairo_matrix_t *ctm, const double bounds[4], double margin) // {{{
+{
+  if (bounds[0] > bounds[2] || bounds[1] > bounds[3]) {
+    return 1;
+  }
+
+  double cx0, cy0, cx1, cy1;
+  cairo_clip_extents(cr, &cx0, &cy0, &cx1, &cy1);
+  cairo_matrix_t cur;
+  cairo_get_matrix(cr, &cur);
+
+  double b[4], c[4];
+  device_bounds(ctm, bounds[0] - margin, bounds[1] - margin, bounds[2] + margin, bounds[3] + margin, b);
+  device_bounds(&cur, cx0, cy0, cx1, cy1, c);
+  return b[2] + 2.0 < c[0] || b[0] - 2.0 > c[2] ||
+         b[3] + 2.0 < c[1] || b[1] - 2.0 > c[3];
+}
+// }}}
+
+int _xmlcairo_cull_outside(cairo_t *cr, const double bounds[4], double margin) // {{{
+{
+  cairo_matrix_t ctm;
+  cairo_get_matrix(cr, &ctm);
+  return outside_clip(cr, &ctm, bounds, margin);
+}
+// }}}
+
+static int has_attr(xmlNodePtr node, const char *name) // {{{
+{
+  for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+    if (attr->type == XML_ATTRIBUTE_NODE && xmlStrEqual(attr->name, (const xmlChar *)name)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+// }}}
+
+// returns 0 on any other attribute
+static int get_only_attr(xmlNodePtr node, const char *name, xmlChar **ret) // {{{ *ret must be xmlFree()d
+{
+  *ret = NULL;
+  for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+    if (attr->type != XML_ATTRIBUTE_NODE) {
+      continue;
+    } else if (*ret || !xmlStrEqual(attr->name, (const xmlChar *)name)) {
+      xmlFree(*ret);
+      *ret = NULL;
+      return 0;
+    }
+    *ret = xmlNodeGetContent((xmlNodePtr)attr);
+    if (!*ret) {
+      return 0;
+    }
+  }
+  return 1;
+}
+// }}}
+
+enum { PATH_OUTER, PATH_OPEN, PATH_NONE };
+
+// grows ret by what children draw (user space); margin: stroke margin (constant, because <set> is not allowed)
+// returns 0 when not known / unbounded
+static int sub_bounds(xmlcairo_cull_t *cull, xmlNodePtr child, double margin, int *path_state, double ret[4]) // {{{
+{
+  for (; child; child = child->next) {
+    if (child->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    const xmlChar *name = child->name;
+    if (xmlStrEqual(name, (const xmlChar *)"path")) {
+      xmlChar *d;
+      if (!get_only_attr(child, "d", &d)) {
+        return 0;
+      } else if (!d) {
+        continue;  // (<path/> keeps current path)
+      }
+      double bounds[4];
+      const int res = _xmlcairo_cull_path_bounds(cull, (const char *)d, bounds);
+      xmlFree(d);
+      if (!res) {
+        return 0;
+      }
+      bounds_union(ret, bounds, margin);
+      *path_state = PATH_OPEN;
+
+    } else if (xmlStrEqual(name, (const xmlChar *)"fill") ||
+               xmlStrEqual(name, (const xmlChar *)"stroke") ||
+               xmlStrEqual(name, (const xmlChar *)"clip")) {
+      if (*path_state == PATH_OUTER) {
+        return 0;  // (would use path from before the <sub>)
+      } else if (!has_attr(child, "preserve")) {
+        *path_state = PATH_NONE;
+      }
+
+    } else if (xmlStrEqual(name, (const xmlChar *)"text")) {
+      double bounds[4];
+      if (!lookup_entry(cull, _xmlcairo_cull_text_key(child), bounds)) {
+        return 0;
+      }
+      bounds_union(ret, bounds, 0.0);
+
+    } else if (xmlStrEqual(name, (const xmlChar *)"sub")) {
+      xmlChar *transform;
+      if (!get_only_attr(child, "transform", &transform)) {
+        return 0;
+      }
+      cairo_matrix_t mtx;
+      cairo_matrix_init_identity(&mtx);
+      const int res = (transform) ? parse_svg_cairo_transform(&mtx, (const char *)transform) : -1;
+      xmlFree(transform);
+      if (res >= 0) {
+        return 0;
+      }
+      double bounds[4];
+      bounds_empty(bounds);
+      if (!sub_bounds(cull, child->children, margin, path_state, bounds)) {
+        return 0;
+      }
+      if (bounds[0] <= bounds[2] && bounds[1] <= bounds[3]) {
+        bounds_transform(ret, &mtx, bounds);
+      }
+
+    } else if (!xmlStrEqual(name, (const xmlChar *)"dash") &&
+               !xmlStrEqual(name, (const xmlChar *)"set-source")) {
+      return 0;  // <paint>, <mask>, <set>, <reset-clip> (draws outside of the clip), <show-page>, <copy-page>, unknown (-> warning) ...
+    }
+  }
+  return 1;
+}
+// }}}
+
+int _xmlcairo_cull_sub(xmlcairo_cull_t *cull, cairo_t *cr, xmlNodePtr sub) // {{{
+{
+  if (!_xmlcairo_cull_bounded_op(cr)) {
+    return 0;
+  }
+
+  int path_state = PATH_OUTER;
+  double bounds[4];
+  bounds_empty(bounds);
+  if (!sub_bounds(cull, sub->children, _xmlcairo_cull_stroke_margin(cr), &path_state, bounds) ||
+      path_state == PATH_OPEN) {  // (current path is not restored by </sub>)
+    return 0;
+  }
+  return _xmlcairo_cull_outside(cr, bounds, 0.0);
+}
+// }}}
+
+// --- culled paths
+
+void _xmlcairo_cull_set_culled_path(xmlcairo_cull_t *cull, cairo_t *cr, xmlNodePtr path, const double bounds[4], double margin) // {{{
+{
+  cull->culled_path = path;
+  if (path) {
+    cairo_get_matrix(cr, &cull->culled_ctm);
+    memcpy(cull->culled_bounds, bounds, sizeof(cull->culled_bounds));
+    cull->culled_margin = margin;
+  }
+}
+// }}}
+
+int _xmlcairo_cull_detach_culled_path(xmlcairo_cull_t *cull) // {{{
+{
+  if (!cull->culled_path || cull->culled_path == cull->detached_path) {
+    return 1;
+  }
+  xmlNodePtr copy = xmlCopyNode(cull->culled_path, 1);
+  if (!copy) {
+    return 0;
+  }
+  xmlFreeNode(cull->detached_path);  // (no longer referenced: not the culled path, need_path result already used)
+  cull->detached_path = copy;
+  cull->culled_path = copy;
+  return 1;
+}
+// }}}
+
+xmlNodePtr _xmlcairo_cull_need_path(xmlcairo_cull_t *cull, cairo_t *cr, int stroke, cairo_matrix_t *ret_ctm) // {{{
+{
+  if (!cull->culled_path) {
+    return NULL;
+  }
+
+  if (_xmlcairo_cull_bounded_op(cr)) {
+    cairo_matrix_t ctm;
+    cairo_get_matrix(cr, &ctm);
+    if ((!stroke ||
+         (memcmp(&ctm, &cull->culled_ctm, sizeof(ctm)) == 0 && _xmlcairo_cull_stroke_margin(cr) <= cull->culled_margin)) &&
+        outside_clip(cr, &cull->culled_ctm, cull->culled_bounds, cull->culled_margin)) {  // (e.g. after <reset-clip>)
+      return NULL;
+    }
+  }
+
+  xmlNodePtr ret = cull->culled_path;
+  *ret_ctm = cull->culled_ctm;
+  cull->culled_path = NULL;
+  return ret;
+}
+// }}}
+
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cairo.h>
+#include <libxml/tree.h>
+
+// bounding box culling of <path>, <text> and <sub> (internal)
+
+typedef struct _xmlcairo_cull_t xmlcairo_cull_t;
+struct _xmlcairo_mem_t;
+
+// mem (can be NULL): the bounds cache grows only within its budget
+xmlcairo_cull_t *_xmlcairo_cull_create(struct _xmlcairo_mem_t *mem);
+void _xmlcairo_cull_destroy(xmlcairo_cull_t *cull);
+
+// drops all cached bounds (e.g. font key now maps to another font)
+void _xmlcairo_cull_clear(xmlcairo_cull_t *cull);
+
+// bounds are user-space x0, y0, x1, y1; empty: x0 > x1
+
+// cached, otherwise parsed (curves: control point hull, arcs: enclosing circle);
+// returns 0 when d could not be parsed
+int _xmlcairo_cull_path_bounds(xmlcairo_cull_t *cull, const char *d, double ret[4]);
+
+// hashes all attributes and the content; font pointers are not part of it, cf. _xmlcairo_cull_clear()
+unsigned long long _xmlcairo_cull_text_key(xmlNodePtr text);
+int _xmlcairo_cull_text_lookup(xmlcairo_cull_t *cull, unsigned long long key, double ret[4]); // 1: found
+void _xmlcairo_cull_text_insert(xmlcairo_cull_t *cull, unsigned long long key, const double bounds[4]);
+
+// how far a stroke of the current line width / cap / join / miter limit can extend beyond the path (user units)
+double _xmlcairo_cull_stroke_margin(cairo_t *cr);
+
+// 0 for CAIRO_OPERATOR_IN, _OUT, _DEST_IN, _DEST_ATOP, which also affect the area outside of the drawn shape
+int _xmlcairo_cull_bounded_op(cairo_t *cr);
+
+// 1 when bounds, grown by margin (user units, plus 2 device pixels for antialiasing / hinting),
+// are completely outside of cairo_clip_extents()
+int _xmlcairo_cull_outside(cairo_t *cr, const double bounds[4], double margin);
+
+// 1 when nothing the children of <sub> draw (in current user space, i.e. after its transform) is inside the clip;
+// gives up (0) on anything unbounded or state-changing (<paint>, <mask>, <set>, <reset-clip>, <show-page>, unknown, open path, ...)
+int _xmlcairo_cull_sub(xmlcairo_cull_t *cull, cairo_t *cr, xmlNodePtr sub);
+
+// <path> (with bounds) culled while the current path was replaced by an empty one;
+// the next non-preserving <fill> / <stroke> / <clip> or <path> resets it (path: NULL, bounds: NULL)
+void _xmlcairo_cull_set_culled_path(xmlcairo_cull_t *cull, cairo_t *cr, xmlNodePtr path, const double bounds[4], double margin);
+// returns the culled <path> (and the ctm it was culled with) when <fill> / <stroke> / <clip> needs the real path
+// after all: unbounded operator, stroke with larger margin / different ctm, or no longer outside of the clip
+xmlNodePtr _xmlcairo_cull_need_path(xmlcairo_cull_t *cull, cairo_t *cr, int stroke, cairo_matrix_t *ret_ctm);
+// the culled <path> is about to be freed (streaming): continue with a copy owned by cull; returns 0 on malloc error
+int _xmlcairo_cull_detach_culled_path(xmlcairo_cull_t *cull);
+
@@ -0,0 +1,546 @@
+#include "xmlcairo-damage.h"
+#include "xmlcairo-cull.h"  // _xmlcairo_cull_bounded_op()
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Each drawing op is recorded as (fingerprint of everything that determines its pixels, device-space bbox).
+// Ops in the common prefix and suffix of two recordings draw the same; only the (bboxes of the) differing
+// middle parts can change pixels. Re-running all ops intersecting that region, clipped to it, reproduces the full render.
+
+struct _xmlcairo_damage_op {
+  unsigned long long key;
+  double x0, y0, x1, y1;  // device space, x0 >= x1: empty
+};
+
+struct _xmlcairo_damage_oplist {
+  struct _xmlcairo_damage_op *ops;
+  int num, size;
+};
+
+struct _xmlcairo_damage_t {
+  enum _xmlcairo_damage_mode mode;
+
+  struct _xmlcairo_damage_oplist prev, cur;
+  int has_prev;
+  int incomplete;  // cur is missing ops (allocation failure)
+
+  unsigned long long clip_key;  // (cairo_save / _restore: cf. _xmlcairo_damage_save)
+  double x0, y0, x1, y1;  // DAMAGE_CULL rect
+};
+
+const cairo_user_data_key_t _xmlcairo_damage_serial_key;
+
+xmlcairo_damage_t *_xmlcairo_damage_create() // {{{
+{
+  return calloc(1, sizeof(xmlcairo_damage_t));
+}
+// }}}
+
+void _xmlcairo_damage_destroy(xmlcairo_damage_t *damage) // {{{
+{
+  if (!damage) {
+    return;
+  }
+  free(damage->prev.ops);
+  free(damage->cur.ops);
+  free(damage);
+}
+// }}}
+
+void _xmlcairo_damage_set_mode(xmlcairo_damage_t *damage, enum _xmlcairo_damage_mode mode) // {{{
+{
+  damage->mode = mode;
+  damage->clip_key = 0;
+  if (mode == DAMAGE_RECORD) {
+    damage->cur.num = 0;
+    damage->incomplete = 0;
+  }
+}
+// }}}
+
+void _xmlcairo_damage_invalidate(xmlcairo_damage_t *damage) // {{{
+{
+  damage->has_prev = 0;
+}
+// }}}
+
+// --- fingerprints (FNV-1a)
+
+static inline unsigned long long hash_bytes(unsigned long long h, const void *data, size_t len) // {{{
+{
+  const unsigned char *cur = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= cur[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+// }}}
+
+static inline unsigned long long hash_int(unsigned long long h, long long val) // {{{
+{
+  return hash_bytes(h, &val, sizeof(val));
+}
+// }}}
+
+static inline unsigned long long hash_double(unsigned long long h, double val) // {{{
+{
+  return hash_bytes(h, &val, sizeof(val));
+}
+// }}}
+
+static inline unsigned long long hash_ptr(unsigned long long h, const void *ptr) // {{{
+{
+  return hash_bytes(h, &ptr, sizeof(ptr));
+}
+// }}}
+
+static unsigned long long hash_matrix(unsigned long long h, const cairo_matrix_t *m) // {{{
+{
+  h = hash_double(h, m->xx);
+  h = hash_double(h, m->yx);
+  h = hash_double(h, m->xy);
+  h = hash_double(h, m->yy);
+  h = hash_double(h, m->x0);
+  return hash_double(h, m->y0);
+}
+// }}}
+
+static unsigned long long hash_path(unsigned long long h, cairo_t *cr) // {{{
+{
+  cairo_path_t *path = cairo_copy_path(cr);
+  if (path->status != CAIRO_STATUS_SUCCESS) {
+    cairo_path_destroy(path);
+    return hash_ptr(h, path);  // (i.e. differs)
+  }
+
+  // (NOTE: header elements are not fully initialized, hash only the used fields)
+  for (int i = 0; i < path->num_data; i += path->data[i].header.length) {
+    const cairo_path_data_t *data = &path->data[i];
+    h = hash_int(h, data->header.type);
+    for (int j = 1; j < data->header.length; j++) {
+      h = hash_double(h, data[j].point.x);
+      h = hash_double(h, data[j].point.y);
+    }
+  }
+
+  cairo_path_destroy(path);
+  return h;
+}
+// }}}
+
+static unsigned long long hash_color_stops(unsigned long long h, cairo_pattern_t *pattern) // {{{
+{
+  int count = 0;
+  cairo_pattern_get_color_stop_count(pattern, &count);
+  for (int i = 0; i < count; i++) {
+    double offset, r, g, b, a;
+    cairo_pattern_get_color_stop_rgba(pattern, i, &offset, &r, &g, &b, &a);
+    h = hash_double(h, offset);
+    h = hash_double(h, r);
+    h = hash_double(h, g);
+    h = hash_double(h, b);
+    h = hash_double(h, a);
+  }
+  return h;
+}
+// }}}
+
+static unsigned long long hash_pattern(unsigned long long h, cairo_pattern_t *pattern) // {{{
+{
+  const cairo_pattern_type_t type = cairo_pattern_get_type(pattern);
+  h = hash_int(h, type);
+
+  cairo_matrix_t matrix;
+  cairo_pattern_get_matrix(pattern, &matrix);
+  h = hash_matrix(h, &matrix);
+  h = hash_int(h, cairo_pattern_get_extend(pattern));
+  h = hash_int(h, cairo_pattern_get_filter(pattern));
+
+  switch (type) {
+  case CAIRO_PATTERN_TYPE_SOLID: {
+    double r, g, b, a;
+    cairo_pattern_get_rgba(pattern, &r, &g, &b, &a);
+    h = hash_double(h, r);
+    h = hash_double(h, g);
+    h = hash_double(h, b);
+    return hash_double(h, a);
+  }
+
+  case CAIRO_PATTERN_TYPE_SURFACE: {
+    cairo_surface_t *surface = NULL;
+    cairo_pattern_get_surface(pattern, &surface);
+    h = hash_ptr(h, surface);  // (loaded images do not change; cf. resource generation in xmlcairo_apply_list_incremental)
+    return hash_ptr(h, cairo_surface_get_user_data(surface, &_xmlcairo_damage_serial_key));
+  }
+
+  case CAIRO_PATTERN_TYPE_LINEAR: {
+    double x0, y0, x1, y1;
+    cairo_pattern_get_linear_points(pattern, &x0, &y0, &x1, &y1);
+    h = hash_double(h, x0);
+    h = hash_double(h, y0);
+    h = hash_double(h, x1);
+    h = hash_double(h, y1);
+    return hash_color_stops(h, pattern);
+  }
+
+  case CAIRO_PATTERN_TYPE_RADIAL: {
+    double x0, y0, r0, x1, y1, r1;
+    cairo_pattern_get_radial_circles(pattern, &x0, &y0, &r0, &x1, &y1, &r1);
+    h = hash_double(h, x0);
+    h = hash_double(h, y0);
+    h = hash_double(h, r0);
+    h = hash_double(h, x1);
+    h = hash_double(h, y1);
+    h = hash_double(h, r1);
+    return hash_color_stops(h, pattern);
+  }
+
+  default:  // (mesh, raster source, ...): pattern identity, i.e. always considered changed
+    return hash_ptr(h, pattern);
+  }
+}
+// }}}
+
+static unsigned long long hash_state(const xmlcairo_damage_t *damage, cairo_t *cr, char op) // {{{
+{
+  unsigned long long h = hash_int(14695981039346656037ull, op);
+
+  cairo_matrix_t ctm;
+  cairo_get_matrix(cr, &ctm);
+  h = hash_matrix(h, &ctm);
+  h = hash_int(h, cairo_get_operator(cr));
+  h = hash_int(h, cairo_get_antialias(cr));
+  h = hash_double(h, cairo_get_tolerance(cr));
+  h = hash_int(h, damage->clip_key);
+  return hash_pattern(h, cairo_get_source(cr));
+}
+// }}}
+
+// --- extents
+
+// user space box -> device space bbox (padded for antialiasing), clipped to current clip
+static void device_box(cairo_t *cr, double x0, double y0, double x1, double y1, struct _xmlcairo_damage_op *ret) // {{{
+{
+  if (x0 >= x1 || y0 >= y1) {
+    ret->x0 = ret->y0 = ret->x1 = ret->y1 = 0;
+    return;
+  }
+
+  double cx0, cy0, cx1, cy1;
+  cairo_clip_extents(cr, &cx0, &cy0, &cx1, &cy1);
+  x0 = fmax(x0, cx0);
+  y0 = fmax(y0, cy0);
+  x1 = fmin(x1, cx1);
+  y1 = fmin(y1, cy1);
+  if (x0 >= x1 || y0 >= y1) {
+    ret->x0 = ret->y0 = ret->x1 = ret->y1 = 0;
+    return;
+  }
+
+  double px[4] = { x0, x1, x0, x1 }, py[4] = { y0, y0, y1, y1 };
+  ret->x0 = ret->y0 = INFINITY;
+  ret->x1 = ret->y1 = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    cairo_user_to_device(cr, &px[i], &py[i]);
+    ret->x0 = fmin(ret->x0, px[i]);
+    ret->y0 = fmin(ret->y0, py[i]);
+    ret->x1 = fmax(ret->x1, px[i]);
+    ret->y1 = fmax(ret->y1, py[i]);
+  }
+  ret->x0 = floor(ret->x0) - 1;
+  ret->y0 = floor(ret->y0) - 1;
+  ret->x1 = ceil(ret->x1) + 1;
+  ret->y1 = ceil(ret->y1) + 1;
+}
+// }}}
+
+static inline int box_empty(const struct _xmlcairo_damage_op *box) // {{{
+{
+  return box->x0 >= box->x1 || box->y0 >= box->y1;
+}
+// }}}
+
+// returns 1 when op shall be skipped
+static int handle_op(xmlcairo_damage_t *damage, const struct _xmlcairo_damage_op *op) // {{{
+{
+  if (damage->mode == DAMAGE_CULL) {
+    return box_empty(op) ||
+           op->x1 <= damage->x0 || op->x0 >= damage->x1 ||
+           op->y1 <= damage->y0 || op->y0 >= damage->y1;
+  }
+  // assert(damage->mode == DAMAGE_RECORD);
+
+  struct _xmlcairo_damage_oplist *list = &damage->cur;
+  if (list->num >= list->size) {
+    const int new_size = list->size ? 2 * list->size : 256;
+    struct _xmlcairo_damage_op *tmp = realloc(list->ops, new_size * sizeof(*tmp));
+    if (!tmp) {
+      damage->incomplete = 1;
+      return 1;
+    }
+    list->ops = tmp;
+    list->size = new_size;
+  }
+  list->ops[list->num++] = *op;
+  return 1;
+}
+// }}}
+
+// extents: cairo_fill_extents / cairo_stroke_extents; unbounded operators (e.g. in) change everything inside the clip
+static void op_extents(cairo_t *cr, void (*extents)(cairo_t *, double *, double *, double *, double *), // {{{
+                       double *x0, double *y0, double *x1, double *y1)
+{
+  if (_xmlcairo_cull_bounded_op(cr)) {
+    extents(cr, x0, y0, x1, y1);
+  } else {
+    cairo_clip_extents(cr, x0, y0, x1, y1);
+  }
+}
+// }}}
+
+int _xmlcairo_damage_fill(xmlcairo_damage_t *damage, cairo_t *cr) // {{{
+{
+  if (damage->mode == DAMAGE_OFF) {
+    return 0;
+  }
+
+  struct _xmlcairo_damage_op op;
+  double x0, y0, x1, y1;
+  op_extents(cr, cairo_fill_extents, &x0, &y0, &x1, &y1);
+  device_box(cr, x0, y0, x1, y1, &op);
+  if (damage->mode == DAMAGE_RECORD) {
+    op.key = hash_state(damage, cr, 'F');
+    op.key = hash_int(op.key, cairo_get_fill_rule(cr));
+    op.key = hash_path(op.key, cr);
+  }
+  return handle_op(damage, &op);
+}
+// }}}
+
+int _xmlcairo_damage_stroke(xmlcairo_damage_t *damage, cairo_t *cr) // {{{
+{
+  if (damage->mode == DAMAGE_OFF) {
+    return 0;
+  }
+
+  struct _xmlcairo_damage_op op;
+  double x0, y0, x1, y1;
+  op_extents(cr, cairo_stroke_extents, &x0, &y0, &x1, &y1);
+  device_box(cr, x0, y0, x1, y1, &op);
+  if (damage->mode == DAMAGE_RECORD) {
+    unsigned long long h = hash_state(damage, cr, 'S');
+    h = hash_double(h, cairo_get_line_width(cr));
+    h = hash_int(h, cairo_get_line_cap(cr));
+    h = hash_int(h, cairo_get_line_join(cr));
+    h = hash_double(h, cairo_get_miter_limit(cr));
+
+    const int num_dashes = cairo_get_dash_count(cr);
+    if (num_dashes > 0) {
+      double *dashes = malloc(num_dashes * sizeof(double)), offset;
+      if (dashes) {
+        cairo_get_dash(cr, dashes, &offset);
+        h = hash_bytes(h, dashes, num_dashes * sizeof(double));
+        h = hash_double(h, offset);
+        free(dashes);
+      } else {
+        h = hash_ptr(h, &op);
+      }
+    }
+    op.key = hash_path(h, cr);
+  }
+  return handle_op(damage, &op);
+}
+// }}}
+
+int _xmlcairo_damage_paint(xmlcairo_damage_t *damage, cairo_t *cr, double alpha, cairo_pattern_t *mask, cairo_surface_t *mask_surface, double mx, double my) // {{{
+{
+  if (damage->mode == DAMAGE_OFF) {
+    return 0;
+  }
+
+  // (conservative: whole clip)
+  struct _xmlcairo_damage_op op;
+  double x0, y0, x1, y1;
+  cairo_clip_extents(cr, &x0, &y0, &x1, &y1);
+  device_box(cr, x0, y0, x1, y1, &op);
+  if (damage->mode == DAMAGE_RECORD) {
+    unsigned long long h = hash_state(damage, cr, 'P');
+    h = hash_double(h, alpha);
+    if (mask) {
+      h = hash_pattern(h, mask);
+    } else if (mask_surface) {
+      h = hash_ptr(h, mask_surface);
+      h = hash_double(h, mx);
+      h = hash_double(h, my);
+    }
+    op.key = h;
+  }
+  return handle_op(damage, &op);
+}
+// }}}
+
+int _xmlcairo_damage_glyphs(xmlcairo_damage_t *damage, cairo_t *cr, const cairo_glyph_t *glyphs, int num_glyphs) // {{{
+{
+  if (damage->mode == DAMAGE_OFF) {
+    return 0;
+  }
+
+  struct _xmlcairo_damage_op op;
+  if (_xmlcairo_cull_bounded_op(cr)) {
+    cairo_text_extents_t ext;
+    cairo_glyph_extents(cr, glyphs, num_glyphs, &ext);
+    device_box(cr, ext.x_bearing, ext.y_bearing, ext.x_bearing + ext.width, ext.y_bearing + ext.height, &op);
+  } else {
+    double x0, y0, x1, y1;
+    cairo_clip_extents(cr, &x0, &y0, &x1, &y1);
+    device_box(cr, x0, y0, x1, y1, &op);
+  }
+  if (damage->mode == DAMAGE_RECORD) {
+    unsigned long long h = hash_state(damage, cr, 'G');
+    h = hash_ptr(h, cairo_get_font_face(cr));
+
+    cairo_matrix_t fm;
+    cairo_get_font_matrix(cr, &fm);
+    h = hash_matrix(h, &fm);
+    for (int i = 0; i < num_glyphs; i++) {
+      h = hash_int(h, glyphs[i].index);
+      h = hash_double(h, glyphs[i].x);
+      h = hash_double(h, glyphs[i].y);
+    }
+    op.key = h;
+  }
+  return handle_op(damage, &op);
+}
+// }}}
+
+void _xmlcairo_damage_clip(xmlcairo_damage_t *damage, cairo_t *cr) // {{{
+{
+  if (damage->mode != DAMAGE_RECORD) {
+    return;
+  }
+
+  cairo_matrix_t ctm;
+  cairo_get_matrix(cr, &ctm);
+  unsigned long long h = hash_int(damage->clip_key, 'C');
+  h = hash_matrix(h, &ctm);
+  h = hash_int(h, cairo_get_fill_rule(cr));
+  h = hash_int(h, cairo_get_antialias(cr));
+  h = hash_double(h, cairo_get_tolerance(cr));
+  damage->clip_key = hash_path(h, cr);
+}
+// }}}
+
+void _xmlcairo_damage_reset_clip(xmlcairo_damage_t *damage, cairo_t *cr) // {{{
+{
+  damage->clip_key = 0;
+  if (damage->mode != DAMAGE_CULL) {
+    return;
+  }
+
+  // clip to the damage rect again, keeping the current path
+  cairo_path_t *path = cairo_copy_path(cr);
+  cairo_matrix_t ctm;
+  cairo_get_matrix(cr, &ctm);
+  cairo_identity_matrix(cr);
+  cairo_new_path(cr);
+  cairo_rectangle(cr, damage->x0, damage->y0, damage->x1 - damage->x0, damage->y1 - damage->y0);
+  cairo_clip(cr);
+  cairo_set_matrix(cr, &ctm);
+  cairo_append_path(cr, path);
+  cairo_path_destroy(path);
+}
+// }}}
+
+unsigned long long _xmlcairo_damage_save(const xmlcairo_damage_t *damage) // {{{
+{
+  return damage->clip_key;
+}
+// }}}
+
+void _xmlcairo_damage_restore(xmlcairo_damage_t *damage, unsigned long long saved) // {{{
+{
+  damage->clip_key = saved;
+}
+// }}}
+
+// --- diff
+
+static void box_union(struct _xmlcairo_damage_op *dst, const struct _xmlcairo_damage_op *src) // {{{
+{
+  if (box_empty(src)) {
+    return;
+  } else if (box_empty(dst)) {
+    *dst = *src;
+    return;
+  }
+  dst->x0 = fmin(dst->x0, src->x0);
+  dst->y0 = fmin(dst->y0, src->y0);
+  dst->x1 = fmax(dst->x1, src->x1);
+  dst->y1 = fmax(dst->y1, src->y1);
+}
+// }}}
+
+static inline int op_equal(const struct _xmlcairo_damage_op *a, const struct _xmlcairo_damage_op *b) // {{{
+{
+  return a->key == b->key &&
+         a->x0 == b->x0 && a->y0 == b->y0 && a->x1 == b->x1 && a->y1 == b->y1;
+}
+// }}}
+
+int _xmlcairo_damage_compute(xmlcairo_damage_t *damage, int width, int height, int ret_rect[4]) // {{{
+{
+  struct _xmlcairo_damage_op box = { 0, 0, 0, 0, 0 };
+  if (!damage->has_prev || damage->incomplete) {
+    box.x1 = width;
+    box.y1 = height;
+  } else {
+    const struct _xmlcairo_damage_oplist *a = &damage->prev, *b = &damage->cur;
+    int prefix = 0;
+    while (prefix < a->num && prefix < b->num && op_equal(&a->ops[prefix], &b->ops[prefix])) {
+      prefix++;
+    }
+    int suffix = 0;
+    while (suffix < a->num - prefix && suffix < b->num - prefix &&
+           op_equal(&a->ops[a->num - 1 - suffix], &b->ops[b->num - 1 - suffix])) {
+      suffix++;
+    }
+
+    for (int i = prefix; i < a->num - suffix; i++) {
+      box_union(&box, &a->ops[i]);
+    }
+    for (int i = prefix; i < b->num - suffix; i++) {
+      box_union(&box, &b->ops[i]);
+    }
+    box.x0 = fmax(box.x0, 0);
+    box.y0 = fmax(box.y0, 0);
+    box.x1 = fmin(box.x1, width);
+    box.y1 = fmin(box.y1, height);
+  }
+
+  // keep current recording for next time
+  struct _xmlcairo_damage_oplist tmp = damage->prev;
+  damage->prev = damage->cur;
+  damage->cur = tmp;
+  damage->cur.num = 0;
+  damage->has_prev = !damage->incomplete;
+
+  if (box_empty(&box)) {
+    ret_rect[0] = ret_rect[1] = ret_rect[2] = ret_rect[3] = 0;
+    return 0;
+  }
+
+  damage->x0 = box.x0;
+  damage->y0 = box.y0;
+  damage->x1 = box.x1;
+  damage->y1 = box.y1;
+
+  ret_rect[0] = box.x0;
+  ret_rect[1] = box.y0;
+  ret_rect[2] = box.x1 - box.x0;
+  ret_rect[3] = box.y1 - box.y0;
+  return 1;
+}
+// }}}
+
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cairo.h>
+
+// damage tracking for xmlcairo_apply_list_incremental() (internal)
+
+typedef struct _xmlcairo_damage_t xmlcairo_damage_t;
+
+// user data (serial number) of source surfaces that can be replaced by a new one at the same address
+// (e.g. <symbol> recordings); part of their fingerprint
+extern const cairo_user_data_key_t _xmlcairo_damage_serial_key;
+
+enum _xmlcairo_damage_mode {
+  DAMAGE_OFF,
+  DAMAGE_RECORD, // only record extents + fingerprints of drawing ops, do not draw
+  DAMAGE_CULL    // draw only ops intersecting the damage rect
+};
+
+xmlcairo_damage_t *_xmlcairo_damage_create();
+void _xmlcairo_damage_destroy(xmlcairo_damage_t *damage);
+
+// DAMAGE_RECORD starts a new op list
+void _xmlcairo_damage_set_mode(xmlcairo_damage_t *damage, enum _xmlcairo_damage_mode mode);
+
+// next _xmlcairo_damage_compute() will report everything as damaged (e.g. resources changed)
+void _xmlcairo_damage_invalidate(xmlcairo_damage_t *damage);
+
+// compares recorded op list with the one of the previous DAMAGE_RECORD (which is then discarded);
+// all previous: full [0, width) x [0, height) rect.
+// returns 0 when nothing changed, otherwise sets damage rect (in device units, integer)
+int _xmlcairo_damage_compute(xmlcairo_damage_t *damage, int width, int height, int ret_rect[4]);
+
+// drawing op hooks: return 1 when the op shall be skipped
+// (NOTE: caller must then still cairo_new_path() for non-preserving fill / stroke)
+int _xmlcairo_damage_fill(xmlcairo_damage_t *damage, cairo_t *cr);
+int _xmlcairo_damage_stroke(xmlcairo_damage_t *damage, cairo_t *cr);
+// paint: alpha can be NAN; mask: either mask (pattern) or mask_surface at (mx, my), or none
+int _xmlcairo_damage_paint(xmlcairo_damage_t *damage, cairo_t *cr, double alpha, cairo_pattern_t *mask, cairo_surface_t *mask_surface, double mx, double my);
+int _xmlcairo_damage_glyphs(xmlcairo_damage_t *damage, cairo_t *cr, const cairo_glyph_t *glyphs, int num_glyphs);
+
+// state hooks
+void _xmlcairo_damage_clip(xmlcairo_damage_t *damage, cairo_t *cr);  // before cairo_clip()
+void _xmlcairo_damage_reset_clip(xmlcairo_damage_t *damage, cairo_t *cr);  // after cairo_reset_clip(): DAMAGE_CULL clips to the damage rect again
+// around cairo_save() / cairo_restore()
+unsigned long long _xmlcairo_damage_save(const xmlcairo_damage_t *damage);
+void _xmlcairo_damage_restore(xmlcairo_damage_t *damage, unsigned long long saved);
+
@@ -1,21 +1,95 @@
 #pragma once
 
 typedef struct _cairo_surface cairo_surface_t;
+typedef enum _cairo_format cairo_format_t;
 
 typedef struct _xmlOutputBuffer *xmlOutputBufferPtr;
 typedef struct _xmlHashTable *xmlHashTablePtr;
 
 typedef struct _ftfont_cairo_mgr ftfont_cairo_mgr_t;
 
+typedef unsigned char xmlChar;
+
+typedef struct _xmlcairo_stats_t xmlcairo_stats_t;
+typedef struct _xmlcairo_trace_t xmlcairo_trace_t;
+typedef struct _xmlcairo_damage_t xmlcairo_damage_t;
+typedef struct _xmlcairo_cull_t xmlcairo_cull_t;
+struct _xmlcairo_mem_t;
+
+struct _xmlcairo_binary_t {
+  const unsigned char *data;
+  unsigned long len;
+  int mapped;  // 1: mmap()ed, 0: malloc()ed (non-file xmlio) or empty
+};
+
 struct _xmlcairo_surface_t {
   cairo_surface_t *surface;
 
   xmlOutputBufferPtr obuf;
 
   xmlHashTablePtr imgs;
+  xmlHashTablePtr binaries;  // struct _xmlcairo_binary_t, cf. xmlcairo_load_binary()
 
   ftfont_cairo_mgr_t *fmgr;
   xmlHashTablePtr fontfiles;
   xmlHashTablePtr fonts;
+
+  xmlcairo_stats_t *stats;  // (not owned, NULL: disabled)
+  xmlcairo_trace_t *trace;  // (not owned, NULL: disabled)
+
+  xmlcairo_damage_t *damage;  // (only after xmlcairo_apply_list_incremental)
+  unsigned int resource_gen, damage_resource_gen;  // (resource_gen: bumped by xmlcairo_load_*)
+
+  xmlcairo_cull_t *cull;  // (NULL: culling disabled), cf. xmlcairo_surface_set_cull()
+  int simplify;  // cf. xmlcairo_surface_set_simplify()
+  unsigned int cull_resource_gen;
+
+  xmlHashTablePtr symbols;  // <symbol id>: struct _xmlcairo_symbol_t
+  unsigned int symbol_serial;
+
+  xmlHashTablePtr patterns;  // <linear-gradient id>, <radial-gradient id>, <surface-pattern id>: struct _xmlcairo_pattern_def_t
+
+  const struct _xmlcairo_surface_t *parent;  // (worker of xmlcairo_apply_list_parallel(): imgs, binaries, fonts are parent's)
+
+  struct _xmlcairo_mem_t *mem;  // budget / limits, cf. xmlcairo-mem.h (workers: parent's)
+};
+
+// xmlcairo.c
+// own symbols, patterns, cull and font scratch; surface (target) is set by the caller. NULL on malloc error
+struct _xmlcairo_surface_t *_xmlcairo_surface_create_worker(const struct _xmlcairo_surface_t *parent);
+void _xmlcairo_surface_free(struct _xmlcairo_surface_t *surface);  // (does not touch surface->surface)
+
+// xmlcairo-pool.c
+// image surface, pixel buffer from / back to the process-wide pool (cf. xmlcairo_set_image_pool_limit())
+cairo_surface_t *_xmlcairo_pool_image_create(cairo_format_t format, int width, int height);
+
+// xmlcairo-stats.c
+unsigned long long _xmlcairo_stats_now(); // ns, monotonic
+void _xmlcairo_stats_add(xmlcairo_stats_t *stats, int kind, const char *name, unsigned long long ns);
+// keeps the highest peaks of mem
+void _xmlcairo_stats_memory(xmlcairo_stats_t *stats, const struct _xmlcairo_mem_t *mem);
+
+// xmlcairo-trace.c
+// emits complete event [start_ns, now); ...: NULL-terminated (const char *key, const char *value) pairs
+void _xmlcairo_trace_complete(xmlcairo_trace_t *trace, const char *cat, const char *name, unsigned long long start_ns, ...);
+
+// xmlcairo-apply.c
+enum {
+  XMLCAIRO_SET_ANTIALIAS,
+  XMLCAIRO_SET_FILL_RULE,
+  XMLCAIRO_SET_LINE_CAP,
+  XMLCAIRO_SET_LINE_JOIN,
+  XMLCAIRO_SET_LINE_WIDTH,
+  XMLCAIRO_SET_MITER_LIMIT,
+  XMLCAIRO_SET_OPERATOR,
+  XMLCAIRO_SET_TOLERANCE,
+  XMLCAIRO_NUM_SET_ATTRS
 };
+// <set> attribute: returns XMLCAIRO_SET_* and the value as applied (enums: as double),
+// -1 when name is not known, -2 when value could not be parsed
+int _xmlcairo_parse_set_attr(const xmlChar *name, const xmlChar *value, double *ret);
+// xmlHashDeallocator for surface->symbols
+void _xmlcairo_symbol_free(void *entry, const xmlChar *name);
+// xmlHashDeallocator for surface->patterns
+void _xmlcairo_pattern_free(void *entry, const xmlChar *name);
 
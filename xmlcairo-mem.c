@@ -0,0 +1,153 @@
+#include "xmlcairo-mem.h"
+#include "xmlcairo-int.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define WARN(s, ...)  fprintf(stderr, "Warning: " s "\n" ,## __VA_ARGS__);
+
+static const char *const kind_names[XMLCAIRO_MEMORY_NUM_KINDS] = {
+  [XMLCAIRO_MEMORY_IMAGES] = "images",
+  [XMLCAIRO_MEMORY_GLYPHS] = "glyphs",
+  [XMLCAIRO_MEMORY_PATHS] = "paths",
+  [XMLCAIRO_MEMORY_DOM] = "dom"
+};
+
+static struct {
+  pthread_mutex_t lock;
+  xmlcairo_limits_t limits;
+} defaults = {
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+void xmlcairo_set_default_limits(const xmlcairo_limits_t *limits) // {{{
+{
+  pthread_mutex_lock(&defaults.lock);
+  defaults.limits = (limits) ? *limits : (xmlcairo_limits_t){ 0 };
+  pthread_mutex_unlock(&defaults.lock);
+}
+// }}}
+
+struct _xmlcairo_mem_t *_xmlcairo_mem_create() // {{{
+{
+  struct _xmlcairo_mem_t *ret = calloc(1, sizeof(struct _xmlcairo_mem_t));
+  if (!ret) {
+    return NULL;
+  }
+  pthread_mutex_lock(&defaults.lock);
+  ret->limits = defaults.limits;
+  pthread_mutex_unlock(&defaults.lock);
+  ret->status = CAIRO_STATUS_SUCCESS;
+  return ret;
+}
+// }}}
+
+void _xmlcairo_mem_destroy(struct _xmlcairo_mem_t *mem) // {{{
+{
+  free(mem);
+}
+// }}}
+
+void xmlcairo_surface_set_limits(xmlcairo_surface_t *surface, const xmlcairo_limits_t *limits) // {{{
+{
+  if (!surface || !surface->mem) {
+    return;
+  }
+  surface->mem->limits = (limits) ? *limits : (xmlcairo_limits_t){ 0 };
+  __atomic_store_n(&surface->mem->status, CAIRO_STATUS_SUCCESS, __ATOMIC_RELAXED);
+}
+// }}}
+
+static inline void update_peak(unsigned long long *peak, unsigned long long value) // {{{
+{
+  unsigned long long cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while (value > cur && !__atomic_compare_exchange_n(peak, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+// }}}
+
+static int charge(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes, int required) // {{{
+{
+  if (!mem || !bytes) {
+    return 1;
+  }
+  const unsigned long long max = mem->limits.max_memory,
+                           total = __atomic_add_fetch(&mem->total, bytes, __ATOMIC_RELAXED);
+  if (max && total > max) {
+    __atomic_sub_fetch(&mem->total, bytes, __ATOMIC_RELAXED);
+    if (required) {
+      WARN("memory budget exceeded: %s need %llu bytes, %llu of %llu in use", kind_names[kind], bytes, total - bytes, max);
+      _xmlcairo_mem_fail(mem, CAIRO_STATUS_NO_MEMORY);
+    }
+    return 0;
+  }
+  update_peak(&mem->peak[kind], __atomic_add_fetch(&mem->used[kind], bytes, __ATOMIC_RELAXED));
+  update_peak(&mem->peak_total, total);
+  return 1;
+}
+// }}}
+
+int _xmlcairo_mem_charge(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes) // {{{
+{
+  return charge(mem, kind, bytes, 1);
+}
+// }}}
+
+int _xmlcairo_mem_try_charge(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes) // {{{
+{
+  return charge(mem, kind, bytes, 0);
+}
+// }}}
+
+void _xmlcairo_mem_release(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes) // {{{
+{
+  if (!mem || !bytes) {
+    return;
+  }
+  __atomic_sub_fetch(&mem->used[kind], bytes, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&mem->total, bytes, __ATOMIC_RELAXED);
+}
+// }}}
+
+void _xmlcairo_mem_begin(struct _xmlcairo_mem_t *mem) // {{{
+{
+  if (!mem) {
+    return;
+  }
+  __atomic_store_n(&mem->status, CAIRO_STATUS_SUCCESS, __ATOMIC_RELAXED);
+}
+// }}}
+
+void _xmlcairo_mem_fail(struct _xmlcairo_mem_t *mem, cairo_status_t status) // {{{
+{
+  if (!mem) {
+    return;
+  }
+  cairo_status_t expected = CAIRO_STATUS_SUCCESS;
+  __atomic_compare_exchange_n(&mem->status, &expected, status, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+// }}}
+
+cairo_status_t _xmlcairo_mem_status(const struct _xmlcairo_mem_t *mem) // {{{
+{
+  return (mem) ? __atomic_load_n(&mem->status, __ATOMIC_RELAXED) : CAIRO_STATUS_SUCCESS;
+}
+// }}}
+
+unsigned long long _xmlcairo_mem_dom_size(xmlNodePtr node, int siblings) // {{{
+{
+  unsigned long long ret = 0;
+  for (; node; node = (siblings) ? node->next : NULL) {
+    ret += sizeof(xmlNode);
+    if (node->type == XML_ELEMENT_NODE) {
+      for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+        ret += sizeof(xmlAttr) + _xmlcairo_mem_dom_size(attr->children, 1);
+      }
+      ret += _xmlcairo_mem_dom_size(node->children, 1);
+    } else if (node->content) {
+      ret += xmlStrlen(node->content) + 1;
+    }
+  }
+  return ret;
+}
+// }}}
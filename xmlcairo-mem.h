@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cairo.h>
+#include <libxml/tree.h>
+#include "xmlcairo.h"  // xmlcairo_limits_t, XMLCAIRO_MEMORY_*
+
+// memory budget / limits of one surface (internal);
+// updated atomically: shared with the workers of xmlcairo_apply_list_parallel()
+
+struct _xmlcairo_mem_t {
+  unsigned long long used[XMLCAIRO_MEMORY_NUM_KINDS], total;  // (bytes)
+  unsigned long long peak[XMLCAIRO_MEMORY_NUM_KINDS], peak_total;
+  xmlcairo_limits_t limits;
+  cairo_status_t status;  // first limit hit in the current xmlcairo_apply*() call
+};
+
+// with the limits of xmlcairo_set_default_limits(); NULL on malloc error
+struct _xmlcairo_mem_t *_xmlcairo_mem_create();
+void _xmlcairo_mem_destroy(struct _xmlcairo_mem_t *mem);
+
+// all of the following accept mem == NULL (not accounted)
+
+// returns 0 when bytes would exceed max_memory: then nothing is charged, and the render fails (CAIRO_STATUS_NO_MEMORY)
+int _xmlcairo_mem_charge(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes);
+// same, for caches that can do without: returns 0 when over budget, but does not fail the render
+int _xmlcairo_mem_try_charge(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes);
+void _xmlcairo_mem_release(struct _xmlcairo_mem_t *mem, xmlcairo_memory_kind_t kind, unsigned long long bytes);
+
+// new render (public xmlcairo_apply*() on the owning surface, not on workers): clears the status
+void _xmlcairo_mem_begin(struct _xmlcairo_mem_t *mem);
+// fails the render with status (when it did not fail already)
+void _xmlcairo_mem_fail(struct _xmlcairo_mem_t *mem, cairo_status_t status);
+// CAIRO_STATUS_SUCCESS, or the status of the first limit hit
+cairo_status_t _xmlcairo_mem_status(const struct _xmlcairo_mem_t *mem);
+
+// estimate (libxml2 structs + text) of node and its descendants; siblings: also all following siblings
+unsigned long long _xmlcairo_mem_dom_size(xmlNodePtr node, int siblings);
@@ -0,0 +1,346 @@
+#include "xmlcairo-int.h"
+#include "xmlcairo.h"
+#include <cairo.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libxml/tree.h>
+
+// Every rule keeps the rendered output identical; only warnings of removed (invalid) elements can get lost.
+// State tracked per instruction list (children of <sub> start with a copy, restored at </sub>):
+// - known <set> values: setting the same value again is a no-op,
+// - pending <set> attributes / <set-source>: not yet used by any drawing op, thus dead when overridden
+//   (or when the list ends, i.e. cairo_restore / cairo_destroy).
+
+struct _optimize_state_t {
+  double known[XMLCAIRO_NUM_SET_ATTRS];       // NAN: unknown
+  xmlAttrPtr pending[XMLCAIRO_NUM_SET_ATTRS];
+  xmlNodePtr pending_source;
+
+  xmlNodePtr last_set;  // directly preceding (valid) <set>, for merging
+
+  xmlNodePtr head;  // first node of the list
+  xmlcairo_optimize_report_t *report;
+};
+
+// cairo_create() defaults
+static const double set_defaults[XMLCAIRO_NUM_SET_ATTRS] = {
+  [XMLCAIRO_SET_ANTIALIAS] = CAIRO_ANTIALIAS_DEFAULT,
+  [XMLCAIRO_SET_FILL_RULE] = CAIRO_FILL_RULE_WINDING,
+  [XMLCAIRO_SET_LINE_CAP] = CAIRO_LINE_CAP_BUTT,
+  [XMLCAIRO_SET_LINE_JOIN] = CAIRO_LINE_JOIN_MITER,
+  [XMLCAIRO_SET_LINE_WIDTH] = 2.0,
+  [XMLCAIRO_SET_MITER_LIMIT] = 10.0,
+  [XMLCAIRO_SET_OPERATOR] = CAIRO_OPERATOR_OVER,
+  [XMLCAIRO_SET_TOLERANCE] = 0.1
+};
+
+static inline int strEqual(const xmlChar *a, const char *b) // {{{
+{
+  return xmlStrEqual(a, (const xmlChar *)b);
+}
+// }}}
+
+static void remove_node(struct _optimize_state_t *st, xmlNodePtr node) // {{{
+{
+  if (node == st->head) {
+    st->head = node->next;
+  }
+  if (node == st->last_set) {
+    st->last_set = NULL;
+  }
+  xmlUnlinkNode(node);
+  xmlFreeNode(node);
+}
+// }}}
+
+static inline int has_attrs(xmlNodePtr node) // {{{
+{
+  for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+    if (attr->type == XML_ATTRIBUTE_NODE) {
+      return 1;
+    }
+  }
+  return 0;
+}
+// }}}
+
+// removes the whole <set>, when attr was its last attribute
+static void remove_set_attr(struct _optimize_state_t *st, xmlAttrPtr attr) // {{{
+{
+  xmlNodePtr node = attr->parent;
+  xmlRemoveProp(attr);
+  st->report->removed_set_attrs++;
+  if (!has_attrs(node)) {
+    remove_node(st, node);
+    st->report->removed_sets++;
+  }
+}
+// }}}
+
+static void consume(struct _optimize_state_t *st, int source) // {{{ drawing op: everything pending is used
+{
+  memset(st->pending, 0, sizeof(st->pending));
+  if (source) {
+    st->pending_source = NULL;
+  }
+}
+// }}}
+
+static void end_of_list(struct _optimize_state_t *st) // {{{
+{
+  for (int i = 0; i < XMLCAIRO_NUM_SET_ATTRS; i++) {
+    if (st->pending[i]) {
+      remove_set_attr(st, st->pending[i]);
+      st->pending[i] = NULL;
+    }
+  }
+  if (st->pending_source) {
+    remove_node(st, st->pending_source);
+    st->report->removed_sources++;
+    st->pending_source = NULL;
+  }
+}
+// }}}
+
+// value of a single text / cdata child, or NULL
+static const xmlChar *simple_value(xmlAttrPtr attr) // {{{
+{
+  if (attr->children && !attr->children->next &&
+      (attr->children->type == XML_TEXT_NODE ||
+       attr->children->type == XML_CDATA_SECTION_NODE)) {
+    return attr->children->content;
+  }
+  return NULL;
+}
+// }}}
+
+// returns 0 when (at least) one attribute is unknown or cannot be parsed, i.e. <set> might only be partially applied
+static int parse_set(xmlNodePtr node, int idx[], double val[], int max) // {{{
+{
+  int num = 0;
+  for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+    if (attr->type != XML_ATTRIBUTE_NODE) {
+      continue;
+    } else if (num >= max) {
+      return 0;
+    }
+    const xmlChar *value = simple_value(attr);
+    idx[num] = (value) ? _xmlcairo_parse_set_attr(attr->name, value, &val[num]) : -2;
+    if (idx[num] < 0) {
+      return 0;
+    }
+    num++;
+  }
+  return 1;
+}
+// }}}
+
+static void optimize_set(struct _optimize_state_t *st, xmlNodePtr node) // {{{
+{
+  int idx[XMLCAIRO_NUM_SET_ATTRS];
+  double val[XMLCAIRO_NUM_SET_ATTRS];
+  if (!parse_set(node, idx, val, XMLCAIRO_NUM_SET_ATTRS)) {
+    consume(st, 0);  // (error: keep as is, forget what was known)
+    for (int i = 0; i < XMLCAIRO_NUM_SET_ATTRS; i++) {
+      st->known[i] = NAN;
+    }
+    st->last_set = NULL;
+    return;
+  }
+
+  xmlAttrPtr attr = node->properties, next;
+  for (int i = 0; attr; attr = next) {
+    next = attr->next;
+    if (attr->type != XML_ATTRIBUTE_NODE) {
+      continue;
+    }
+    const int k = idx[i];
+    const double v = val[i++];
+    if (st->known[k] == v) {
+      xmlRemoveProp(attr);  // (no-op)
+      st->report->removed_set_attrs++;
+      continue;
+    }
+    if (st->pending[k]) {
+      remove_set_attr(st, st->pending[k]);  // (overridden before use)
+    }
+    st->known[k] = v;
+    st->pending[k] = attr;
+  }
+  if (!has_attrs(node)) {
+    remove_node(st, node);  // (keeps st->last_set: still directly preceding)
+    st->report->removed_sets++;
+    return;
+  }
+
+  // merge into directly preceding <set> (nothing used its pending values in between, so names are distinct)
+  if (st->last_set) {
+    for (attr = node->properties; attr; attr = next) {
+      next = attr->next;
+      const int k = _xmlcairo_parse_set_attr(attr->name, simple_value(attr), &val[0]);
+      st->pending[k] = xmlSetProp(st->last_set, attr->name, simple_value(attr));
+    }
+    remove_node(st, node);
+    st->report->merged_sets++;
+    return;
+  }
+  st->last_set = node;
+}
+// }}}
+
+static int is_path_elem(const xmlChar *name) // {{{ replaces the current path
+{
+  return strEqual(name, "path") || strEqual(name, "rect") || strEqual(name, "circle") || strEqual(name, "ellipse") ||
+         strEqual(name, "polygon") || strEqual(name, "rects") || strEqual(name, "circles");
+}
+// }}}
+
+static int is_rgb_source(xmlNodePtr node) // {{{ <set-source r g b [a]>, all valid
+{
+  int seen = 0;
+  for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+    if (attr->type != XML_ATTRIBUTE_NODE) {
+      continue;
+    }
+    const xmlChar *value = simple_value(attr);
+    if (!value || !attr->name[0] || attr->name[1]) {
+      return 0;
+    }
+    const char *pos = strchr("rgba", attr->name[0]);
+    if (!pos) {
+      return 0;
+    }
+    char *end;
+    const double val = strtod((const char *)value, &end);
+    if (*end || isnan(val)) {
+      return 0;
+    }
+    seen |= 1 << (pos - "rgba");
+  }
+  return (seen & 0x07) == 0x07;
+}
+// }}}
+
+static int is_flattenable_sub(xmlNodePtr node) // {{{ no transform, no state changes
+{
+  if (has_attrs(node)) {
+    return 0;
+  }
+  for (xmlNodePtr child = node->children; child; child = child->next) {
+    if (child->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+    const xmlChar *name = child->name;
+    if (!is_path_elem(name) && !strEqual(name, "fill") && !strEqual(name, "stroke") &&
+        !strEqual(name, "paint") && !strEqual(name, "mask") && !strEqual(name, "text") &&
+        !strEqual(name, "labels") && !strEqual(name, "sub") && !strEqual(name, "use") && !strEqual(name, "instances")) {
+      return 0;  // (<set>, <set-source>, <dash>, <clip>, <reset-clip>, <show-page>, unknown, ...)
+    }
+  }
+  return 1;
+}
+// }}}
+
+static void optimize_list(struct _optimize_state_t *st, xmlNodePtr node);
+
+static void optimize_sub(struct _optimize_state_t *st, xmlNodePtr node) // {{{
+{
+  struct _optimize_state_t child = {
+    .head = node->children,
+    .report = st->report
+  };
+  memcpy(child.known, st->known, sizeof(child.known));
+  optimize_list(&child, node->children);
+
+  int has_elements = 0;
+  for (xmlNodePtr cur = node->children; cur && !has_elements; cur = cur->next) {
+    has_elements = (cur->type == XML_ELEMENT_NODE);
+  }
+  if (!has_elements) {
+    remove_node(st, node);
+    st->report->removed_subs++;
+    return;
+  }
+
+  consume(st, 1);
+
+  if (is_flattenable_sub(node)) {
+    if (node == st->head) {
+      st->head = node->children;
+    }
+    xmlNodePtr next;
+    for (xmlNodePtr cur = node->children; cur; cur = next) {
+      next = cur->next;
+      xmlUnlinkNode(cur);
+      xmlAddPrevSibling(node, cur);  // (text nodes might get merged)
+    }
+    remove_node(st, node);
+    st->report->flattened_subs++;
+  }
+}
+// }}}
+
+static void optimize_list(struct _optimize_state_t *st, xmlNodePtr node) // {{{
+{
+  xmlNodePtr next;
+  for (; node; node = next) {
+    next = node->next;
+    if (node->type != XML_ELEMENT_NODE) {
+      continue;
+    }
+
+    const xmlChar *name = node->name;
+    if (strEqual(name, "set")) {
+      optimize_set(st, node);
+      continue;
+    }
+    st->last_set = NULL;
+
+    if (strEqual(name, "set-source")) {
+      if (st->pending_source && is_rgb_source(node)) {
+        remove_node(st, st->pending_source);  // (overridden before use)
+        st->report->removed_sources++;
+      }
+      st->pending_source = node;
+
+    } else if (is_path_elem(name)) {
+      st->pending[XMLCAIRO_SET_TOLERANCE] = NULL;  // (arcs)
+
+    } else if (strEqual(name, "dash") || strEqual(name, "reset-clip") ||
+               strEqual(name, "linear-gradient") || strEqual(name, "radial-gradient") || strEqual(name, "surface-pattern")) {
+      // (uses no <set> state / source)
+
+    } else if (strEqual(name, "clip")) {
+      consume(st, 0);
+
+    } else if (strEqual(name, "sub")) {
+      optimize_sub(st, node);
+
+    } else {  // <fill>, <stroke>, <paint>, <mask>, <text>, <show-page>, unknown, ...
+      consume(st, 1);
+    }
+  }
+  end_of_list(st);
+}
+// }}}
+
+xmlNodePtr xmlcairo_optimize_list(xmlNodePtr insns, xmlcairo_optimize_report_t *report) // {{{
+{
+  xmlcairo_optimize_report_t dummy;
+  if (!report) {
+    report = &dummy;
+  }
+  memset(report, 0, sizeof(*report));
+
+  struct _optimize_state_t st = {
+    .head = insns,
+    .report = report
+  };
+  memcpy(st.known, set_defaults, sizeof(st.known));
+  optimize_list(&st, insns);
+
+  return st.head;
+}
+// }}}
+
@@ -0,0 +1,163 @@
+#include "xmlcairo-int.h"
+#include "xmlcairo.h"
+#include <cairo.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Pixel buffers of image surfaces, kept per size class (4 per power of two, i.e. at most 25% slack)
+// after their surface is destroyed, so e.g. a daemon rendering one 4K canvas after the other reuses
+// already faulted-in memory instead of mmap()ing / munmap()ing it for every job.
+
+#define POOL_MIN_SHIFT 12  // class 0: up to 4 KiB
+#define POOL_MAX_SHIFT 40  // larger buffers are never pooled
+#define POOL_NUM_CLASSES (1 + 4 * (POOL_MAX_SHIFT - POOL_MIN_SHIFT))
+#define POOL_DEFAULT_LIMIT (256ul << 20)
+
+static struct {
+  pthread_mutex_t lock;
+  void *free[POOL_NUM_CLASSES];  // singly linked through the first pointer of each unused buffer
+  unsigned long cached, limit;   // (bytes)
+} pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .limit = POOL_DEFAULT_LIMIT
+};
+
+struct _pool_buffer {
+  void *data;
+  size_t size;
+};
+
+static const cairo_user_data_key_t pool_key;
+
+static size_t class_size(int idx) // {{{
+{
+  if (idx == 0) {
+    return 1ul << POOL_MIN_SHIFT;
+  }
+  const size_t base = (size_t)1 << (POOL_MIN_SHIFT + (idx - 1) / 4);
+  return base + ((idx - 1) % 4 + 1) * (base / 4);
+}
+// }}}
+
+static int size_class(size_t size, size_t *ret_size) // {{{ -1: not pooled
+{
+  if (size <= (1ul << POOL_MIN_SHIFT)) {
+    *ret_size = 1ul << POOL_MIN_SHIFT;
+    return 0;
+  }
+  const int shift = 63 - __builtin_clzll(size - 1);  // 2^shift < size <= 2^(shift+1)
+  if (shift >= POOL_MAX_SHIFT) {
+    *ret_size = size;
+    return -1;
+  }
+  const size_t base = (size_t)1 << shift, step = base / 4;
+  const size_t k = (size - base + step - 1) / step;  // 1 .. 4
+  *ret_size = base + k * step;
+  return 1 + 4 * (shift - POOL_MIN_SHIFT) + (k - 1);
+}
+// }}}
+
+static void *pool_get(size_t size) // {{{ zeroed
+{
+  size_t csize;
+  const int idx = size_class(size, &csize);
+  if (idx >= 0) {
+    pthread_mutex_lock(&pool.lock);
+    void *ret = pool.free[idx];
+    if (ret) {
+      pool.free[idx] = *(void **)ret;
+      pool.cached -= csize;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    if (ret) {
+      memset(ret, 0, size);  // (rest of csize is never used)
+      return ret;
+    }
+  }
+  return calloc(1, csize);  // (fresh pages are zero anyway)
+}
+// }}}
+
+static void pool_put(void *data, size_t size) // {{{
+{
+  size_t csize;
+  const int idx = size_class(size, &csize);
+  if (idx >= 0) {
+    pthread_mutex_lock(&pool.lock);
+    const int keep = (pool.cached + csize <= pool.limit);
+    if (keep) {
+      *(void **)data = pool.free[idx];
+      pool.free[idx] = data;
+      pool.cached += csize;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    if (keep) {
+      return;
+    }
+  }
+  free(data);
+}
+// }}}
+
+static void pool_release(void *user) // {{{ cairo_destroy_func_t: surface is gone
+{
+  struct _pool_buffer *buf = (struct _pool_buffer *)user;
+  pool_put(buf->data, buf->size);
+  free(buf);
+}
+// }}}
+
+cairo_surface_t *_xmlcairo_pool_image_create(cairo_format_t format, int width, int height) // {{{
+{
+  const int stride = cairo_format_stride_for_width(format, width);
+  if (stride <= 0 || height <= 0) {
+    return cairo_image_surface_create(format, width, height);  // (error / empty surface)
+  }
+
+  struct _pool_buffer *buf = malloc(sizeof(struct _pool_buffer));
+  if (!buf) {
+    return cairo_image_surface_create(format, width, height);
+  }
+  buf->size = (size_t)stride * height;
+  buf->data = pool_get(buf->size);
+  if (!buf->data) {
+    free(buf);
+    return cairo_image_surface_create(format, width, height);  // (will most likely fail, too)
+  }
+
+  cairo_surface_t *ret = cairo_image_surface_create_for_data(buf->data, format, width, height, stride);
+  if (cairo_surface_set_user_data(ret, &pool_key, buf, pool_release) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(ret);  // (error surface, or nil)
+    pool_release(buf);
+    return cairo_image_surface_create(format, width, height);
+  }
+  return ret;
+}
+// }}}
+
+void xmlcairo_set_image_pool_limit(unsigned long bytes) // {{{
+{
+  void *release = NULL;  // (freed outside of the lock)
+  pthread_mutex_lock(&pool.lock);
+  pool.limit = bytes;
+  for (int i = POOL_NUM_CLASSES - 1; i >= 0 && pool.cached > pool.limit; i--) {  // (largest first)
+    const size_t csize = class_size(i);
+    while (pool.free[i] && pool.cached > pool.limit) {
+      void *data = pool.free[i];
+      pool.free[i] = *(void **)data;
+      pool.cached -= csize;
+      *(void **)data = release;
+      release = data;
+    }
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  while (release) {
+    void *next = *(void **)release;
+    free(release);
+    release = next;
+  }
+}
+// }}}
+
@@ -0,0 +1,23 @@
+#pragma once
+
+// USDT / SDT static probes (provider "xmlcairo"), enabled by: make WITH_SDT=1  (needs <sys/sdt.h>, e.g. systemtap-sdt-dev)
+// compiled-in probes are a single nop until attached, e.g.:
+//   bpftrace -e 'usdt:./xmlcairo:xmlcairo:element__start { @[str(arg0)] = count(); }'
+//   perf probe -x ./xmlcairo sdt_xmlcairo:path__parse__done
+//
+// element__start(const char *name)            element__done(const char *name, int res)
+// path__parse__start(const char *d)           path__parse__done(const char *d, int res)
+// glyphs__start(const char *str, int len)     glyphs__done(const char *str, int num_glyphs)
+// kern__lookup(unsigned first, unsigned second, int value)   (raw: font units, or 26.6 pixels for legacy 'kern' w/o fast cmap)
+// write(const void *data, unsigned int length, int res)
+
+#ifdef WITH_SDT
+#include <sys/sdt.h>
+#define XMLCAIRO_PROBE1(name, a1) DTRACE_PROBE1(xmlcairo, name, a1)
+#define XMLCAIRO_PROBE2(name, a1, a2) DTRACE_PROBE2(xmlcairo, name, a1, a2)
+#define XMLCAIRO_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(xmlcairo, name, a1, a2, a3)
+#else
+#define XMLCAIRO_PROBE1(name, a1) do { } while (0)
+#define XMLCAIRO_PROBE2(name, a1, a2) do { } while (0)
+#define XMLCAIRO_PROBE3(name, a1, a2, a3) do { } while (0)
+#endif
@@ -0,0 +1,221 @@
+#include "xmlcairo-int.h"
+#include "xmlcairo.h"
+#include "xmlcairo-mem.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// log-scale histogram: 4 sub-buckets per power of 2 (of ns)
+#define STATS_SUB_BITS 2
+#define STATS_NUM_BUCKETS (64 << STATS_SUB_BITS)
+
+struct _xmlcairo_stats_slot {
+  xmlcairo_stats_kind_t kind;
+  char *name;
+  unsigned long count;
+  unsigned long long total_ns, max_ns;
+  unsigned int buckets[STATS_NUM_BUCKETS];
+};
+
+struct _xmlcairo_stats_t {
+  struct _xmlcairo_stats_slot **slots;
+  int num_slots, size_slots;
+
+  xmlcairo_memory_t memory;
+};
+
+unsigned long long _xmlcairo_stats_now() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+// }}}
+
+static int bucket_index(unsigned long long ns) // {{{
+{
+  if (ns < (1 << STATS_SUB_BITS)) {
+    return ns;
+  }
+  const int e = 63 - __builtin_clzll(ns);  // >= STATS_SUB_BITS
+  const int m = (ns >> (e - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1);
+  return ((e - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + m;
+}
+// }}}
+
+// lower bound (in ns) of bucket idx
+static double bucket_low(int idx) // {{{
+{
+  if (idx < (1 << STATS_SUB_BITS)) {
+    return idx;
+  }
+  const int e = (idx >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+  const int m = idx & ((1 << STATS_SUB_BITS) - 1);
+  return ldexp((1 << STATS_SUB_BITS) + m, e - STATS_SUB_BITS);
+}
+// }}}
+
+xmlcairo_stats_t *xmlcairo_stats_create() // {{{
+{
+  return calloc(1, sizeof(xmlcairo_stats_t));
+}
+// }}}
+
+void xmlcairo_stats_reset(xmlcairo_stats_t *stats) // {{{
+{
+  if (!stats) {
+    return;
+  }
+  for (int i = 0; i < stats->num_slots; i++) {
+    free(stats->slots[i]->name);
+    free(stats->slots[i]);
+  }
+  stats->num_slots = 0;
+  memset(&stats->memory, 0, sizeof(stats->memory));
+}
+// }}}
+
+void xmlcairo_stats_destroy(xmlcairo_stats_t *stats) // {{{
+{
+  if (!stats) {
+    return;
+  }
+  xmlcairo_stats_reset(stats);
+  free(stats->slots);
+  free(stats);
+}
+// }}}
+
+void xmlcairo_surface_set_stats(xmlcairo_surface_t *surface, xmlcairo_stats_t *stats) // {{{
+{
+  if (surface) {
+    surface->stats = stats;
+  }
+}
+// }}}
+
+// NULL on allocation failure
+static struct _xmlcairo_stats_slot *get_slot(xmlcairo_stats_t *stats, xmlcairo_stats_kind_t kind, const char *name) // {{{
+{
+  // (few distinct names: linear search is good enough)
+  for (int i = 0; i < stats->num_slots; i++) {
+    struct _xmlcairo_stats_slot *slot = stats->slots[i];
+    if (slot->kind == kind && strcmp(slot->name, name) == 0) {
+      return slot;
+    }
+  }
+
+  if (stats->num_slots >= stats->size_slots) {
+    const int new_size = stats->size_slots ? 2 * stats->size_slots : 32;
+    struct _xmlcairo_stats_slot **tmp = realloc(stats->slots, new_size * sizeof(*tmp));
+    if (!tmp) {
+      return NULL;
+    }
+    stats->slots = tmp;
+    stats->size_slots = new_size;
+  }
+
+  struct _xmlcairo_stats_slot *slot = calloc(1, sizeof(struct _xmlcairo_stats_slot));
+  if (!slot) {
+    return NULL;
+  }
+  slot->kind = kind;
+  slot->name = strdup(name);
+  if (!slot->name) {
+    free(slot);
+    return NULL;
+  }
+
+  stats->slots[stats->num_slots++] = slot;
+  return slot;
+}
+// }}}
+
+void _xmlcairo_stats_add(xmlcairo_stats_t *stats, int kind, const char *name, unsigned long long ns) // {{{
+{
+  struct _xmlcairo_stats_slot *slot = get_slot(stats, kind, name ? name : "");
+  if (!slot) {
+    return;  // (profiling is best effort)
+  }
+  slot->count++;
+  slot->total_ns += ns;
+  if (ns > slot->max_ns) {
+    slot->max_ns = ns;
+  }
+  slot->buckets[bucket_index(ns)]++;
+}
+// }}}
+
+int xmlcairo_stats_get_num_entries(const xmlcairo_stats_t *stats) // {{{
+{
+  return stats ? stats->num_slots : 0;
+}
+// }}}
+
+// in ns, midpoint of bucket containing the q-quantile
+static double slot_quantile(const struct _xmlcairo_stats_slot *slot, double q) // {{{
+{
+  if (!slot->count) {
+    return 0.0;
+  }
+  const unsigned long rank = (unsigned long)ceil(q * slot->count);
+  unsigned long sum = 0;
+  for (int i = 0; i < STATS_NUM_BUCKETS; i++) {
+    sum += slot->buckets[i];
+    if (sum >= rank) {
+      const double ret = (bucket_low(i) + bucket_low(i + 1)) / 2;
+      return (ret > slot->max_ns) ? slot->max_ns : ret;
+    }
+  }
+  return slot->max_ns;
+}
+// }}}
+
+int xmlcairo_stats_get_entry(const xmlcairo_stats_t *stats, int idx, xmlcairo_stats_entry_t *ret) // {{{
+{
+  if (!stats || !ret || idx < 0 || idx >= stats->num_slots) {
+    return -1;
+  }
+
+  const struct _xmlcairo_stats_slot *slot = stats->slots[idx];
+  ret->kind = slot->kind;
+  ret->name = slot->name;
+  ret->count = slot->count;
+  ret->total_ms = slot->total_ns / 1e6;
+  ret->p50_ms = slot_quantile(slot, 0.50) / 1e6;
+  ret->p99_ms = slot_quantile(slot, 0.99) / 1e6;
+  ret->max_ms = slot->max_ns / 1e6;
+
+  return 0;
+}
+// }}}
+
+void _xmlcairo_stats_memory(xmlcairo_stats_t *stats, const struct _xmlcairo_mem_t *mem) // {{{
+{
+  if (!mem) {
+    return;
+  }
+  for (int i = 0; i < XMLCAIRO_MEMORY_NUM_KINDS; i++) {
+    const unsigned long long peak = __atomic_load_n(&mem->peak[i], __ATOMIC_RELAXED);
+    if (peak > stats->memory.peak[i]) {
+      stats->memory.peak[i] = peak;
+    }
+  }
+  const unsigned long long peak = __atomic_load_n(&mem->peak_total, __ATOMIC_RELAXED);
+  if (peak > stats->memory.peak_total) {
+    stats->memory.peak_total = peak;
+  }
+}
+// }}}
+
+int xmlcairo_stats_get_memory(const xmlcairo_stats_t *stats, xmlcairo_memory_t *ret) // {{{
+{
+  if (!stats || !ret) {
+    return -1;
+  }
+  *ret = stats->memory;
+  return 0;
+}
+// }}}
+
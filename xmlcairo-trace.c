@@ -0,0 +1,180 @@
+#include "xmlcairo-int.h"
+#include "xmlcairo.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libxml/xmlIO.h>
+
+// Chrome trace event format (JSON array), loads in chrome://tracing and Perfetto.
+
+struct _xmlcairo_trace_t {
+  pthread_mutex_t lock;
+  xmlOutputBufferPtr obuf;
+  unsigned long long start_ns;
+  int num_events;
+};
+
+static int next_tid;
+static __thread int trace_tid;  // 0: not yet assigned
+
+xmlcairo_trace_t *xmlcairo_trace_create(const char *filename) // {{{
+{
+  if (!filename) {
+    return NULL;
+  }
+
+  xmlcairo_trace_t *ret = calloc(1, sizeof(xmlcairo_trace_t));
+  if (!ret) {
+    return NULL;
+  }
+
+  ret->obuf = xmlOutputBufferCreateFilename(filename, NULL, 0);
+  if (!ret->obuf) {
+    free(ret);
+    return NULL;
+  }
+  if (pthread_mutex_init(&ret->lock, NULL) != 0) {
+    xmlOutputBufferClose(ret->obuf);
+    free(ret);
+    return NULL;
+  }
+
+  ret->start_ns = _xmlcairo_stats_now();
+  xmlOutputBufferWriteString(ret->obuf, "[\n");
+
+  return ret;
+}
+// }}}
+
+int xmlcairo_trace_destroy(xmlcairo_trace_t *trace) // {{{
+{
+  if (!trace) {
+    return -1;
+  }
+
+  xmlOutputBufferWriteString(trace->obuf, "\n]\n");
+  const int res = xmlOutputBufferClose(trace->obuf);
+
+  pthread_mutex_destroy(&trace->lock);
+  free(trace);
+  return (res < 0) ? -1 : 0;
+}
+// }}}
+
+void xmlcairo_surface_set_trace(xmlcairo_surface_t *surface, xmlcairo_trace_t *trace) // {{{
+{
+  if (surface) {
+    surface->trace = trace;
+  }
+}
+// }}}
+
+static void write_json_string(xmlOutputBufferPtr obuf, const char *str) // {{{
+{
+  xmlOutputBufferWrite(obuf, 1, "\"");
+  const char *cur = str;
+  while (*cur) {
+    const size_t len = strcspn(cur, "\"\\\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+                                    "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+    xmlOutputBufferWrite(obuf, len, cur);
+    cur += len;
+    if (!*cur) {
+      break;
+    }
+    char tmp[8];
+    if (*cur == '"' || *cur == '\\') {
+      snprintf(tmp, sizeof(tmp), "\\%c", *cur);
+    } else {
+      snprintf(tmp, sizeof(tmp), "\\u%04x", (unsigned char)*cur);
+    }
+    xmlOutputBufferWriteString(obuf, tmp);
+    cur++;
+  }
+  xmlOutputBufferWrite(obuf, 1, "\"");
+}
+// }}}
+
+// ph: 'X' (complete, needs dur_ns), 'B', 'E'
+// ap: NULL-terminated list of (const char *key, const char *value) pairs
+static void trace_event(xmlcairo_trace_t *trace, char ph, const char *cat, const char *name, unsigned long long start_ns, unsigned long long dur_ns, va_list ap) // {{{
+{
+  if (!trace_tid) {
+    trace_tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);  // (per thread, same in all traces)
+  }
+
+  pthread_mutex_lock(&trace->lock);
+  xmlOutputBufferPtr obuf = trace->obuf;
+  char tmp[128];
+  snprintf(tmp, sizeof(tmp), "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+           (trace->num_events++) ? ",\n" : "", ph, trace_tid, (start_ns - trace->start_ns) / 1e3);
+  xmlOutputBufferWriteString(obuf, tmp);
+  if (ph == 'X') {
+    snprintf(tmp, sizeof(tmp), ",\"dur\":%.3f", dur_ns / 1e3);
+    xmlOutputBufferWriteString(obuf, tmp);
+  }
+  if (cat) {
+    xmlOutputBufferWriteString(obuf, ",\"cat\":");
+    write_json_string(obuf, cat);
+  }
+  if (name) {
+    xmlOutputBufferWriteString(obuf, ",\"name\":");
+    write_json_string(obuf, name);
+  }
+
+  const char *key = va_arg(ap, const char *);
+  if (key) {
+    xmlOutputBufferWriteString(obuf, ",\"args\":{");
+    for (int first = 1; key; key = va_arg(ap, const char *), first = 0) {
+      const char *value = va_arg(ap, const char *);
+      if (!first) {
+        xmlOutputBufferWrite(obuf, 1, ",");
+      }
+      write_json_string(obuf, key);
+      xmlOutputBufferWrite(obuf, 1, ":");
+      write_json_string(obuf, value ? value : "");
+    }
+    xmlOutputBufferWrite(obuf, 1, "}");
+  }
+  xmlOutputBufferWrite(obuf, 1, "}");
+
+  pthread_mutex_unlock(&trace->lock);
+}
+// }}}
+
+void _xmlcairo_trace_complete(xmlcairo_trace_t *trace, const char *cat, const char *name, unsigned long long start_ns, ...) // {{{
+{
+  const unsigned long long end_ns = _xmlcairo_stats_now();
+  va_list ap;
+  va_start(ap, start_ns);
+  trace_event(trace, 'X', cat, name, start_ns, end_ns - start_ns, ap);
+  va_end(ap);
+}
+// }}}
+
+static void trace_event_now(xmlcairo_trace_t *trace, char ph, const char *cat, const char *name, ...) // {{{
+{
+  va_list ap;
+  va_start(ap, name);
+  trace_event(trace, ph, cat, name, _xmlcairo_stats_now(), 0, ap);
+  va_end(ap);
+}
+// }}}
+
+void xmlcairo_trace_begin(xmlcairo_trace_t *trace, const char *name) // {{{
+{
+  if (trace) {
+    trace_event_now(trace, 'B', "user", name, NULL);
+  }
+}
+// }}}
+
+void xmlcairo_trace_end(xmlcairo_trace_t *trace) // {{{
+{
+  if (trace) {
+    trace_event_now(trace, 'E', NULL, NULL, NULL);
+  }
+}
+// }}}
+
@@ -0,0 +1,143 @@
+#include "xmlcairo-xslt.h"
+#include <cairo.h>
+#include <stdlib.h>
+#include <libxml/tree.h>
+#include <libxslt/xsltInternals.h>
+#include <libxslt/extensions.h>
+#include <libxslt/transform.h>
+#include <libxslt/templates.h>
+#include <libxslt/security.h>
+#include <libxslt/xsltutils.h>
+
+#if __has_attribute(unused)
+#define UNUSED __attribute__((unused))
+#else
+#define UNUSED
+#endif
+
+// per transformation context (xsltGetExtData)
+struct _xmlcairo_xslt_t {
+  xmlcairo_xslt_prepare_func prepare;
+  void *user;
+};
+
+static void *xslt_init(xsltTransformContextPtr ctxt UNUSED, const xmlChar *URI UNUSED) // {{{
+{
+  return calloc(1, sizeof(struct _xmlcairo_xslt_t));
+}
+// }}}
+
+static void xslt_shutdown(xsltTransformContextPtr ctxt UNUSED, const xmlChar *URI UNUSED, void *data) // {{{
+{
+  free(data);
+}
+// }}}
+
+// reports and stops the transformation
+static void render_error(xsltTransformContextPtr ctxt, xmlNodePtr inst, const char *msg, const xmlChar *output) // {{{
+{
+  xsltTransformError(ctxt, NULL, inst, "xc:render: %s%s\n", msg, (output) ? (const char *)output : "");
+  ctxt->state = XSLT_STATE_STOPPED;
+}
+// }}}
+
+// NULL when content does not instantiate to a single <surface> element (text: only whitespace)
+static xmlNodePtr get_surface(xmlDocPtr container) // {{{
+{
+  xmlNodePtr ret = NULL;
+  for (xmlNodePtr cur = container->children; cur; cur = cur->next) {
+    if (cur->type == XML_ELEMENT_NODE) {
+      if (ret || cur->ns || !xmlStrEqual(cur->name, (const xmlChar *)"surface")) {
+        return NULL;
+      }
+      ret = cur;
+    } else if (cur->type == XML_TEXT_NODE && !xmlIsBlankNode(cur)) {
+      return NULL;
+    }
+  }
+  return ret;
+}
+// }}}
+
+static void render_elem(xsltTransformContextPtr ctxt, xmlNodePtr node, xmlNodePtr inst, xsltElemPreCompPtr comp UNUSED) // {{{
+{
+  if (!ctxt || !node || !inst) {
+    return;
+  }
+
+  xmlChar *output = xsltEvalAttrValueTemplate(ctxt, inst, (const xmlChar *)"output", NULL);
+  if (!output) {
+    render_error(ctxt, inst, "output=\"...\" is required", NULL);
+    return;
+  } else if (xsltCheckWrite(ctxt->sec, ctxt, output) != 1) {
+    render_error(ctxt, inst, "writing is forbidden: ", output);
+    xmlFree(output);
+    return;
+  }
+
+  xmlDocPtr container = xsltCreateRVT(ctxt);
+  if (!container) {
+    render_error(ctxt, inst, "out of memory for ", output);
+    xmlFree(output);
+    return;
+  }
+  xmlNodePtr insert = ctxt->insert;
+  ctxt->insert = (xmlNodePtr)container;
+  xsltApplyOneTemplate(ctxt, node, inst->children, NULL, NULL);
+  ctxt->insert = insert;
+
+  xmlNodePtr root = get_surface(container);
+  if (ctxt->state != XSLT_STATE_OK) {
+    // (already reported)
+  } else if (!root) {
+    render_error(ctxt, inst, "content must be a single <surface> element, for ", output);
+  } else {
+    xmlcairo_surface_t *surface = xmlcairo_surface_create_from_node(root, (const char *)output);
+    if (!surface) {
+      render_error(ctxt, inst, "could not create surface ", output);
+    } else {
+      const struct _xmlcairo_xslt_t *data = xsltGetExtData(ctxt, (const xmlChar *)XMLCAIRO_XSLT_NAMESPACE);
+      cairo_status_t status = CAIRO_STATUS_SUCCESS;
+      if (data && data->prepare && data->prepare(surface, (const char *)output, data->user) != 0) {
+        render_error(ctxt, inst, "preparing failed: ", output);
+      } else {
+        status = xmlcairo_apply_list(surface, root->children);
+      }
+      const cairo_status_t dstatus = xmlcairo_surface_destroy(surface);  // (writes the output)
+      if (status == CAIRO_STATUS_SUCCESS) {
+        status = dstatus;
+      }
+      if (status != CAIRO_STATUS_SUCCESS && ctxt->state == XSLT_STATE_OK) {
+        xsltTransformError(ctxt, NULL, inst, "xc:render: %s: %s\n", output, cairo_status_to_string(status));
+        ctxt->state = XSLT_STATE_STOPPED;
+      }
+    }
+  }
+
+  xsltReleaseRVT(ctxt, container);
+  xmlFree(output);
+}
+// }}}
+
+int xmlcairo_xslt_register() // {{{
+{
+  const xmlChar *ns = (const xmlChar *)XMLCAIRO_XSLT_NAMESPACE;
+  if (xsltRegisterExtModule(ns, xslt_init, xslt_shutdown) != 0 ||
+      xsltRegisterExtModuleElement((const xmlChar *)"render", ns, NULL, render_elem) != 0) {
+    return -1;
+  }
+  return 0;
+}
+// }}}
+
+int xmlcairo_xslt_set_prepare(xsltTransformContextPtr ctxt, xmlcairo_xslt_prepare_func prepare, void *user) // {{{
+{
+  struct _xmlcairo_xslt_t *data = (ctxt) ? xsltGetExtData(ctxt, (const xmlChar *)XMLCAIRO_XSLT_NAMESPACE) : NULL;
+  if (!data) {
+    return -1;
+  }
+  data->prepare = prepare;
+  data->user = user;
+  return 0;
+}
+// }}}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "xmlcairo.h"
+
+// ... #include <libxslt/xsltInternals.h>
+typedef struct _xsltTransformContext xsltTransformContext;
+typedef xsltTransformContext *xsltTransformContextPtr;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XMLCAIRO_XSLT_NAMESPACE "urn:xmlcairo"
+
+// registers the extension element <xc:render output="..."> (xmlns:xc="urn:xmlcairo", extension-element-prefixes="xc")
+// for all stylesheets: its content is instantiated into a result tree fragment, whose <surface> element is then
+// rendered in-process (xmlcairo_surface_create_from_node(), xmlcairo_apply_list()) to output, i.e. without
+// serializing and re-parsing. output is an attribute value template, subject to the xsltSecurityPrefs write checks.
+// Any error stops the transformation (xsltApplyStylesheet*() returns NULL). Returns 0 on success
+int xmlcairo_xslt_register();
+
+// called for every <xc:render> surface before anything is drawn, e.g. to load fonts and images (xmlcairo_load_*());
+// non-zero return: error
+typedef int (*xmlcairo_xslt_prepare_func)(xmlcairo_surface_t *surface, const char *output, void *user);
+
+// per transformation (before xsltApplyStylesheetUser()); returns 0 on success, -1 when not registered
+int xmlcairo_xslt_set_prepare(xsltTransformContextPtr ctxt, xmlcairo_xslt_prepare_func prepare, void *user);
+
+#ifdef __cplusplus
+};
+#endif
@@ -4,7 +4,19 @@
 #include <string.h>  // memcpy()
 //#include <assert.h>
 #include <libxml/xmlIO.h>
+#include <libxml/tree.h>
+#include <stdio.h>  // fprintf()
+#include <math.h>  // ceil()
+#include <stdlib.h>
+#include <fcntl.h>  // open()
+#include <unistd.h>  // close()
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "ftfont-cairo.h"
+#include "xmlcairo-probes.h"
+#include "xmlcairo-damage.h"
+#include "xmlcairo-cull.h"
+#include "xmlcairo-mem.h"
 
 #if __has_attribute(unused)
 #define UNUSED __attribute__((unused))
@@ -62,7 +74,9 @@ static cairo_status_t xmlioCairoWriteFunc(void *closure, const unsigned char *da
 {
   xmlOutputBufferPtr obuf = (xmlOutputBufferPtr)closure;
 
-  if (xmlOutputBufferWrite(obuf, length, (const char *)data) < 0) {
+  const int res = xmlOutputBufferWrite(obuf, length, (const char *)data);
+  XMLCAIRO_PROBE3(write, data, length, res);
+  if (res < 0) {
     return CAIRO_STATUS_WRITE_ERROR;
   }
   return CAIRO_STATUS_SUCCESS;
@@ -76,6 +90,18 @@ static void hash_free_imgs(void *entry, const xmlChar *name UNUSED) // {{{
 }
 // }}}
 
+static void hash_free_binaries(void *entry, const xmlChar *name UNUSED) // {{{
+{
+  struct _xmlcairo_binary_t *bin = (struct _xmlcairo_binary_t *)entry;
+  if (bin->mapped) {
+    munmap((void *)bin->data, bin->len);
+  } else {
+    free((void *)bin->data);
+  }
+  free(bin);
+}
+// }}}
+
 
 static xmlcairo_surface_t *_xmlcairo_surface_alloc() // {{{
 {
@@ -102,6 +128,92 @@ static xmlcairo_surface_t *_xmlcairo_surface_alloc() // {{{
     return NULL;
   }
 
+  ret->symbols = xmlHashCreate(32);
+  if (!ret->symbols) {
+    xmlHashFree(ret->imgs, hash_free_imgs);
+    xmlHashFree(ret->fontfiles, NULL);
+    xmlHashFree(ret->fonts, NULL);
+    free(ret);
+    return NULL;
+  }
+
+  ret->patterns = xmlHashCreate(32);
+  if (!ret->patterns) {
+    xmlHashFree(ret->imgs, hash_free_imgs);
+    xmlHashFree(ret->fontfiles, NULL);
+    xmlHashFree(ret->fonts, NULL);
+    xmlHashFree(ret->symbols, NULL);
+    free(ret);
+    return NULL;
+  }
+
+  ret->binaries = xmlHashCreate(32);
+  if (!ret->binaries) {
+    xmlHashFree(ret->imgs, hash_free_imgs);
+    xmlHashFree(ret->fontfiles, NULL);
+    xmlHashFree(ret->fonts, NULL);
+    xmlHashFree(ret->symbols, NULL);
+    xmlHashFree(ret->patterns, NULL);
+    free(ret);
+    return NULL;
+  }
+
+  ret->mem = _xmlcairo_mem_create();
+  if (!ret->mem) {
+    xmlHashFree(ret->imgs, hash_free_imgs);
+    xmlHashFree(ret->fontfiles, NULL);
+    xmlHashFree(ret->fonts, NULL);
+    xmlHashFree(ret->symbols, NULL);
+    xmlHashFree(ret->patterns, NULL);
+    xmlHashFree(ret->binaries, NULL);
+    free(ret);
+    return NULL;
+  }
+
+  return ret;
+}
+// }}}
+
+xmlcairo_surface_t *_xmlcairo_surface_create_worker(const xmlcairo_surface_t *parent) // {{{
+{
+  xmlcairo_surface_t *ret = calloc(1, sizeof(xmlcairo_surface_t));
+  if (!ret) {
+    return NULL;
+  }
+  ret->parent = parent;
+  ret->mem = parent->mem;  // (atomic)
+
+  // (only read by workers)
+  ret->imgs = parent->imgs;
+  ret->binaries = parent->binaries;
+  ret->fontfiles = parent->fontfiles;
+  ret->fonts = parent->fonts;
+
+  if (parent->fmgr) {
+    ret->fmgr = ftfont_cairo_mgr_create();  // (just the glyph scratch buffer; fonts stay with the parent's manager)
+    if (!ret->fmgr) {
+      free(ret);
+      return NULL;
+    }
+  }
+
+  ret->symbols = xmlHashCreate(32);
+  if (!ret->symbols) {
+    _xmlcairo_surface_free(ret);
+    return NULL;
+  }
+
+  ret->patterns = xmlHashCreate(32);
+  if (!ret->patterns) {
+    _xmlcairo_surface_free(ret);
+    return NULL;
+  }
+
+  ret->trace = parent->trace;  // (thread-safe; stats are not)
+  ret->resource_gen = parent->resource_gen;
+  ret->simplify = parent->simplify;
+  ret->cull = (parent->cull) ? _xmlcairo_cull_create(ret->mem) : NULL;  // (NULL: just not culled)
+
   return ret;
 }
 // }}}
@@ -110,13 +222,24 @@ void _xmlcairo_surface_free(xmlcairo_surface_t *surface) // {{{
 {
   // assert(surface);
 
-  xmlHashFree(surface->fonts, NULL);
-  xmlHashFree(surface->fontfiles, NULL);
+  if (!surface->parent) {
+    xmlHashFree(surface->fonts, NULL);
+    xmlHashFree(surface->fontfiles, NULL);
+    xmlHashFree(surface->imgs, hash_free_imgs);
+    xmlHashFree(surface->binaries, hash_free_binaries);
+  }
   if (surface->fmgr) {
     ftfont_cairo_mgr_destroy(surface->fmgr);
   }
 
-  xmlHashFree(surface->imgs, hash_free_imgs);
+  xmlHashFree(surface->symbols, _xmlcairo_symbol_free);
+  xmlHashFree(surface->patterns, _xmlcairo_pattern_free);
+
+  _xmlcairo_damage_destroy(surface->damage);  // (accepts NULL)
+  _xmlcairo_cull_destroy(surface->cull);  // (accepts NULL)
+  if (!surface->parent) {
+    _xmlcairo_mem_destroy(surface->mem);  // (after everything that releases into it)
+  }
 
   free(surface);
 }
@@ -130,10 +253,14 @@ cairo_status_t xmlcairo_surface_destroy(xmlcairo_surface_t *surface) // {{{
 
   cairo_status_t ret = cairo_surface_status(surface->surface);
   if (ret == CAIRO_STATUS_SUCCESS) {
+    const unsigned long long start = (surface->trace) ? _xmlcairo_stats_now() : 0;
     if (cairo_surface_get_type(surface->surface) == CAIRO_SURFACE_TYPE_IMAGE) {
       ret = cairo_surface_write_to_png_stream(surface->surface, xmlioCairoWriteFunc, surface->obuf);
     }
-    cairo_surface_destroy(surface->surface);
+    cairo_surface_destroy(surface->surface);  // (vector surfaces: finish, i.e. emit output)
+    if (surface->trace) {
+      _xmlcairo_trace_complete(surface->trace, "encode", "encode", start, NULL);
+    }
   }
 
   xmlOutputBufferClose(surface->obuf);
@@ -143,6 +270,26 @@ cairo_status_t xmlcairo_surface_destroy(xmlcairo_surface_t *surface) // {{{
 }
 // }}}
 
+void xmlcairo_surface_set_simplify(xmlcairo_surface_t *surface, int enable) // {{{
+{
+  // assert(surface);
+  surface->simplify = !!enable;
+}
+// }}}
+
+int xmlcairo_surface_set_cull(xmlcairo_surface_t *surface, int enable) // {{{
+{
+  // assert(surface);
+  if (!enable) {
+    _xmlcairo_cull_destroy(surface->cull);  // (accepts NULL)
+    surface->cull = NULL;
+  } else if (!surface->cull) {
+    surface->cull = _xmlcairo_cull_create(surface->mem);
+  }
+  return (!enable || surface->cull);
+}
+// }}}
+
 static xmlcairo_surface_t *_xmlcairo_surface_alloc_file(const char *filename) // {{{
 {
   xmlcairo_surface_t *ret = _xmlcairo_surface_alloc();
@@ -190,7 +337,15 @@ xmlcairo_surface_t *xmlcairo_surface_create_png(const char *filename, cairo_form
     return NULL;
   }
 
-  ret->surface = cairo_image_surface_create(format, width, height);
+  // (checked before allocating: e.g. a hostile 30000x30000 canvas)
+  const int stride = cairo_format_stride_for_width(format, width);
+  if (stride > 0 && height > 0 && !_xmlcairo_mem_charge(ret->mem, XMLCAIRO_MEMORY_IMAGES, (unsigned long long)stride * height)) {
+    xmlOutputBufferClose(ret->obuf);  // (no surface yet)
+    _xmlcairo_surface_free(ret);
+    return NULL;
+  }
+
+  ret->surface = _xmlcairo_pool_image_create(format, width, height);
   // assert(ret->surface);
   if (cairo_surface_status(ret->surface) != CAIRO_STATUS_SUCCESS) {
     xmlcairo_surface_destroy(ret);
@@ -269,23 +424,213 @@ xmlcairo_surface_t *xmlcairo_surface_create_script(const char *filename, cairo_c
 // }}}
 #endif
 
+// -- surface factory
+
+#define WARN(s, ...)  fprintf(stderr, "Warning: " s "\n" ,## __VA_ARGS__);
+
+static int get_attr_double(xmlNodePtr node, const char *name, double *ret) // {{{ 0: missing / not positive
+{
+  xmlChar *value = xmlGetNoNsProp(node, (const xmlChar *)name);
+  if (!value) {
+    WARN("<%s %s=\"...\"> is required", node->name, name);
+    return 0;
+  }
+  char *end;
+  *ret = strtod((const char *)value, &end);
+  const int ok = (end != (char *)value && !*end && *ret > 0.0);
+  if (!ok) {
+    WARN("could not parse <%s %s=\"%s\">", node->name, name, value);
+  }
+  xmlFree(value);
+  return ok;
+}
+// }}}
+
+// returns index into names, dflt when attribute is missing, -1 when not known
+static int get_attr_enum(xmlNodePtr node, const char *name, const char *const *names, int num, int dflt) // {{{
+{
+  xmlChar *value = xmlGetNoNsProp(node, (const xmlChar *)name);
+  if (!value) {
+    return dflt;
+  }
+  int ret = -1;
+  for (int i = 0; i < num && ret < 0; i++) {
+    if (xmlStrEqual(value, (const xmlChar *)names[i])) {
+      ret = i;
+    }
+  }
+  if (ret < 0) {
+    WARN("unknown <%s %s=\"%s\">", node->name, name, value);
+  }
+  xmlFree(value);
+  return ret;
+}
+// }}}
+
+xmlcairo_surface_t *xmlcairo_surface_create_from_node(xmlNodePtr node, const char *filename) // {{{
+{
+  static const char *const types[] = { "png", "pdf", "ps", "svg", "script" };
+  static const char *const formats[] = { "argb32", "rgb24", "a8", "a1", "rgb16_565", "rgb30" };
+  static const cairo_format_t format_values[] = {
+    CAIRO_FORMAT_ARGB32, CAIRO_FORMAT_RGB24, CAIRO_FORMAT_A8, CAIRO_FORMAT_A1, CAIRO_FORMAT_RGB16_565, CAIRO_FORMAT_RGB30
+  };
+  static const char *const contents[] = { "color", "alpha", "color-alpha" };
+  static const cairo_content_t content_values[] = {
+    CAIRO_CONTENT_COLOR, CAIRO_CONTENT_ALPHA, CAIRO_CONTENT_COLOR_ALPHA
+  };
+
+  if (!node || !filename) {
+    return NULL;
+  }
+
+  double width, height;
+  const int type = get_attr_enum(node, "type", types, sizeof(types) / sizeof(*types), 0);
+  if (type < 0 || !get_attr_double(node, "width", &width) || !get_attr_double(node, "height", &height)) {
+    return NULL;
+  }
+
+  switch (type) {
+  case 0: {
+    const int format = get_attr_enum(node, "format", formats, sizeof(formats) / sizeof(*formats), 0);
+    if (format < 0) {
+      return NULL;
+    } else if (width > 32767 || height > 32767) {  // (cairo's limit for image surfaces)
+      WARN("<%s width=\"%g\" height=\"%g\"> too large for png", node->name, width, height);
+      return NULL;
+    }
+    return xmlcairo_surface_create_png(filename, format_values[format], (int)ceil(width), (int)ceil(height));
+  }
+  case 1:
+    return xmlcairo_surface_create_pdf(filename, width, height);
+  case 2:
+    return xmlcairo_surface_create_ps(filename, width, height);
+  case 3:
+    return xmlcairo_surface_create_svg(filename, width, height);
+  case 4: {
+    const int content = get_attr_enum(node, "content", contents, sizeof(contents) / sizeof(*contents), 2);
+    if (content < 0) {
+      return NULL;
+    }
+    return xmlcairo_surface_create_script(filename, content_values[content], width, height);
+  }
+  }
+  return NULL;
+}
+// }}}
+
 // --
 
+static unsigned long long image_size(cairo_surface_t *img) // {{{ bytes of the pixel buffer
+{
+  return (unsigned long long)cairo_image_surface_get_stride(img) * cairo_image_surface_get_height(img);
+}
+// }}}
+
 cairo_status_t xmlcairo_load_image(xmlcairo_surface_t *surface, const char *key, const char *filename) // {{{
 {
   if (!surface || !key || !filename) {
     return CAIRO_STATUS_NULL_POINTER;
   }
 
+  const unsigned long long start = (surface->trace) ? _xmlcairo_stats_now() : 0;
   cairo_surface_t *img = _xmlcairo_surface_read_png_file(filename);
+  if (surface->trace) {
+    _xmlcairo_trace_complete(surface->trace, "load", "load_image", start, "key", key, "filename", filename, NULL);
+  }
   if (!img) {
     return CAIRO_STATUS_READ_ERROR;  // TODO?
   }
 
+  // (the decoded image is only accounted after the fact: its size is not known before reading the png)
+  if (!_xmlcairo_mem_charge(surface->mem, XMLCAIRO_MEMORY_IMAGES, image_size(img))) {
+    cairo_surface_destroy(img);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  cairo_surface_t *old = xmlHashLookup(surface->imgs, (const xmlChar *)key);
+  const unsigned long long old_size = (old) ? image_size(old) : 0;
   if (xmlHashUpdateEntry(surface->imgs, (const xmlChar *)key, img, hash_free_imgs) != 0) {
+    _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_IMAGES, image_size(img));
     cairo_surface_destroy(img);
     return CAIRO_STATUS_NO_MEMORY;
   }
+  _xmlcairo_mem_release(surface->mem, XMLCAIRO_MEMORY_IMAGES, old_size);  // (replaced)
+  surface->resource_gen++;
+
+  return CAIRO_STATUS_SUCCESS;
+}
+// }}}
+
+// NULL on error
+static struct _xmlcairo_binary_t *_xmlcairo_read_binary_file(const char *filename) // {{{
+{
+  struct _xmlcairo_binary_t *ret = calloc(1, sizeof(struct _xmlcairo_binary_t));
+  if (!ret) {
+    return NULL;
+  }
+
+  const char *path = (strncmp(filename, "file://", 7) == 0) ? filename + 7 : filename;
+  const int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      ret->len = st.st_size;
+      void *data = (ret->len > 0) ? mmap(NULL, ret->len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+      close(fd);
+      if (data == MAP_FAILED) {
+        free(ret);
+        return NULL;
+      }
+      ret->data = data;
+      ret->mapped = (data != NULL);
+      return ret;
+    }
+    close(fd);
+  }
+
+  // not a local file (e.g. other xmlio scheme): read into memory
+  xmlParserInputBufferPtr ibuf = xmlParserInputBufferCreateFilename(filename, XML_CHAR_ENCODING_NONE);
+  if (!ibuf) {
+    free(ret);
+    return NULL;
+  }
+  int res;
+  while ((res = xmlParserInputBufferRead(ibuf, 65536)) > 0) { }
+  ret->len = xmlBufUse(ibuf->buffer);
+  unsigned char *data = (res == 0 && ret->len > 0) ? malloc(ret->len) : NULL;
+  if (data) {
+    memcpy(data, xmlBufContent(ibuf->buffer), ret->len);
+  }
+  xmlFreeParserInputBuffer(ibuf);
+  if (res < 0 || (ret->len > 0 && !data)) {
+    free(data);
+    free(ret);
+    return NULL;
+  }
+  ret->data = data;
+  return ret;
+}
+// }}}
+
+cairo_status_t xmlcairo_load_binary(xmlcairo_surface_t *surface, const char *key, const char *filename) // {{{
+{
+  if (!surface || !key || !filename) {
+    return CAIRO_STATUS_NULL_POINTER;
+  }
+
+  const unsigned long long start = (surface->trace) ? _xmlcairo_stats_now() : 0;
+  struct _xmlcairo_binary_t *bin = _xmlcairo_read_binary_file(filename);
+  if (surface->trace) {
+    _xmlcairo_trace_complete(surface->trace, "load", "load_binary", start, "key", key, "filename", filename, NULL);
+  }
+  if (!bin) {
+    return CAIRO_STATUS_READ_ERROR;
+  }
+
+  if (xmlHashUpdateEntry(surface->binaries, (const xmlChar *)key, bin, hash_free_binaries) != 0) {
+    hash_free_binaries(bin, NULL);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+  surface->resource_gen++;
 
   return CAIRO_STATUS_SUCCESS;
 }
@@ -306,7 +651,11 @@ cairo_status_t xmlcairo_load_font(xmlcairo_surface_t *surface, const char *key,
 
   ftfont_cairo_font_t *font = xmlHashLookup(surface->fontfiles, (const xmlChar *)filename);
   if (!font) {
+    const unsigned long long start = (surface->trace) ? _xmlcairo_stats_now() : 0;
     font = ftfont_cairo_load(surface->fmgr, filename);
+    if (surface->trace) {
+      _xmlcairo_trace_complete(surface->trace, "load", "load_font", start, "key", key, "filename", filename, NULL);
+    }
     if (!font) {
       return CAIRO_STATUS_NO_MEMORY;  // FIXME? font load failed ...
     }
@@ -319,6 +668,7 @@ cairo_status_t xmlcairo_load_font(xmlcairo_surface_t *surface, const char *key,
   if (xmlHashUpdateEntry(surface->fonts, (const xmlChar *)key, font, NULL) != 0) {
     return CAIRO_STATUS_NO_MEMORY;
   }
+  surface->resource_gen++;
 
   return CAIRO_STATUS_SUCCESS;
 }
@@ -21,14 +21,152 @@ xmlcairo_surface_t *xmlcairo_surface_create_ps(const char *filename, double widt
 xmlcairo_surface_t *xmlcairo_surface_create_svg(const char *filename, double width_in_points, double height_in_points);
 xmlcairo_surface_t *xmlcairo_surface_create_script(const char *filename, cairo_content_t content, double width, double height);
 
+// from the attributes of e.g. the root element: <surface [type="png|pdf|ps|svg|script"] width="..." height="..."
+// [format="argb32|rgb24|a8|a1|rgb16_565|rgb30"] (png) [content="color|alpha|color-alpha"] (script)>;
+// defaults: png, argb32, color-alpha. NULL on error (with a warning on stderr for bad attributes)
+xmlcairo_surface_t *xmlcairo_surface_create_from_node(xmlNodePtr node, const char *filename);
+
+// png surfaces take their pixel buffers from a process-wide pool (4 size classes per power of two):
+// buffers of destroyed surfaces are kept, and cleared for reuse by the next surface of the same class
+// (no page faults / munmap churn for repeated canvases). bytes: max. unused memory kept (default 256 MiB),
+// 0 releases everything and disables pooling. Thread-safe
+void xmlcairo_set_image_pool_limit(unsigned long bytes);
+
 cairo_status_t xmlcairo_load_image(xmlcairo_surface_t *surface, const char *key, const char *filename);
 cairo_status_t xmlcairo_load_font(xmlcairo_surface_t *surface, const char *key, const char *filename);
+// raw data for <path src="key" format="f32xy|f64xy" [offset] [count] [ops] [ops-offset]/>:
+// local files are memory-mapped, anything else is read via xmlio
+cairo_status_t xmlcairo_load_binary(xmlcairo_surface_t *surface, const char *key, const char *filename);
 
 cairo_status_t xmlcairo_apply(xmlcairo_surface_t *surface, xmlNodePtr insn);
 cairo_status_t xmlcairo_apply_list(xmlcairo_surface_t *surface, xmlNodePtr insns);
 
+// same as xmlcairo_apply_list() on the children of the root element of filename (via xmlio), but without keeping
+// the whole document in memory: each child is parsed, applied and freed before the next one (e.g. pdf / ps
+// with many <show-page/>); the output is flushed after every <show-page/>.
+// returns CAIRO_STATUS_READ_ERROR when filename cannot be read or parsed (the pages so far are already drawn)
+cairo_status_t xmlcairo_apply_stream(xmlcairo_surface_t *surface, const char *filename);
+
+// renders the pages of insns (split at top-level <show-page/>) on num_threads threads into recording surfaces,
+// which are then replayed in order onto surface (one document: cairo still shares font subsets and images).
+// Pages may only depend on top-level <set>, <set-source>, <dash> and on definitions (<symbol>, patterns) of
+// previous pages; otherwise (top-level <clip>, open path across <show-page/>, <copy-page/>, nested <show-page/>),
+// for surfaces other than pdf / ps, with num_threads < 2, or when surface already has definitions from previous
+// calls, this is just xmlcairo_apply_list().
+// stats only record the replay (<show-page/>); trace records the workers, too
+cairo_status_t xmlcairo_apply_list_parallel(xmlcairo_surface_t *surface, xmlNodePtr insns, int num_threads);
+
+// incremental re-rendering on a retained png surface (e.g. for editors):
+// the first call renders insns fully; later calls only clear and redraw the device region where the drawing ops
+// of insns differ from those of the previous call (or everything, after xmlcairo_load_*)
+// ret_rect (can be NULL): damaged region as x, y, width, height (all 0: unchanged)
+cairo_status_t xmlcairo_apply_list_incremental(xmlcairo_surface_t *surface, xmlNodePtr insns, int ret_rect[4]);
+
 cairo_status_t xmlcairo_surface_destroy(xmlcairo_surface_t *surface);
 
+// simplify runs of <path> line segments (e.g. time series, gps tracks with millions of points) to within
+// the current tolerance (<set tolerance="..."/>, device units) of the original; default: off
+void xmlcairo_surface_set_simplify(xmlcairo_surface_t *surface, int enable);
+
+// skip <path>, <text>, <sub>, <use> and <instances> records completely outside of the current clip
+// (e.g. tiles of a large map); bounds are cached per surface. default: off; set it between renders.
+// returns 0 on malloc error
+int xmlcairo_surface_set_cull(xmlcairo_surface_t *surface, int enable);
+
+// -- memory budget
+// per surface (i.e. per render), shared with the workers of xmlcairo_apply_list_parallel()
+
+typedef enum _xmlcairo_memory_kind {
+  XMLCAIRO_MEMORY_IMAGES,  // png canvas, loaded images, <use cache="raster"/> stamps
+  XMLCAIRO_MEMORY_GLYPHS,  // glyph buffers of <text> / <labels> (upper bound: one glyph per byte)
+  XMLCAIRO_MEMORY_PATHS,   // cached path / text bounds (culling)
+  XMLCAIRO_MEMORY_DOM,     // instructions being applied (estimate: nodes, attributes, text)
+  XMLCAIRO_MEMORY_NUM_KINDS
+} xmlcairo_memory_kind_t;
+
+typedef struct _xmlcairo_limits_t {
+  unsigned long long max_memory;  // bytes, all kinds together (0: unlimited)
+  int max_dashes;                 // entries per <dash> (0: unlimited)
+} xmlcairo_limits_t;
+
+// hitting a limit fails fast: nothing more is drawn, and xmlcairo_apply*() return CAIRO_STATUS_NO_MEMORY
+// (max_memory, also for png surfaces that would not fit: NULL from xmlcairo_surface_create_png()) or
+// CAIRO_STATUS_INVALID_DASH (max_dashes), with a warning on stderr; per call, i.e. the next xmlcairo_apply*() starts over
+
+// for surfaces created afterwards; NULL: unlimited (default). Thread-safe
+void xmlcairo_set_default_limits(const xmlcairo_limits_t *limits);
+// NULL: unlimited
+void xmlcairo_surface_set_limits(xmlcairo_surface_t *surface, const xmlcairo_limits_t *limits);
+
+typedef struct _xmlcairo_memory_t {
+  unsigned long long peak[XMLCAIRO_MEMORY_NUM_KINDS];  // bytes
+  unsigned long long peak_total;  // (kinds peak at different times: not the sum of peak[])
+} xmlcairo_memory_t;
+
+// -- display-list optimizer
+
+typedef struct _xmlcairo_optimize_report_t {
+  int removed_set_attrs;  // <set> attributes: same value as before, or overridden before any drawing op used it
+  int removed_sets;       // <set> left without attributes
+  int merged_sets;        // <set> merged into the directly preceding one
+  int removed_sources;    // <set-source> overridden (or restored) before any drawing op used it
+  int flattened_subs;     // <sub> without transform and without state changes, replaced by its children
+  int removed_subs;       // <sub> without children
+} xmlcairo_optimize_report_t;
+
+// rewrites insns (as passed to xmlcairo_apply_list(), i.e. starting from cairo's default state) in place;
+// the rendered output stays identical. report (can be NULL) is reset first.
+// returns the new first node (the old one might have been removed)
+xmlNodePtr xmlcairo_optimize_list(xmlNodePtr insns, xmlcairo_optimize_report_t *report);
+
+// -- opt-in profiling
+
+typedef struct _xmlcairo_stats_t xmlcairo_stats_t;
+
+typedef enum _xmlcairo_stats_kind {
+  XMLCAIRO_STATS_ELEMENT,   // per element name, including children (<sub>) and content (<text>)
+  XMLCAIRO_STATS_ATTRIBUTE  // per attribute name, e.g. <path d="..."/> parse
+} xmlcairo_stats_kind_t;
+
+typedef struct _xmlcairo_stats_entry_t {
+  xmlcairo_stats_kind_t kind;
+  const char *name;  // valid until xmlcairo_stats_reset() / _destroy()
+  unsigned long count;
+  double total_ms;
+  double p50_ms, p99_ms, max_ms;  // (p50/p99: from log-scale histogram, ~10% resolution)
+} xmlcairo_stats_entry_t;
+
+xmlcairo_stats_t *xmlcairo_stats_create();
+void xmlcairo_stats_reset(xmlcairo_stats_t *stats);
+void xmlcairo_stats_destroy(xmlcairo_stats_t *stats);
+
+// stats is not owned and can be shared by multiple surfaces (but not across threads); NULL disables profiling
+void xmlcairo_surface_set_stats(xmlcairo_surface_t *surface, xmlcairo_stats_t *stats);
+
+int xmlcairo_stats_get_num_entries(const xmlcairo_stats_t *stats);
+// returns 0 on success, -1 when idx is out of range
+int xmlcairo_stats_get_entry(const xmlcairo_stats_t *stats, int idx, xmlcairo_stats_entry_t *ret);
+// highest memory peaks of the surfaces using stats (cf. xmlcairo_limits_t; DOM only counted with stats or max_memory);
+// returns 0 on success, -1 when stats is NULL
+int xmlcairo_stats_get_memory(const xmlcairo_stats_t *stats, xmlcairo_memory_t *ret);
+
+// -- opt-in timeline (Chrome trace event JSON, for chrome://tracing or Perfetto)
+// records resource loads, elements (with <sub> nesting) and encode; thread-safe
+
+typedef struct _xmlcairo_trace_t xmlcairo_trace_t;
+
+// filename: via xmlio; NULL on error
+xmlcairo_trace_t *xmlcairo_trace_create(const char *filename);
+// returns 0 on success, -1 on write error
+int xmlcairo_trace_destroy(xmlcairo_trace_t *trace);
+
+// trace is not owned and can be shared by multiple surfaces (also across threads); NULL disables tracing
+void xmlcairo_surface_set_trace(xmlcairo_surface_t *surface, xmlcairo_trace_t *trace);
+
+// caller spans, e.g. document parse; must nest properly per thread. trace can be NULL
+void xmlcairo_trace_begin(xmlcairo_trace_t *trace, const char *name);
+void xmlcairo_trace_end(xmlcairo_trace_t *trace);
+
 #ifdef __cplusplus
 };
 #endif